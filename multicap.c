@@ -0,0 +1,448 @@
+/*
+* multicap - capture from many V4L2 channels at once
+*
+* This program can be used and distributed without restrictions.
+*
+* Built on the videotest code (vcap.c) for the 8 to 16 channel case:
+* the channels are spread round-robin over worker threads, one per CPU
+* by default, each pinned to its CPU and waiting on all of its channels
+* with one epoll instance.  Every channel has its own ring of mmap (or
+* userptr) buffers which is requeued as soon as a frame has been
+* accounted for.
+*
+* Reports per channel and in aggregate: frames, fps, MB/s, dropped
+* frames, DQBUF latency and interval jitter, and per worker the CPU
+* time spent per frame.  A channel well below the median frame rate
+* is flagged as starved.
+*
+* Example, all eight channels of one board for a minute:
+*   multicap -d /dev/video0 ... -d /dev/video7 -s 720x576 -t 60 -j
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>		/* getopt_long() */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "vcap.h"
+#define MAX_CHANNELS 64
+#define STARVED 0.9		/* of the median frame rate */
+struct worker {
+    pthread_t thread;
+    unsigned int id;
+    int cpu;			/* -1: not pinned */
+    struct vcap *chans[MAX_CHANNELS];
+    unsigned int n_chans;
+    unsigned long wakeups;	/* epoll_wait returns */
+    double cpu_time;		/* seconds, this thread */
+};
+static struct vcap channels[MAX_CHANNELS];
+static const char *chan_names[MAX_CHANNELS];
+static unsigned int chan_worker[MAX_CHANNELS];
+static unsigned int n_channels = 0;
+static struct worker *workers;
+static unsigned int n_workers = 0;
+static int cpus[CPU_SETSIZE];
+static unsigned int n_cpus = 0;
+static struct vcap_config cfg = {
+    .io = IO_METHOD_MMAP,
+    .n_buffers = 4,
+    .width = 720,
+    .height = 576,
+    .pixelformat = V4L2_PIX_FMT_YUYV,
+    .field = V4L2_FIELD_INTERLACED,
+    .warmup = 5,
+};
+static unsigned long max_frames = 0;
+static double max_seconds = 10;
+static int json = 0;
+static pthread_barrier_t start_barrier;
+static double start_time;
+
+static double thread_cpu_seconds(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static int channel_finished(const struct vcap *c)
+{
+    if (max_frames && c->frames >= max_frames + cfg.warmup)
+	return 1;
+    return max_seconds && vcap_now() - start_time >= max_seconds;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct epoll_event ev, events[MAX_CHANNELS];
+    unsigned int i, running = w->n_chans;
+    double cpu;
+    int epfd, n;
+    if (w->cpu >= 0) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	errno = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (errno)
+	    fprintf(stderr, "worker %u: cannot pin to cpu %d: %s\n",
+		    w->id, w->cpu, strerror(errno));
+    }
+    epfd = epoll_create1(0);
+    if (-1 == epfd) {
+	perror("epoll_create1");
+	exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < w->n_chans; i++) {
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = w->chans[i];
+	if (-1 == epoll_ctl(epfd, EPOLL_CTL_ADD, w->chans[i]->fd, &ev)) {
+	    perror("epoll_ctl");
+	    exit(EXIT_FAILURE);
+	}
+    }
+    /* all channels of all workers start streaming together */
+    pthread_barrier_wait(&start_barrier);
+    cpu = thread_cpu_seconds();
+    for (i = 0; i < w->n_chans; i++)
+	vcap_start(w->chans[i]);
+    while (running) {
+	n = epoll_wait(epfd, events, w->n_chans, 2000);
+	if (-1 == n) {
+	    if (EINTR == errno)
+		continue;
+	    perror("epoll_wait");
+	    exit(EXIT_FAILURE);
+	}
+	if (0 == n) {
+	    fprintf(stderr, "worker %u: epoll timeout\n", w->id);
+	    exit(EXIT_FAILURE);
+	}
+	w->wakeups++;
+	while (n-- > 0) {
+	    struct vcap *c = events[n].data.ptr;
+/* EAGAIN - back to epoll_wait. */
+	    vcap_read_frame(c);
+	    if (!c->done && channel_finished(c)) {
+		c->done = 1;
+		epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+		running--;
+	    }
+	}
+    }
+    for (i = 0; i < w->n_chans; i++)
+	vcap_stop(w->chans[i]);
+    w->cpu_time = thread_cpu_seconds() - cpu;
+    close(epfd);
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double channel_mbps(const struct vcap *c)
+{
+    double t = c->last_dq - c->first_dq;
+    return t > 0 ? c->bytes / t / 1e6 : 0;
+}
+
+static void report(double elapsed)
+{
+    double fps[MAX_CHANNELS], median, total_fps = 0, total_mbps = 0;
+    unsigned long frames = 0, dropped = 0;
+    unsigned int i;
+    for (i = 0; i < n_channels; i++) {
+	fps[i] = vcap_fps(&channels[i]);
+	total_fps += fps[i];
+	total_mbps += channel_mbps(&channels[i]);
+	frames += channels[i].frames;
+	dropped += channels[i].dropped;
+    }
+    qsort(fps, n_channels, sizeof(fps[0]), cmp_double);
+    median = fps[n_channels / 2];
+    if (!json) {
+	if (cfg.verbose)
+	    fputc('\n', stdout);
+	for (i = 0; i < n_channels; i++) {
+	    struct vcap *c = &channels[i];
+	    printf("%-14s w%-2u %7lu frames %7.2f fps %7.2f MB/s "
+		   "%5lu dropped  lat %6.2f/%6.2f ms  jitter %6.3f ms%s\n",
+		   c->name, chan_worker[i], c->frames, vcap_fps(c),
+		   channel_mbps(c), c->dropped,
+		   vcap_stat_mean(&c->latency), c->latency.max,
+		   vcap_stat_stddev(&c->interval),
+		   vcap_fps(c) < STARVED * median ? "  STARVED" : "");
+	}
+	for (i = 0; i < n_workers; i++) {
+	    struct worker *w = &workers[i];
+	    unsigned long wf = 0;
+	    unsigned int j;
+	    for (j = 0; j < w->n_chans; j++)
+		wf += w->chans[j]->frames;
+	    printf("worker %u: cpu %d, %u channels, %.1f us cpu/frame, "
+		   "%.2f frames/wakeup\n", w->id, w->cpu, w->n_chans,
+		   wf ? w->cpu_time * 1e6 / wf : 0,
+		   w->wakeups ? (double) wf / w->wakeups : 0);
+	}
+	printf("total: %u channels, %lu frames in %.2f s, %.2f fps, "
+	       "%.2f MB/s, %lu dropped, fps min/median/max "
+	       "%.2f/%.2f/%.2f\n", n_channels, frames, elapsed, total_fps,
+	       total_mbps, dropped, fps[0], median, fps[n_channels - 1]);
+	return;
+    }
+    printf("{\n  \"io\": \"%s\",\n  \"buffers\": %u,\n"
+	   "  \"elapsed_s\": %.3f,\n  \"channels\": %u,\n"
+	   "  \"frames\": %lu,\n  \"fps\": %.3f,\n  \"mbps\": %.3f,\n"
+	   "  \"dropped\": %lu,\n  \"fps_min\": %.3f,\n"
+	   "  \"fps_median\": %.3f,\n  \"fps_max\": %.3f,\n"
+	   "  \"per_channel\": [\n", vcap_io_name[cfg.io], cfg.n_buffers,
+	   elapsed, n_channels, frames, total_fps, total_mbps, dropped,
+	   fps[0], median, fps[n_channels - 1]);
+    for (i = 0; i < n_channels; i++) {
+	struct vcap *c = &channels[i];
+	printf("    {\"device\": \"%s\", \"worker\": %u, "
+	       "\"width\": %u, \"height\": %u, \"fourcc\": \"%.4s\", "
+	       "\"frames\": %lu, \"fps\": %.3f, \"mbps\": %.3f, "
+	       "\"dropped\": %lu, \"errors\": %lu, "
+	       "\"latency_ms_mean\": %.3f, \"latency_ms_max\": %.3f, "
+	       "\"interval_ms_mean\": %.3f, \"jitter_ms\": %.3f, "
+	       "\"starved\": %s}%s\n", c->name, chan_worker[i],
+	       c->fmt.fmt.pix.width, c->fmt.fmt.pix.height,
+	       (char *) &c->fmt.fmt.pix.pixelformat, c->frames,
+	       vcap_fps(c), channel_mbps(c), c->dropped, c->errors,
+	       vcap_stat_mean(&c->latency), c->latency.max,
+	       vcap_stat_mean(&c->interval),
+	       vcap_stat_stddev(&c->interval),
+	       vcap_fps(c) < STARVED * median ? "true" : "false",
+	       i + 1 < n_channels ? "," : "");
+    }
+    printf("  ],\n  \"workers\": [\n");
+    for (i = 0; i < n_workers; i++) {
+	struct worker *w = &workers[i];
+	unsigned long wf = 0;
+	unsigned int j;
+	for (j = 0; j < w->n_chans; j++)
+	    wf += w->chans[j]->frames;
+	printf("    {\"worker\": %u, \"cpu\": %d, \"channels\": %u, "
+	       "\"cpu_us_per_frame\": %.2f, \"frames_per_wakeup\": %.3f}"
+	       "%s\n", w->id, w->cpu, w->n_chans,
+	       wf ? w->cpu_time * 1e6 / wf : 0,
+	       w->wakeups ? (double) wf / w->wakeups : 0,
+	       i + 1 < n_workers ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+static int parse_cpus(const char *list)
+{
+    char *copy = strdup(list), *tok, *save;
+    int a, b;
+    for (tok = strtok_r(copy, ",", &save); tok;
+	 tok = strtok_r(NULL, ",", &save)) {
+	if (2 == sscanf(tok, "%d-%d", &a, &b)) {
+	    for (; a <= b && n_cpus < CPU_SETSIZE; a++)
+		cpus[n_cpus++] = a;
+	} else if (1 == sscanf(tok, "%d", &a) && n_cpus < CPU_SETSIZE) {
+	    cpus[n_cpus++] = a;
+	} else {
+	    free(copy);
+	    return -1;
+	}
+    }
+    free(copy);
+    return 0;
+}
+
+static void usage(FILE * fp, int argc, char **argv)
+{
+    fprintf(fp,
+	    "Usage: %s [options] -d /dev/videoN [-d /dev/videoM ...]\n\n"
+	    "Options:\n"
+	    "-d | --device name   Video device, repeat for each channel\n"
+	    "-h | --help          Print this message\n"
+	    "-u | --userp         Use application allocated buffers\n"
+	    "                     (default: an mmap ring per channel)\n"
+	    "-b | --buffers n     Buffers per channel [4]\n"
+	    "-f | --format fourcc Pixel format [YUYV]\n"
+	    "-s | --size WxH      Image size [720x576]\n"
+	    "-F | --field name    interlaced, top, bottom, seq-tb, seq-bt,\n"
+	    "                     alternate, any [interlaced]\n"
+	    "-T | --threads n     Worker threads [one per cpu, at most one\n"
+	    "                     per channel]\n"
+	    "-c | --cpus list     Pin workers to these cpus, e.g. 0-3,8\n"
+	    "                     [0, 1, 2, ...]; -c none to not pin\n"
+	    "-n | --frames n      Stop each channel after n frames\n"
+	    "-t | --time secs     Stop after this long [10]\n"
+	    "-w | --warmup n      Frames to skip before measuring [5]\n"
+	    "-j | --json          Report in JSON\n"
+	    "-v | --verbose       Print a dot per frame\n"
+	    "", argv[0]);
+}
+
+static const char short_options[] = "d:hub:f:s:F:T:c:n:t:w:jv";
+static const struct option long_options[] = {
+    {"device", required_argument, NULL, 'd'},
+    {"help", no_argument, NULL, 'h'},
+    {"userp", no_argument, NULL, 'u'},
+    {"buffers", required_argument, NULL, 'b'},
+    {"format", required_argument, NULL, 'f'},
+    {"size", required_argument, NULL, 's'},
+    {"field", required_argument, NULL, 'F'},
+    {"threads", required_argument, NULL, 'T'},
+    {"cpus", required_argument, NULL, 'c'},
+    {"frames", required_argument, NULL, 'n'},
+    {"time", required_argument, NULL, 't'},
+    {"warmup", required_argument, NULL, 'w'},
+    {"json", no_argument, NULL, 'j'},
+    {"verbose", no_argument, NULL, 'v'},
+    {0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+    unsigned int i, threads = 0;
+    int pin = 1;
+    double elapsed;
+    for (;;) {
+	int index;
+	int c;
+	c = getopt_long(argc, argv, short_options, long_options, &index);
+	if (-1 == c)
+	    break;
+	switch (c) {
+	    case 0:		/* getopt_long() flag */
+		break;
+	    case 'd':
+		if (n_channels == MAX_CHANNELS) {
+		    fprintf(stderr, "at most %d channels\n", MAX_CHANNELS);
+		    exit(EXIT_FAILURE);
+		}
+		chan_names[n_channels++] = optarg;
+		break;
+	    case 'h':
+		usage(stdout, argc, argv);
+		exit(EXIT_SUCCESS);
+	    case 'u':
+		cfg.io = IO_METHOD_USERPTR;
+		break;
+	    case 'b':
+		cfg.n_buffers = strtoul(optarg, NULL, 0);
+		if (cfg.n_buffers < 2)
+		    cfg.n_buffers = 2;
+		break;
+	    case 'f':
+		if (strlen(optarg) != 4) {
+		    fprintf(stderr, "format must be a fourcc\n");
+		    exit(EXIT_FAILURE);
+		}
+		cfg.pixelformat = v4l2_fourcc(optarg[0], optarg[1],
+					      optarg[2], optarg[3]);
+		break;
+	    case 's':
+		if (2 != sscanf(optarg, "%ux%u", &cfg.width, &cfg.height)) {
+		    fprintf(stderr, "size must be WIDTHxHEIGHT\n");
+		    exit(EXIT_FAILURE);
+		}
+		break;
+	    case 'F':
+		if (vcap_parse_field(optarg, &cfg.field)) {
+		    fprintf(stderr, "unknown field order '%s'\n", optarg);
+		    exit(EXIT_FAILURE);
+		}
+		break;
+	    case 'T':
+		threads = strtoul(optarg, NULL, 0);
+		break;
+	    case 'c':
+		if (!strcmp(optarg, "none"))
+		    pin = 0;
+		else if (parse_cpus(optarg)) {
+		    fprintf(stderr, "bad cpu list '%s'\n", optarg);
+		    exit(EXIT_FAILURE);
+		}
+		break;
+	    case 'n':
+		max_frames = strtoul(optarg, NULL, 0);
+		break;
+	    case 't':
+		max_seconds = strtod(optarg, NULL);
+		break;
+	    case 'w':
+		cfg.warmup = strtoul(optarg, NULL, 0);
+		break;
+	    case 'j':
+		json = 1;
+		break;
+	    case 'v':
+		cfg.verbose = 1;
+		break;
+	    default:
+		usage(stderr, argc, argv);
+		exit(EXIT_FAILURE);
+	}
+    }
+    if (0 == n_channels) {
+	usage(stderr, argc, argv);
+	exit(EXIT_FAILURE);
+    }
+    if (0 == max_frames && 0 == max_seconds) {
+	fprintf(stderr, "need --frames or --time\n");
+	exit(EXIT_FAILURE);
+    }
+    if (0 == n_cpus)
+	for (i = 0; i < (unsigned int) sysconf(_SC_NPROCESSORS_ONLN) &&
+	     i < CPU_SETSIZE; i++)
+	    cpus[n_cpus++] = i;
+    if (0 == threads)
+	threads = n_cpus;
+    if (threads > n_channels)
+	threads = n_channels;
+    n_workers = threads;
+    workers = calloc(n_workers, sizeof(*workers));
+    if (!workers) {
+	fprintf(stderr, "Out of memory\n");
+	exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n_workers; i++) {
+	workers[i].id = i;
+	workers[i].cpu = pin ? cpus[i % n_cpus] : -1;
+    }
+    for (i = 0; i < n_channels; i++) {
+	struct worker *w = &workers[i % n_workers];
+	vcap_open(&channels[i], chan_names[i], &cfg);
+	w->chans[w->n_chans++] = &channels[i];
+	chan_worker[i] = w->id;
+    }
+    pthread_barrier_init(&start_barrier, NULL, n_workers + 1);
+    for (i = 0; i < n_workers; i++) {
+	errno = pthread_create(&workers[i].thread, NULL, worker_main,
+			       &workers[i]);
+	if (errno) {
+	    perror("pthread_create");
+	    exit(EXIT_FAILURE);
+	}
+    }
+    start_time = vcap_now();
+    pthread_barrier_wait(&start_barrier);
+    for (i = 0; i < n_workers; i++)
+	pthread_join(workers[i].thread, NULL);
+    elapsed = vcap_now() - start_time;
+    for (i = 0; i < n_channels; i++)
+	vcap_close(&channels[i]);
+    report(elapsed);
+    free(workers);
+    exit(EXIT_SUCCESS);
+    return 0;
+}
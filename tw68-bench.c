@@ -0,0 +1,229 @@
+/*
+ *  tw68-bench.c - time RISC program generation in tw68-risc.c
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Times tw68_risc_frame() for every entry of formats[], every field
+ * order buffer_prepare() accepts, a set of common sizes and several
+ * shapes of scatter-gather list, and reports per case
+ *
+ *	ns		mean time to build one program
+ *	insns		instructions emitted, including the final jump
+ *	alloc, used	bytes of btcx_riscmem asked for and actually used
+ *	sg		entries in the scatter-gather list
+ *
+ * as JSON (default) or CSV (-c).  Allocation here is malloc(), not
+ * pci_alloc_consistent(), so ns is the cost of the emitter itself.
+ *
+ * Usage: tw68-bench [-c] [-t msecs per case]
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tw68-shim.h"
+#include "tw68-formats.h"
+
+#define	FORMATS		(sizeof(formats) / sizeof(formats[0]))
+#define	MAX_PAGES	1024
+
+static const struct {
+	enum v4l2_field	field;
+	const char	*name;
+	int		one_field;	/* only one field's worth of lines */
+} fields[] = {
+	{ V4L2_FIELD_TOP,	 "top",	       1 },
+	{ V4L2_FIELD_BOTTOM,	 "bottom",     1 },
+	{ V4L2_FIELD_INTERLACED, "interlaced", 0 },
+	{ V4L2_FIELD_SEQ_TB,	 "seq-tb",     0 },
+	{ V4L2_FIELD_SEQ_BT,	 "seq-bt",     0 },
+	{ V4L2_FIELD_ALTERNATE,	 "alternate",  1 },
+};
+
+static const struct {
+	unsigned int	width, height;
+} sizes[] = {
+	{ 720, 576 }, { 720, 480 }, { 640, 480 }, { 352, 288 }, { 176, 144 },
+};
+
+/*
+ * contig	one entry (a physically contiguous buffer)
+ * pages	one page per entry, as for a vmalloc'ed mmap buffer
+ * userptr	one page per entry, not starting on a page boundary
+ * merged	runs of 1 to 4 pages, as an IOMMU may merge them
+ */
+enum sgshape { SG_CONTIG, SG_PAGES, SG_USERPTR, SG_MERGED, SG_SHAPES };
+static const char *sgshape_name[] = { "contig", "pages", "userptr",
+				      "merged" };
+
+static uint32_t next_dma = 0x10000;
+
+void tw68_shim_bug(const char *file, int line, const char *cond)
+{
+	fprintf(stderr, "BUG at %s:%d: %s\n", file, line, cond);
+	exit(1);
+}
+
+int btcx_riscmem_alloc(struct pci_dev *pci, struct btcx_riscmem *risc,
+		       unsigned int size)
+{
+	if (NULL != risc->cpu && risc->size < size)
+		btcx_riscmem_free(pci, risc);
+	if (NULL == risc->cpu) {
+		risc->cpu = malloc(size);
+		if (NULL == risc->cpu)
+			return -ENOMEM;
+		risc->size = size;
+		risc->dma = next_dma;
+		next_dma += (size + 7) & ~7;
+	}
+	return 0;
+}
+
+void btcx_riscmem_free(struct pci_dev *pci, struct btcx_riscmem *risc)
+{
+	free(risc->cpu);
+	memset(risc, 0, sizeof(*risc));
+}
+
+/* bus addresses only matter for where the page borders are */
+static int build_sg(enum sgshape shape, unsigned int size,
+		    struct scatterlist *sg)
+{
+	unsigned int offset = SG_USERPTR == shape ? 0xa40 : 0;
+	unsigned int npages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+	unsigned int i, n = 0, run;
+	uint32_t addr = 0x1000000;
+
+	for (i = 0; i < npages; i += run) {
+		switch (shape) {
+		case SG_CONTIG:
+			run = npages;
+			break;
+		case SG_MERGED:
+			run = 1 + (i * 7 + 3) % 4;
+			if (run > npages - i)
+				run = npages - i;
+			break;
+		default:
+			run = 1;
+			break;
+		}
+		sg[n].dma_address = addr;
+		sg[n++].dma_length = run * PAGE_SIZE;
+		addr += (run + 1) * PAGE_SIZE;		/* leave a hole */
+	}
+	sg[0].dma_address += offset;
+	sg[0].dma_length -= offset;
+	return n;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	static struct scatterlist sg[MAX_PAGES];
+	struct btcx_riscmem risc;
+	unsigned int f, fl, sz, sh, height, bpl, nsg, iters, insns, used;
+	uint64_t budget = 10000000, t0, t;
+	int c, csv = 0, first = 1;
+
+	while ((c = getopt(argc, argv, "ct:")) != -1) {
+		switch (c) {
+		case 'c':
+			csv = 1;
+			break;
+		case 't':
+			budget = strtoull(optarg, NULL, 0) * 1000000;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-c] [-t msecs]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (csv)
+		printf("format,fourcc,depth,width,height,field,sg,sg_entries,"
+		       "iterations,ns,insns,alloc,used\n");
+	else
+		printf("[\n");
+
+	for (f = 0; f < FORMATS; f++)
+	for (fl = 0; fl < sizeof(fields) / sizeof(fields[0]); fl++)
+	for (sz = 0; sz < sizeof(sizes) / sizeof(sizes[0]); sz++)
+	for (sh = 0; sh < SG_SHAPES; sh++) {
+		height = sizes[sz].height;
+		if (fields[fl].one_field)
+			height >>= 1;
+		bpl = sizes[sz].width * formats[f].depth / 8;
+		nsg = build_sg(sh, bpl * height, sg);
+
+		/* every program is built from scratch, as for a new buffer */
+		memset(&risc, 0, sizeof(risc));
+		iters = 0;
+		t0 = now_ns();
+		do {
+			if (tw68_risc_frame(NULL, &risc, sg, fields[fl].field,
+					    bpl, bpl, height) < 0) {
+				fprintf(stderr, "tw68_risc_frame failed\n");
+				return 1;
+			}
+			insns = (risc.jmp - risc.cpu) / 2 + 1;
+			used = (risc.jmp - risc.cpu + 2) * sizeof(*risc.cpu);
+			if (++iters & 15)
+				btcx_riscmem_free(NULL, &risc);
+			else if ((t = now_ns() - t0) >= budget)
+				break;
+			else
+				btcx_riscmem_free(NULL, &risc);
+		} while (1);
+
+		if (csv)
+			printf("\"%s\",\"%.4s\",%u,%u,%u,%s,%s,%u,%u,%.1f,"
+			       "%u,%u,%u\n", formats[f].name,
+			       (char *)&formats[f].fourcc, formats[f].depth,
+			       sizes[sz].width, height, fields[fl].name,
+			       sgshape_name[sh], nsg, iters,
+			       (double)t / iters, insns, risc.size, used);
+		else
+			printf("%s  {\"format\": \"%s\", \"fourcc\": \"%.4s\", "
+			       "\"depth\": %u, \"width\": %u, \"height\": %u, "
+			       "\"field\": \"%s\", \"sg\": \"%s\", "
+			       "\"sg_entries\": %u, \"iterations\": %u, "
+			       "\"ns\": %.1f, \"insns\": %u, \"alloc\": %u, "
+			       "\"used\": %u}", first ? "" : ",\n",
+			       formats[f].name, (char *)&formats[f].fourcc,
+			       formats[f].depth, sizes[sz].width, height,
+			       fields[fl].name, sgshape_name[sh], nsg, iters,
+			       (double)t / iters, insns, risc.size, used);
+		first = 0;
+		btcx_riscmem_free(NULL, &risc);
+	}
+	if (!csv)
+		printf("\n]\n");
+	return 0;
+}
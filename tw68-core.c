@@ -38,6 +38,10 @@
 #include <linux/mutex.h>
 #include <linux/dma-mapping.h>
 #include <linux/pm.h>
+#include <linux/highmem.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/math64.h>
 
 #include <media/v4l2-dev.h>
 #include "tw68.h"
@@ -67,23 +71,54 @@ static unsigned int nocomb;
 module_param(nocomb, int, 0644);
 MODULE_PARM_DESC(nocomb, "disable comb filter");
 
+static unsigned int powersave = 1;
+module_param(powersave, int, 0644);
+MODULE_PARM_DESC(powersave, "power down the decoder while not capturing "
+		 "(the next capture then waits for the decoder to lock), "
+		 "default 1");
+
+static unsigned int buffer_mem = 4;
+module_param(buffer_mem, int, 0644);
+MODULE_PARM_DESC(buffer_mem, "MB of capture buffers per open file, "
+		 "bounding how many buffers REQBUFS grants (1-1024)");
+
+static unsigned int pci_budget;
+module_param(pci_budget, int, 0644);
+MODULE_PARM_DESC(pci_budget, "MB/s the capture streams of all the cards on "
+		 "a PCI bus may take together, checked at STREAMON, S_FMT "
+		 "and read() (0 for no limit)");
+
+static unsigned int fifo_level = 0x20;
+module_param(fifo_level, int, 0644);
+MODULE_PARM_DESC(fifo_level, "DMA FIFO level for bus requests, and the "
+		 "highest fifo_adapt raises it to [0x20]");
+
+static unsigned int fifo_adapt = 1;
+module_param(fifo_adapt, int, 0644);
+MODULE_PARM_DESC(fifo_adapt, "lower the DMA FIFO level on overflows, raise "
+		 "it again once quiet");
+
 static unsigned int video_nr[] = {[0 ... (TW68_MAXBOARDS - 1)] = UNSET };
 static unsigned int vbi_nr[]   = {[0 ... (TW68_MAXBOARDS - 1)] = UNSET };
 static unsigned int radio_nr[] = {[0 ... (TW68_MAXBOARDS - 1)] = UNSET };
 static unsigned int tuner[]    = {[0 ... (TW68_MAXBOARDS - 1)] = UNSET };
 static unsigned int card[]     = {[0 ... (TW68_MAXBOARDS - 1)] = UNSET };
+static unsigned int group[]    = {[0 ... (TW68_MAXBOARDS - 1)] = 0 };
 
 module_param_array(video_nr, int, NULL, 0444);
 module_param_array(vbi_nr,   int, NULL, 0444);
 module_param_array(radio_nr, int, NULL, 0444);
 module_param_array(tuner,    int, NULL, 0444);
 module_param_array(card,     int, NULL, 0444);
+module_param_array(group,    int, NULL, 0444);
 
 MODULE_PARM_DESC(video_nr, "video device number");
 MODULE_PARM_DESC(vbi_nr,   "vbi device number");
 MODULE_PARM_DESC(radio_nr, "radio device number");
 MODULE_PARM_DESC(tuner,    "tuner type");
 MODULE_PARM_DESC(card,     "card type");
+MODULE_PARM_DESC(group,    "capture group (0 for none): the members "
+		 "start together and number their frames alike");
 
 LIST_HEAD(tw68_devlist);
 EXPORT_SYMBOL(tw68_devlist);
@@ -102,19 +137,73 @@ EXPORT_SYMBOL(tw68_dmasound_exit);
 
 /* ------------------------------------------------------------------ */
 
+/*
+ * tw68_buf_track / tw68_buf_untrack
+ *
+ * Keep dev->risc_bufs listing the video buffers which have a program,
+ * so that debugfs can show any of them.  A buffer is taken off before
+ * its program is rebuilt or freed.
+ */
+void tw68_buf_track(struct tw68_dev *dev, struct tw68_buf *buf)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->slock, flags);
+	if (!buf->risc_listed) {
+		list_add_tail(&buf->risc_list, &dev->risc_bufs);
+		buf->risc_listed = 1;
+	}
+	spin_unlock_irqrestore(&dev->slock, flags);
+}
+
+void tw68_buf_untrack(struct tw68_dev *dev, struct tw68_buf *buf)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->slock, flags);
+	if (buf->risc_listed) {
+		list_del(&buf->risc_list);
+		buf->risc_listed = 0;
+	}
+	spin_unlock_irqrestore(&dev->slock, flags);
+}
+
 void tw68_dma_free(struct videobuf_queue *q, struct tw68_buf *buf)
 {
 	struct videobuf_dmabuf *dma = videobuf_to_dma(&buf->vb);
+	struct tw68_dmaqueue *dmaq = buf->dmaq;
+	struct tw68_fh *fh = q->priv_data;
+	unsigned long flags;
 	
 	if (core_debug & DBG_FLOW)
 		printk(KERN_DEBUG "%s: called\n", __func__);
 	BUG_ON(in_interrupt());
 
+	/*
+	 * Take the buffer away from any readers sharing it.  They hold
+	 * references of their own on the pages they copy, and look at the
+	 * buffer only while its tap_gen is unchanged (see
+	 * tw68_dma_copy_to_user), so there is nothing to wait for.
+	 */
+	if (dmaq) {
+		spin_lock_irqsave(&dmaq->dev->slock, flags);
+		if (dmaq->last == buf)
+			dmaq->last = NULL;
+		dmaq->tap_gen[buf->vb.i]++;
+		spin_unlock_irqrestore(&dmaq->dev->slock, flags);
+	}
+
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,36)
 	videobuf_waiton(&buf->vb, 0, 0);
 #else
 	videobuf_waiton(q, &buf->vb, 0, 0);
 #endif
+	tw68_buf_untrack(fh->dev, buf);
+	/* userptr pages may be kept pinned for the next use */
+	if (tw68_userptr_put(fh, buf)) {
+		buf->vb.state = VIDEOBUF_NEEDS_INIT;
+		return;
+	}
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,35)	
 	videobuf_dma_unmap(q, dma);
 #else
@@ -185,15 +274,16 @@ int tw68_buffer_requeue(struct tw68_dev *dev,
 		/* if nothing precedes this one */
 		if (NULL == prev) {
 			list_move_tail(&buf->vb.queue, &q->active);
-			q->start_dma(dev, q, buf);
 			buf->activate(dev, buf, NULL);
+			q->start_dma(dev, q, buf);
 			dprintk(DBG_BUFF, "%s: [%p/%d] first active\n",
 				__func__, buf, buf->vb.i);
 
 		} else if (q->buf_compat(prev, buf) &&
 			   (prev->fmt == buf->fmt)) {
 			list_move_tail(&buf->vb.queue, &q->active);
-			buf->activate(dev, buf, NULL);
+			buf->activate(dev, buf, prev);
+			wmb();
 			prev->risc.jmp[1] = cpu_to_le32(buf->risc.dma);
 			dprintk(DBG_BUFF, "%s: [%p/%d] move to active\n",
 				__func__, buf, buf->vb.i);
@@ -214,18 +304,278 @@ static int tw68_buffer_pages(int size)
 	return size;
 }
 
-/* calc max # of buffers from size (must not exceed the 4MB virtual
- * address space per DMA channel) */
+/* calc max # of buffers from size, within buffer_mem: a QCIF buffer is a
+ * sixteenth of a D1 one, so the same memory holds a much deeper queue.
+ * 0 if not even one fits, which the callers turn into ENOMEM.
+ * buffer_mem is writable at any time, so it is clamped before the shift
+ * (VIDEO_MAX_FRAME D1 buffers fit well within the upper bound). */
 int tw68_buffer_count(unsigned int size, unsigned int count)
 {
 	unsigned int maxcount;
 
-	maxcount = 1024 / tw68_buffer_pages(size);
+	maxcount = (clamp(buffer_mem, 1U, 1024U) << (20 - 12)) /
+		   tw68_buffer_pages(size);
 	if (count > maxcount)
 		count = maxcount;
+	if (count > VIDEO_MAX_FRAME)
+		count = VIDEO_MAX_FRAME;
 	return count;
 }
 
+/*
+ * PCI bandwidth
+ *
+ * Every chip on a PCI segment shares its bandwidth, and when a chip
+ * can't get the bus in time its FIFO overflows and the frame gets a
+ * band of stale lines, with nothing else to show for it.  So with
+ * pci_budget set, each capture stream reserves what it will take at
+ * STREAMON, again at each S_FMT while streaming, and for each read()
+ * capture, and is refused (ENOSPC) if that would take the streams on
+ * its bus beyond the budget.  Reservations are in KB/s (1000 bytes),
+ * held by the file handle capturing, summed up per device in
+ * dev->bw_kbps, and kept under tw68_devlist_lock.  The frame rate is
+ * the standard's, so S_STD checks those of the device again.
+ */
+
+static unsigned int bw_demand(struct tw68_tvnorm *norm,
+			      struct tw68_format *fmt, unsigned int width,
+			      unsigned int height, enum v4l2_field field)
+{
+	/* buffers a second: a frame (or one field of it) per frame,
+	 * except with ALTERNATE which takes both fields in turn */
+	unsigned int rate = (norm->id & V4L2_STD_525_60) ? 30 : 25;
+
+	if (V4L2_FIELD_ALTERNATE == field)
+		rate *= 2;
+	return div_u64((u64)width * height * fmt->depth * rate, 8 * 1000);
+}
+
+/* KB/s of a stream of @fmt buffers @width by @height, in @field order */
+unsigned int tw68_bw_demand(struct tw68_dev *dev, struct tw68_format *fmt,
+			    unsigned int width, unsigned int height,
+			    enum v4l2_field field)
+{
+	return bw_demand(dev->tvnorm, fmt, width, height, field);
+}
+
+/* the budget in KB/s, 0 for none */
+static unsigned int bw_budget(void)
+{
+	/* anything that would overflow is more than any bus carries */
+	return min(pci_budget, UINT_MAX / 1000) * 1000;
+}
+
+/* KB/s reserved on the bus of @dev; under tw68_devlist_lock */
+static unsigned int bw_used(struct tw68_dev *dev)
+{
+	struct tw68_dev *d;
+	unsigned int used = 0;
+
+	list_for_each_entry(d, &tw68_devlist, devlist)
+		if (d->pci->bus == dev->pci->bus)
+			used += d->bw_kbps;
+	return used;
+}
+
+static void bw_refuse(struct tw68_dev *dev, unsigned int kbps,
+		      unsigned int used, unsigned int budget)
+{
+	printk(KERN_INFO "%s: stream needs %u KB/s, %u of the %u KB/s "
+	       "of pci_budget are left on bus %02x: try a smaller "
+	       "size, a 16 bit format or a single field\n",
+	       dev->name, kbps, used < budget ? budget - used : 0,
+	       budget, dev->pci->bus->number);
+}
+
+/* have @fh hold @kbps, in place of what it held so far */
+int tw68_bw_reserve(struct tw68_fh *fh, unsigned int kbps)
+{
+	struct tw68_dev *dev = fh->dev;
+	unsigned int used, budget = bw_budget();
+	int err = 0;
+
+	mutex_lock(&tw68_devlist_lock);
+	used = bw_used(dev) - fh->bw_kbps;
+	if (budget && used + kbps > budget) {
+		bw_refuse(dev, kbps, used, budget);
+		err = -ENOSPC;
+	} else {
+		dev->bw_kbps += kbps - fh->bw_kbps;
+		fh->bw_kbps = kbps;
+		if (list_empty(&fh->bw_list))
+			list_add_tail(&fh->bw_list, &dev->bw_fhs);
+		dprintk(DBG_FLOW, "%s: %u KB/s reserved, %u on the bus\n",
+			__func__, kbps, used + kbps);
+	}
+	mutex_unlock(&tw68_devlist_lock);
+	return err;
+}
+
+void tw68_bw_release(struct tw68_fh *fh)
+{
+	mutex_lock(&tw68_devlist_lock);
+	if (!list_empty(&fh->bw_list)) {
+		fh->dev->bw_kbps -= fh->bw_kbps;
+		fh->bw_kbps = 0;
+		list_del_init(&fh->bw_list);
+	}
+	mutex_unlock(&tw68_devlist_lock);
+}
+
+/*
+ * Before switching @dev to @norm: the reservations of its file handles
+ * at the new frame rate, or ENOSPC (and none changed) if they no longer
+ * fit the budget.
+ */
+int tw68_bw_renorm(struct tw68_dev *dev, struct tw68_tvnorm *norm)
+{
+	struct tw68_fh *fh;
+	unsigned int used, kbps = 0, budget = bw_budget();
+	int err = 0;
+
+	mutex_lock(&tw68_devlist_lock);
+	list_for_each_entry(fh, &dev->bw_fhs, bw_list)
+		kbps += bw_demand(norm, fh->fmt, fh->width, fh->height,
+				  fh->cap.field);
+	used = bw_used(dev) - dev->bw_kbps;
+	if (budget && used + kbps > budget) {
+		bw_refuse(dev, kbps, used, budget);
+		err = -ENOSPC;
+	} else {
+		list_for_each_entry(fh, &dev->bw_fhs, bw_list)
+			fh->bw_kbps = bw_demand(norm, fh->fmt, fh->width,
+						fh->height, fh->cap.field);
+		dev->bw_kbps = kbps;
+	}
+	mutex_unlock(&tw68_devlist_lock);
+	return err;
+}
+
+/* let the owner of a finished (or failed) buffer know about it */
+static void tw68_buf_done(struct tw68_buf *buf)
+{
+	if (NULL == buf->fh)
+		return;
+	atomic_inc(&buf->fh->done_cnt);
+	wake_up(&buf->fh->done_wait);
+}
+
+/*
+ * Frames which went by since the previous completion without being
+ * captured, typically because the DMA sat in the stopper waiting for
+ * a buffer.  Judged from the time elapsed and the frame period of the
+ * current norm, so that the gap shows up in v4l2_buffer.sequence.
+ */
+static unsigned int tw68_frames_missed(struct tw68_dmaqueue *q,
+				       struct timeval *now)
+{
+	struct tw68_dev *dev = q->dev;
+	unsigned int period, missed = 0;
+	s64 elapsed;
+
+	if (q->last_ts.tv_sec || q->last_ts.tv_usec) {
+		period = (dev->tvnorm->id & V4L2_STD_525_60) ? 33367 : 40000;
+		elapsed = (s64)(now->tv_sec - q->last_ts.tv_sec) * 1000000 +
+			  now->tv_usec - q->last_ts.tv_usec;
+		if (elapsed > period + period / 2)
+			missed = div_u64(elapsed + period / 2, period) - 1;
+	}
+	q->last_ts = *now;
+	return missed;
+}
+
+/*
+ * DMA FIFO level
+ *
+ * The chip asks for the bus once its FIFO holds dev->fifo_level worth
+ * of data (DMAC bits 15:8).  The higher the level, the longer and
+ * fewer its bursts, but the less slack is left for when the bus is
+ * slow to come: on a busy segment that shows as FFOF/FFERR interrupts
+ * and a band of stale lines.  So the level starts at fifo_level, is
+ * lowered a step on the first overflow of any second, and is raised a
+ * step again after fifo_hold quiet seconds.  An overflow in the second
+ * after a raise doubles fifo_hold, so that a bus which only copes with
+ * the lower level isn't tried every few seconds.
+ */
+static unsigned int tw68_fifo_ceiling(void)
+{
+	return clamp_t(unsigned int, fifo_level, TW68_FIFO_LEVEL_MIN, 0xff);
+}
+
+static void tw68_fifo_set(struct tw68_dev *dev, unsigned int level)
+{
+	dev->fifo_level = level;
+	tw_andorl(TW68_DMAC, TW68_FIFO_LEVEL_MASK,
+		  level << TW68_FIFO_LEVEL_SHIFT);
+}
+
+/*
+ * Called on every video completion and every FIFO interrupt, under
+ * dev->slock: closes the current second once it is over.  The
+ * interrupts keep the level going down in an overflow storm which
+ * completes no buffers.
+ */
+static void tw68_fifo_tune(struct tw68_dev *dev)
+{
+	unsigned int ceiling = tw68_fifo_ceiling();
+
+	if (time_before(jiffies, dev->fifo_second))
+		return;
+	dev->fifo_second = jiffies + HZ;
+	dev->fifo_trial = 0;
+	if (dev->fifo_events) {
+		dev->fifo_events = 0;
+		dev->fifo_quiet = 0;
+		return;
+	}
+	/* not adapting, or fifo_level was changed below the level in use */
+	if (!fifo_adapt || dev->fifo_level > ceiling) {
+		if (dev->fifo_level != ceiling)
+			tw68_fifo_set(dev, ceiling);
+		return;
+	}
+	if (dev->fifo_level == ceiling || ++dev->fifo_quiet < dev->fifo_hold)
+		return;
+	dev->fifo_quiet = 0;
+	dev->fifo_trial = 1;
+	tw68_fifo_set(dev, min(dev->fifo_level + TW68_FIFO_LEVEL_STEP,
+			       ceiling));
+	dev->fifo_raised++;
+	dprintk(DBG_UNUSUAL, "%s: FIFO level raised to 0x%02x\n",
+		__func__, dev->fifo_level);
+}
+
+/* called by tw68_irq_video_done, under dev->slock */
+void tw68_fifo_event(struct tw68_dev *dev, u32 status)
+{
+	if (status & TW68_FFOF)
+		dev->fifo_ffof++;
+	if (status & TW68_FFERR)
+		dev->fifo_fferr++;
+	tw68_fifo_tune(dev);
+	if (dev->fifo_events++ || !fifo_adapt)
+		return;
+	if (dev->fifo_trial && dev->fifo_hold < TW68_FIFO_HOLD_MAX)
+		dev->fifo_hold *= 2;
+	dev->fifo_trial = 0;
+	if (dev->fifo_level <= TW68_FIFO_LEVEL_MIN)
+		return;
+	tw68_fifo_set(dev, max_t(unsigned int, TW68_FIFO_LEVEL_MIN,
+				 dev->fifo_level - TW68_FIFO_LEVEL_STEP));
+	dev->fifo_lowered++;
+	dprintk(DBG_UNUSUAL, "%s: FIFO level lowered to 0x%02x\n",
+		__func__, dev->fifo_level);
+}
+
+/* called at STREAMON, under dev->slock: the first second starts now */
+void tw68_fifo_start(struct tw68_dev *dev)
+{
+	dev->fifo_second = jiffies + HZ;
+	dev->fifo_events = 0;
+	dev->fifo_quiet = 0;
+	dev->fifo_trial = 0;
+}
+
 /*
  * tw68_wakeup
  *
@@ -236,6 +586,7 @@ void tw68_wakeup(struct tw68_dmaqueue *q, unsigned int *fc)
 {
 	struct tw68_dev *dev = q->dev;
 	struct tw68_buf *buf;
+	unsigned int missed;
 
 	dprintk(DBG_FLOW, "%s: called\n", __func__);
 	if (list_empty(&q->active)) {
@@ -246,13 +597,232 @@ void tw68_wakeup(struct tw68_dmaqueue *q, unsigned int *fc)
 	}
 	buf = list_entry(q->active.next, struct tw68_buf, vb.queue);
 	do_gettimeofday(&buf->vb.ts);
-	buf->vb.field_count = (*fc)++;
+	/*
+	 * field_count counts fields (videobuf reports field_count / 2 as
+	 * the sequence number), and a frame buffer takes two of them.
+	 * A field buffer of an ALTERNATE stream takes one: even counts
+	 * for top fields, odd for bottom, so both fields of a frame
+	 * share a sequence number.
+	 */
+	missed = tw68_frames_missed(q, &buf->vb.ts);
+	/*
+	 * While scanning inputs, every buffer waits out the settle
+	 * fields after its input switch: those frames were skipped on
+	 * purpose, and the buffers are numbered one after the other.
+	 */
+	if (q == &dev->video_q && dev->scan_mask)
+		missed = 0;
+	*fc += 2 * missed;
+	if (V4L2_FIELD_ALTERNATE == buf->field) {
+		buf->vb.field = (RISC_SYNCO ==
+				 (le32_to_cpu(buf->risc.cpu[0]) & 0xf0000000))
+				? V4L2_FIELD_TOP : V4L2_FIELD_BOTTOM;
+		if ((*fc & 1) != (V4L2_FIELD_BOTTOM == buf->vb.field))
+			(*fc)++;
+		buf->vb.field_count = *fc;
+		*fc += 1;
+	} else {
+		buf->vb.field_count = *fc;
+		*fc += 2;
+	}
+	/* crops only change between frames, so this one covers it all */
+	buf->crop = dev->crop_hw;
+	if (q == &dev->video_q) {
+		tw68_fifo_tune(dev);
+		buf->meta.crop = buf->crop;
+		buf->meta.status = tw_readl(TW68_STATUS1) & 0xff;
+		/*
+		 * Only 6804-class chips interrupt on lock changes, so
+		 * also compare the lock bits with the last completion's.
+		 */
+		if ((buf->meta.status ^ dev->meta_status) &
+		    (TW68_STATUS1_VLOCK | TW68_STATUS1_HLOCK |
+		     TW68_STATUS1_VDLOSS))
+			dev->meta_flags |= TW68_META_SYNC;
+		dev->meta_status = buf->meta.status;
+		buf->meta.flags = dev->meta_flags |
+				  (missed ? TW68_META_MISSED : 0);
+		buf->done_time = dev->irq_time;
+		dev->meta_flags = 0;
+	}
+	if (q == &dev->video_q)
+		tw68_group_stamp(dev, buf);
 	dprintk(DBG_BUFF | DBG_TESTING, "%s: [%p/%d] field_count=%d\n",
 		__func__, buf, buf->vb.i, *fc);
 	buf->vb.state = VIDEOBUF_DONE;
 	list_del(&buf->vb.queue);
 	wake_up(&buf->vb.done);
+	tw68_buf_done(buf);
+	q->last = buf;
+	q->done_seq++;
+	wake_up_all(&q->tap_wait);
 	mod_timer(&q->timeout, jiffies + BUFFER_TIMEOUT);
+
+	/*
+	 * If that was the last buffer of the active chain, the DMAP is
+	 * now waiting in the stopper.  Buffers of another size or format
+	 * left on the queued chain are started right away (new scaling,
+	 * new DMAC format, DMAP restarted), so that the switch costs at
+	 * most the field the stopper is skipping rather than the whole
+	 * buffer timeout.
+	 */
+	if (list_empty(&q->active) && !list_empty(&q->queued)) {
+		dprintk(DBG_BUFF | DBG_TESTING, "%s: format change\n",
+			__func__);
+		tw68_buffer_requeue(dev, q);
+	}
+}
+
+/*
+ * Copy (part of) completed buffer @buf, index @i of @q, to user space,
+ * as of generation @gen of the index.  A page at a time: the buffer is
+ * only looked at, under slock, while the generation is unchanged -
+ * until then neither it nor its pages can have been freed - and each
+ * page is copied with a reference of our own, so that tw68_dma_free
+ * never waits for a reader.  Once the buffer is requeued or freed the
+ * copy gives up, as if it had been overwritten.
+ */
+static int tw68_dma_copy_to_user(struct tw68_dmaqueue *q, char __user *data,
+				 struct tw68_buf *buf, unsigned int i,
+				 unsigned int gen, size_t len)
+{
+	struct tw68_dev *dev = q->dev;
+	struct videobuf_dmabuf *dma;
+	unsigned int n, off;
+	struct page *page;
+	unsigned long flags;
+	size_t chunk, done;
+	void *src;
+	int rc;
+
+	for (n = 0, done = 0; done < len; n++, done += chunk) {
+		spin_lock_irqsave(&dev->slock, flags);
+		if (q->tap_gen[i] != gen) {
+			spin_unlock_irqrestore(&dev->slock, flags);
+			return -EAGAIN;
+		}
+		dma = videobuf_to_dma(&buf->vb);
+		if (0 == n)
+			dma_sync_sg_for_cpu(&dev->pci->dev, dma->sglist,
+					    dma->sglen, DMA_FROM_DEVICE);
+		if (dma->vaddr) {	/* kernel buffer (read() mode) */
+			off = 0;
+			page = vmalloc_to_page(dma->vaddr + done);
+		} else {		/* pinned user pages */
+			off = n ? 0 : dma->offset;
+			page = n < dma->nr_pages ? dma->pages[n] : NULL;
+		}
+		if (page)
+			get_page(page);
+		spin_unlock_irqrestore(&dev->slock, flags);
+		if (NULL == page)
+			break;
+
+		chunk = min_t(size_t, len - done, PAGE_SIZE - off);
+		src = kmap(page);
+		rc = copy_to_user(data + done, src + off, chunk);
+		kunmap(page);
+		put_page(page);
+		if (rc)
+			return -EFAULT;
+	}
+	return 0;
+}
+
+/* whether tap reader @fh has the format of @buf; under slock */
+int tw68_tap_fmt_ok(struct tw68_fh *fh, struct tw68_buf *buf)
+{
+	return buf->fmt == fh->fmt && buf->vb.width == fh->width &&
+	       buf->vb.height == fh->height;
+}
+
+/* completion @done is taken by tap reader @fh: count what it skipped */
+void tw68_tap_count(struct tw68_fh *fh, unsigned int done)
+{
+	if (fh->tap_seq && done - fh->tap_seq > 1)
+		fh->tap_dropped += done - fh->tap_seq - 1;
+	fh->tap_seq = done;
+}
+
+/*
+ * tw68_tap_read
+ *
+ * read() for a file handle which shares ("taps") a stream owned by
+ * another file handle.  There is still only one DMA stream; each tap
+ * reader is given the most recently completed buffer of the queue,
+ * copied straight from the owner's DMA memory, provided it has the
+ * format the reader set (EBUSY otherwise).  fh->tap_seq is the
+ * reader's last seen completion number, and fh->tap_dropped counts
+ * the completions it missed, so every reader sees its own drops; the
+ * frame's TW68_IOC_G_META is kept for TW68_META_TAP_LAST.
+ *
+ * If the owner requeued or freed the buffer in the meantime the copy
+ * is discarded and the next completion is used instead.  Readers which
+ * would rather not copy map the owner's buffers, see tw68_tap_mmap.
+ */
+ssize_t tw68_tap_read(struct tw68_fh *fh, char __user *data, size_t count,
+		      int nonblocking)
+{
+	struct tw68_dev *dev = fh->dev;
+	struct tw68_dmaqueue *q = &dev->video_q;
+	struct tw68_meta meta;
+	struct tw68_buf *buf;
+	unsigned long flags;
+	unsigned int done, i, gen;
+	size_t len;
+	long ret;
+	int rc;
+
+	for (;;) {
+		spin_lock_irqsave(&dev->slock, flags);
+		buf = q->last;
+		done = q->done_seq;
+		if (buf && done != fh->tap_seq) {
+			if (!tw68_tap_fmt_ok(fh, buf)) {
+				spin_unlock_irqrestore(&dev->slock, flags);
+				return -EBUSY;
+			}
+			i = buf->vb.i;
+			gen = q->tap_gen[i];
+			len = min_t(size_t, count, buf->vb.size);
+			meta = buf->meta;
+			meta.index = buf->vb.i;
+			meta.sequence = buf->vb.field_count >> 1;
+			meta.offset = buf->vb.boff;
+			spin_unlock_irqrestore(&dev->slock, flags);
+		} else {
+			spin_unlock_irqrestore(&dev->slock, flags);
+			if (nonblocking)
+				return -EAGAIN;
+			ret = wait_event_interruptible_timeout(q->tap_wait,
+					ACCESS_ONCE(q->done_seq) !=
+					fh->tap_seq, BUFFER_TIMEOUT);
+			if (ret < 0)
+				return ret;
+			if (0 == ret)
+				return -EIO;
+			continue;
+		}
+
+		rc = tw68_dma_copy_to_user(q, data, buf, i, gen, len);
+		/* and it must not have been refilled while we copied */
+		spin_lock_irqsave(&dev->slock, flags);
+		if (0 == rc && q->tap_gen[i] != gen)
+			rc = -EAGAIN;
+		spin_unlock_irqrestore(&dev->slock, flags);
+		tw68_tap_count(fh, done);
+		if (-EAGAIN == rc) {
+			dprintk(DBG_BUFF, "%s: overwritten, dropped\n",
+				__func__);
+			fh->tap_dropped++;
+			continue;
+		}
+		if (0 == rc) {
+			fh->tap_meta = meta;
+			fh->tap_frames++;
+		}
+		return rc ? rc : len;
+	}
 }
 
 /*
@@ -269,6 +839,9 @@ void tw68_buffer_queue(struct tw68_dev *dev,
 	dprintk(DBG_FLOW, "%s: called\n", __func__);
 	assert_spin_locked(&dev->slock);
 	dprintk(DBG_BUFF, "%s: queuing buffer %p\n", __func__, buf);
+	buf->dmaq = q;
+	/* tap readers still copying from it drop their copy */
+	q->tap_gen[buf->vb.i]++;
 
 	/* append a 'JUMP to stopper' to the buffer risc program */
 	buf->risc.jmp[0] = cpu_to_le32(RISC_JUMP | RISC_INT_BIT);
@@ -291,9 +864,9 @@ void tw68_buffer_queue(struct tw68_dev *dev,
 		dprintk(DBG_BUFF, "%s: [%p/%d] first active\n",
 			__func__, buf, buf->vb.i);
 		list_add_tail(&buf->vb.queue, &q->active);
-		q->start_dma(dev, q, buf);	/* 1st one - start dma */
-		/* TODO - why have we removed buf->count and q->count? */
+		/* activate may patch the program, so it goes first */
 		buf->activate(dev, buf, NULL);
+		q->start_dma(dev, q, buf);	/* 1st one - start dma */
 
 	/* else we would like to put this buffer on the tail of the
 	 * active chain, provided it is "compatible". */
@@ -301,10 +874,11 @@ void tw68_buffer_queue(struct tw68_dev *dev,
 		/* "compatibility" depends upon the type of buffer */
 		prev = list_entry(q->active.prev, struct tw68_buf, vb.queue);
 		if (q->buf_compat(prev, buf)) {
-			/* If "compatible", append to active chain */
-			prev->risc.jmp[1] = cpu_to_le32(buf->risc.dma);
-			/* the param 'prev' is only for debug printing */
+			/* If "compatible", append to active chain, once
+			 * activate has finished with the program */
 			buf->activate(dev, buf, prev);
+			wmb();
+			prev->risc.jmp[1] = cpu_to_le32(buf->risc.dma);
 			list_add_tail(&buf->vb.queue, &q->active);
 			dprintk(DBG_BUFF, "%s: [%p/%d] appended to active\n",
 				__func__, buf, buf->vb.i);
@@ -336,12 +910,20 @@ void tw68_buffer_timeout(unsigned long data)
 	dprintk(DBG_FLOW, "%s: called\n", __func__);
 	spin_lock_irqsave(&dev->slock, flags);
 
+	/* a capture group member gives up waiting for the others */
+	if (q == &dev->video_q && tw68_group_expire(dev)) {
+		mod_timer(&q->timeout, jiffies + BUFFER_TIMEOUT);
+		spin_unlock_irqrestore(&dev->slock, flags);
+		return;
+	}
+
 	/* flag all current active buffers as failed */
 	while (!list_empty(&q->active)) {
 		buf = list_entry(q->active.next, struct tw68_buf, vb.queue);
 		list_del(&buf->vb.queue);
 		buf->vb.state = VIDEOBUF_ERROR;
 		wake_up(&buf->vb.done);
+		tw68_buf_done(buf);
 		printk(KERN_INFO "%s/0: [%p/%d] timeout - dma=0x%08lx\n",
 			dev->name, buf, buf->vb.i,
 			(unsigned long)buf->risc.dma);
@@ -360,88 +942,88 @@ static int tw68_hw_enable1(struct tw68_dev *dev)
 }
 
 /*
- * The device is given a "soft reset". According to the specifications,
- * after this "all register content remain unchanged", so we also write
- * to all specified registers manually as well (mostly to manufacturer's
- * specified reset values)
+ * Register initialisation table.  These are the values written to the
+ * chip by tw68_hw_init1 after the soft reset.  According to the
+ * specifications, after the reset "all register content remain
+ * unchanged", so we write to all specified registers manually (mostly
+ * to manufacturer's specified reset values).
+ *
+ * The same table is used by tw68_suspend to save the current register
+ * contents (which by then include the user's controls, the scaler and
+ * the input mux) into dev->reg_shadow, and by tw68_resume to write them
+ * all back again in a single pass.
  */
-static int tw68_hw_init1(struct tw68_dev *dev)
-{
-	dprintk(DBG_FLOW, "%s: called\n", __func__);
-	/* Assure all interrupts are disabled */
-	tw_writel(TW68_INTMASK, 0);		/* 020 */
-	/* Clear any pending interrupts */
-	tw_writel(TW68_INTSTAT, 0xffffffff);	/* 01C */
-	/* Stop risc processor, set default buffer level */
-	tw_writel(TW68_DMAC, 0x1600);
-
-	tw_writeb(TW68_ACNTL, 0x80);	/* 218	soft reset */
-	msleep(100);
-
-	tw_writeb(TW68_INFORM, 0x40);	/* 208	mux0, 27mhz xtal */
-	tw_writeb(TW68_OPFORM, 0x04);	/* 20C	analog line-lock */
-	tw_writeb(TW68_HSYNC, 0);	/* 210	color-killer high sens */
-	tw_writeb(TW68_ACNTL, 0x42);	/* 218	int vref #2, chroma adc off */
-
-	tw_writeb(TW68_CROP_HI, 0x02);	/* 21C	Hactive m.s. bits */
-	tw_writeb(TW68_VDELAY_LO, 0x12);/* 220	Mfg specified reset value */
-	tw_writeb(TW68_VACTIVE_LO, 0xf0);
-	tw_writeb(TW68_HDELAY_LO, 0x0f);
-	tw_writeb(TW68_HACTIVE_LO, 0xd0);
-
-	tw_writeb(TW68_CNTRL1, 0xcd);	/* 230	Wide Chroma BPF B/W
+#define	REGB(reg, val)	{ (reg), 1, (val) }
+#define	REGL(reg, val)	{ (reg), 4, (val) }
+
+static const struct tw68_reg_init {
+	u16	reg;
+	u8	width;		/* 1 = byte register, 4 = long register */
+	u32	val;
+} tw68_init_regs[] = {
+	REGB(TW68_INFORM, 0x40),	/* 208	mux0, 27mhz xtal */
+	REGB(TW68_OPFORM, 0x04),	/* 20C	analog line-lock */
+	REGB(TW68_HSYNC, 0),		/* 210	color-killer high sens */
+	REGB(TW68_ACNTL, 0x42),		/* 218	int vref #2, chroma adc off */
+
+	REGB(TW68_CROP_HI, 0x02),	/* 21C	Hactive m.s. bits */
+	REGB(TW68_VDELAY_LO, 0x12),	/* 220	Mfg specified reset value */
+	REGB(TW68_VACTIVE_LO, 0xf0),
+	REGB(TW68_HDELAY_LO, 0x0f),
+	REGB(TW68_HACTIVE_LO, 0xd0),
+
+	REGB(TW68_CNTRL1, 0xcd),	/* 230	Wide Chroma BPF B/W
 					 *	Secam reduction, Adap comb for
 					 *	NTSC, Op Mode 1 */
 
-	tw_writeb(TW68_VSCALE_LO, 0);	/* 234 */
-	tw_writeb(TW68_SCALE_HI, 0x11);	/* 238 */
-	tw_writeb(TW68_HSCALE_LO, 0);	/* 23c */
-	tw_writeb(TW68_BRIGHT, 0);	/* 240 */
-	tw_writeb(TW68_CONTRAST, 0x5c);	/* 244 */
-	tw_writeb(TW68_SHARPNESS, 0x51);/* 248 */
-	tw_writeb(TW68_SAT_U, 0x80);	/* 24C */
-	tw_writeb(TW68_SAT_V, 0x80);	/* 250 */
-	tw_writeb(TW68_HUE, 0x00);	/* 254 */
+	REGB(TW68_VSCALE_LO, 0),	/* 234 */
+	REGB(TW68_SCALE_HI, 0x11),	/* 238 */
+	REGB(TW68_HSCALE_LO, 0),	/* 23c */
+	REGB(TW68_BRIGHT, 0),		/* 240 */
+	REGB(TW68_CONTRAST, 0x5c),	/* 244 */
+	REGB(TW68_SHARPNESS, 0x51),	/* 248 */
+	REGB(TW68_SAT_U, 0x80),		/* 24C */
+	REGB(TW68_SAT_V, 0x80),		/* 250 */
+	REGB(TW68_HUE, 0x00),		/* 254 */
 
 	/* TODO - Check that none of these are set by control defaults */
-	tw_writeb(TW68_SHARP2, 0x53);	/* 258	Mfg specified reset val */
-	tw_writeb(TW68_VSHARP, 0x80);	/* 25C	Sharpness Coring val 8 */
-	tw_writeb(TW68_CORING, 0x44);	/* 260	CTI and Vert Peak coring */
-	tw_writeb(TW68_CNTRL2, 0x00);	/* 268	No power saving enabled */
-	tw_writeb(TW68_SDT, 0x07);	/* 270	Enable shadow reg, auto-det */
-	tw_writeb(TW68_SDTR, 0x7f);	/* 274	All stds recog, don't start */
-	tw_writeb(TW68_CLMPG, 0x50);	/* 280	Clamp end at 40 sys clocks */
-	tw_writeb(TW68_IAGC, 0x22);	/* 284	Mfg specified reset val */
-	tw_writeb(TW68_AGCGAIN, 0xf0);	/* 288	AGC gain when loop disabled */
-	tw_writeb(TW68_PEAKWT, 0xd8);	/* 28C	White peak threshold */
-	tw_writeb(TW68_CLMPL, 0x3c);	/* 290	Y channel clamp level */
-//	tw_writeb(TW68_SYNCT, 0x38);	/* 294	Sync amplitude */
-	tw_writeb(TW68_SYNCT, 0x30);	/* 294	Sync amplitude */
-	tw_writeb(TW68_MISSCNT, 0x44);	/* 298	Horiz sync, VCR detect sens */
-	tw_writeb(TW68_PCLAMP, 0x28);	/* 29C	Clamp pos from PLL sync */
+	REGB(TW68_SHARP2, 0x53),	/* 258	Mfg specified reset val */
+	REGB(TW68_VSHARP, 0x80),	/* 25C	Sharpness Coring val 8 */
+	REGB(TW68_CORING, 0x44),	/* 260	CTI and Vert Peak coring */
+	REGB(TW68_CNTRL2, 0x00),	/* 268	No power saving enabled */
+	REGB(TW68_SDT, 0x07),		/* 270	Enable shadow reg, auto-det */
+	REGB(TW68_SDTR, 0x7f),		/* 274	All stds recog, don't start */
+	REGB(TW68_CLMPG, 0x50),		/* 280	Clamp end at 40 sys clocks */
+	REGB(TW68_IAGC, 0x22),		/* 284	Mfg specified reset val */
+	REGB(TW68_AGCGAIN, 0xf0),	/* 288	AGC gain when loop disabled */
+	REGB(TW68_PEAKWT, 0xd8),	/* 28C	White peak threshold */
+	REGB(TW68_CLMPL, 0x3c),		/* 290	Y channel clamp level */
+/*	REGB(TW68_SYNCT, 0x38),		   294	Sync amplitude */
+	REGB(TW68_SYNCT, 0x30),		/* 294	Sync amplitude */
+	REGB(TW68_MISSCNT, 0x44),	/* 298	Horiz sync, VCR detect sens */
+	REGB(TW68_PCLAMP, 0x28),	/* 29C	Clamp pos from PLL sync */
 	/* Bit DETV of VCNTL1 helps sync multi cams/chip board */
-	tw_writeb(TW68_VCNTL1, 0x04);	/* 2A0 */
-	tw_writeb(TW68_VCNTL2, 0);	/* 2A4 */
-	tw_writeb(TW68_CKILL, 0x68);	/* 2A8	Mfg specified reset val */
-	tw_writeb(TW68_COMB, 0x44);	/* 2AC	Mfg specified reset val */
-	tw_writeb(TW68_LDLY, 0x30);	/* 2B0	Max positive luma delay */
-	tw_writeb(TW68_MISC1, 0x14);	/* 2B4	Mfg specified reset val */
-	tw_writeb(TW68_LOOP, 0xa5);	/* 2B8	Mfg specified reset val */
-	tw_writeb(TW68_MISC2, 0xe0);	/* 2BC	Enable colour killer */
-	tw_writeb(TW68_MVSN, 0);	/* 2C0 */
-	tw_writeb(TW68_CLMD, 0x05);	/* 2CC	slice level auto, clamp med. */
-	tw_writeb(TW68_IDCNTL, 0);	/* 2D0	Writing zero to this register
+	REGB(TW68_VCNTL1, 0x04),	/* 2A0 */
+	REGB(TW68_VCNTL2, 0),		/* 2A4 */
+	REGB(TW68_CKILL, 0x68),		/* 2A8	Mfg specified reset val */
+	REGB(TW68_COMB, 0x44),		/* 2AC	Mfg specified reset val */
+	REGB(TW68_LDLY, 0x30),		/* 2B0	Max positive luma delay */
+	REGB(TW68_MISC1, 0x14),		/* 2B4	Mfg specified reset val */
+	REGB(TW68_LOOP, 0xa5),		/* 2B8	Mfg specified reset val */
+	REGB(TW68_MISC2, 0xe0),		/* 2BC	Enable colour killer */
+	REGB(TW68_MVSN, 0),		/* 2C0 */
+	REGB(TW68_CLMD, 0x05),		/* 2CC	slice level auto, clamp med. */
+	REGB(TW68_IDCNTL, 0),		/* 2D0	Writing zero to this register
 					 *	selects NTSC ID detection,
 					 *	but doesn't change the
 					 *	sensitivity (which has a reset
 					 *	value of 1E).  Since we are
 					 *	not doing auto-detection, it
 					 *	has no real effect */
-	tw_writeb(TW68_CLCNTL1, 0);	/* 2D4 */
-	tw_writel(TW68_VBIC, 0x03);	/* 010 */
-	tw_writel(TW68_CAP_CTL, 0x03);	/* 040	Enable both even & odd flds */
-	tw_writel(TW68_DMAC, 0x2000);	/* patch set had 0x2080 */
-	tw_writel(TW68_TESTREG, 0);	/* 02C */
+	REGB(TW68_CLCNTL1, 0),		/* 2D4 */
+	REGL(TW68_VBIC, 0x03),		/* 010 */
+	REGL(TW68_CAP_CTL, 0x03),	/* 040	Enable both even & odd flds */
+	REGL(TW68_TESTREG, 0),		/* 02C */
 
 	/*
 	 * Some common boards, especially inexpensive single-chip models,
@@ -455,13 +1037,82 @@ static int tw68_hw_init1(struct tw68_dev *dev)
 	 * identify.  For the moment, however, it shouldn't hurt anything
 	 * to do these steps.
 	 */
-	tw_writel(TW68_GPIOC, 0);	/* Set the GPIO to "normal", no ints */
-	tw_writel(TW68_GPOE, 0x0f);	/* Set bits 0-3 to "output" */
-	tw_writel(TW68_GPDATA, 0);	/* Set all bits to low state */
+	REGL(TW68_GPIOC, 0),		/* Set the GPIO to "normal", no ints */
+	REGL(TW68_GPOE, 0x0f),		/* Set bits 0-3 to "output" */
+	REGL(TW68_GPDATA, 0),		/* Set all bits to low state */
+};
+#define	TW68_INIT_REGS	ARRAY_SIZE(tw68_init_regs)
+
+/*
+ * tw68_hw_load_regs
+ *
+ * Write the register table to the chip.  If @shadow is NULL the table's
+ * own values are used, otherwise the values previously saved by
+ * tw68_hw_save_regs.  No delays are needed between the writes.
+ */
+static void tw68_hw_load_regs(struct tw68_dev *dev, const u32 *shadow)
+{
+	const struct tw68_reg_init *r;
+	unsigned int i;
+	u32 val;
+
+	BUILD_BUG_ON(TW68_INIT_REGS > TW68_SHADOW_REGS);
+	dprintk(DBG_FLOW, "%s: called (%s)\n", __func__,
+		shadow ? "restore" : "defaults");
+	for (i = 0; i < TW68_INIT_REGS; i++) {
+		r = &tw68_init_regs[i];
+		val = shadow ? shadow[i] : r->val;
+		if (1 == r->width)
+			tw_writeb(r->reg, val);
+		else
+			tw_writel(r->reg, val);
+	}
+	/* the FIFO level alone (the patch set had 0x2080) */
+	tw_writel(TW68_DMAC, dev->fifo_level << TW68_FIFO_LEVEL_SHIFT);
+}
+
+/* Save the current contents of all registers in the init table */
+static void tw68_hw_save_regs(struct tw68_dev *dev)
+{
+	const struct tw68_reg_init *r;
+	unsigned int i;
+
+	for (i = 0; i < TW68_INIT_REGS; i++) {
+		r = &tw68_init_regs[i];
+		if (1 == r->width)
+			dev->reg_shadow[i] = tw_readb(r->reg);
+		else
+			dev->reg_shadow[i] = tw_readl(r->reg);
+	}
+}
+
+/*
+ * The device is given a "soft reset", then loaded from the register
+ * initialisation table above.
+ */
+static int tw68_hw_init1(struct tw68_dev *dev)
+{
+	dprintk(DBG_FLOW, "%s: called\n", __func__);
+	/* Assure all interrupts are disabled */
+	tw_writel(TW68_INTMASK, 0);		/* 020 */
+	/* Clear any pending interrupts */
+	tw_writel(TW68_INTSTAT, 0xffffffff);	/* 01C */
+	/* Stop risc processor, set default buffer level */
+	tw_writel(TW68_DMAC, 0x1600);
+
+	tw_writeb(TW68_ACNTL, 0x80);	/* 218	soft reset */
+	msleep(100);
+
+	dev->fifo_level = tw68_fifo_ceiling();
+	dev->fifo_hold = TW68_FIFO_HOLD;
+	dev->fifo_second = jiffies + HZ;
+	tw68_hw_load_regs(dev, NULL);
 
 	/* Initialize the device control structures */
 	mutex_init(&dev->lock);
+	mutex_init(&dev->power_lock);
 	spin_lock_init(&dev->slock);
+	INIT_LIST_HEAD(&dev->bw_fhs);
 
 	/* Initialize any subsystems */
 	tw68_video_init1(dev);
@@ -511,6 +1162,80 @@ static int tw68_hwfini(struct tw68_dev *dev)
 	return 0;
 }
 
+/* ------------------------------------------------------------------ */
+/*
+ * Power management of idle decoders
+ *
+ * dev->users counts the captures under way: the file handles holding
+ * RESOURCE_VIDEO or RESOURCE_VBI, and the read() captures of video.
+ * When the last of them ends (and the 'powersave' option is set) the
+ * ADCs and the decoder clock are put to sleep and the video interrupts
+ * are masked.  The next STREAMON or read wakes the chip again, and
+ * waits (up to TW68_WAKEUP_SETTLE msecs) for the decoder to lock on the
+ * input before it captures; opening the device, or only using its
+ * controls, doesn't.  The wait is under dev->power_lock, not dev->lock,
+ * so that the other handles' ioctls go on meanwhile.
+ *
+ * The caller must hold dev->power_lock.
+ */
+static void tw68_hw_sleep(struct tw68_dev *dev)
+{
+	unsigned long flags;
+
+	if (dev->asleep)
+		return;
+	dprintk(DBG_FLOW, "%s: powering down\n", __func__);
+	spin_lock_irqsave(&dev->slock, flags);
+	tw_clearl(TW68_DMAC, TW68_DMAP_EN | TW68_FIFO_EN);
+	dev->pci_irqmask &= ~dev->board_virqmask;
+	tw_clearl(TW68_INTMASK, dev->board_virqmask);
+	spin_unlock_irqrestore(&dev->slock, flags);
+	dev->acntl = tw_readb(TW68_ACNTL);
+	tw_writeb(TW68_ACNTL, dev->acntl | TW68_ACNTL_SLEEP);
+	dev->asleep = 1;
+}
+
+static void tw68_hw_wakeup(struct tw68_dev *dev)
+{
+	unsigned long timeout;
+	u32 status;
+
+	if (!dev->asleep)
+		return;
+	dprintk(DBG_FLOW, "%s: powering up\n", __func__);
+	/* interrupts are unmasked again by the next start_dma */
+	tw_writeb(TW68_ACNTL, dev->acntl);
+	dev->asleep = 0;
+
+	timeout = jiffies + msecs_to_jiffies(TW68_WAKEUP_SETTLE);
+	do {
+		msleep(10);
+		status = tw_readl(TW68_STATUS1);
+		if ((status & (TW68_STATUS1_VLOCK | TW68_STATUS1_HLOCK)) ==
+		    (TW68_STATUS1_VLOCK | TW68_STATUS1_HLOCK))
+			return;
+	} while (time_before(jiffies, timeout));
+	dprintk(DBG_UNUSUAL, "%s: decoder not locked after %u msecs%s\n",
+		__func__, TW68_WAKEUP_SETTLE,
+		(status & TW68_STATUS1_VDLOSS) ? " (no signal)" : "");
+}
+
+void tw68_power_get(struct tw68_dev *dev)
+{
+	mutex_lock(&dev->power_lock);
+	if (0 == dev->users++)
+		tw68_hw_wakeup(dev);
+	mutex_unlock(&dev->power_lock);
+}
+
+void tw68_power_put(struct tw68_dev *dev)
+{
+	mutex_lock(&dev->power_lock);
+	if (0 == --dev->users && powersave)
+		tw68_hw_sleep(dev);
+	mutex_unlock(&dev->power_lock);
+}
+
 static void must_configure_manually(void)
 {
 	unsigned int i, p;
@@ -591,6 +1316,7 @@ static struct video_device *vdev_init(struct tw68_dev *dev,
 	vfd->parent  = &dev->pci->dev;
 	vfd->release = video_device_release;
 	/* vfd->debug   = tw_video_debug; */
+	video_set_drvdata(vfd, dev);
 	snprintf(vfd->name, sizeof(vfd->name), "%s %s (%s)",
 		 dev->name, type, tw68_boards[dev->board].name);
 	return vfd;
@@ -882,6 +1608,14 @@ static int tw68_initdev(struct pci_dev *pci_dev,
 
 	/* everything worked */
 	tw68_devcount++;
+	tw68_group_join(dev, group[dev->nr]);
+	tw68_debugfs_dev_init(dev);
+
+	/* nothing is capturing yet */
+	mutex_lock(&dev->power_lock);
+	if (0 == dev->users && powersave)
+		tw68_hw_sleep(dev);
+	mutex_unlock(&dev->power_lock);
 
 	if (tw68_dmasound_init && !dev->dmasound.priv_data)
 		tw68_dmasound_init(dev);
@@ -915,6 +1649,9 @@ static void tw68_finidev(struct pci_dev *pci_dev)
 	struct tw68_mpeg_ops *mops;
 
 	dprintk(DBG_FLOW, "%s: called\n", __func__);
+	tw68_debugfs_dev_fini(dev);
+	tw68_group_leave(dev);
+
 	/* Release DMA sound modules if present */
 	if (tw68_dmasound_exit && dev->dmasound.priv_data)
 		tw68_dmasound_exit(dev);
@@ -948,6 +1685,8 @@ static void tw68_finidev(struct pci_dev *pci_dev)
 
 	/* release resources */
 	free_irq(pci_dev->irq, dev);
+	btcx_riscmem_free(pci_dev, &dev->video_q.stopper);
+	btcx_riscmem_free(pci_dev, &dev->scan_risc);
 	iounmap(dev->lmmio);
 	release_mem_region(pci_resource_start(pci_dev, 0),
 			   pci_resource_len(pci_dev, 0));
@@ -971,6 +1710,9 @@ static int tw68_suspend(struct pci_dev *pci_dev , pm_message_t state)
 	dev->pci_irqmask &= ~TW68_VID_INTS;
 	tw_writel(TW68_INTMASK, 0);
 
+	/* remember controls, scaler and input for tw68_resume */
+	tw68_hw_save_regs(dev);
+
 	dev->insuspend = 1;
 	synchronize_irq(pci_dev->irq);
 
@@ -1008,7 +1750,15 @@ static int tw68_resume(struct pci_dev *pci_dev)
 
 	tw68_board_init1(dev);
 
-	/* tw68_hw_init1 */
+	/*
+	 * tw68_hw_init1, but without the soft reset and its delay.  All
+	 * registers are written from the shadow saved at suspend time, so
+	 * the decoder comes back exactly as the user left it.
+	 */
+	tw_writel(TW68_INTMASK, 0);
+	tw_writel(TW68_INTSTAT, 0xffffffff);
+	tw_writel(TW68_DMAC, 0x1600);
+	tw68_hw_load_regs(dev, dev->reg_shadow);
 	if (tw68_boards[dev->board].video_out)
 		tw68_videoport_init(dev);
 	if (card_has_mpeg(dev))
@@ -1019,8 +1769,6 @@ static int tw68_resume(struct pci_dev *pci_dev)
 #endif
 	tw68_hw_enable1(dev);
 
-	msleep(100);
-
 	tw68_board_init2(dev);
 
 	/*tw68_hw_init2*/
@@ -1033,8 +1781,7 @@ static int tw68_resume(struct pci_dev *pci_dev)
 	/*resume unfinished buffer(s)*/
 	spin_lock_irqsave(&dev->slock, flags);
 	tw68_buffer_requeue(dev, &dev->video_q);
-	tw68_buffer_requeue(dev, &dev->vbi_q);
-	tw68_buffer_requeue(dev, &dev->ts_q);
+	/* vbi_q and ts_q are never initialised (see tw68-vbi.c, tw68-ts.c) */
 
 	/* FIXME: Disable DMA audio sound - temporary till proper support
 		  is implemented*/
@@ -1045,6 +1792,8 @@ static int tw68_resume(struct pci_dev *pci_dev)
 	dev->insuspend = 0;
 	smp_wmb();
 	tw68_set_dmabits(dev);
+	/* start_dma re-enables the video interrupts, others are ours */
+	tw_setl(TW68_INTMASK, dev->pci_irqmask);
 	spin_unlock_irqrestore(&dev->slock, flags);
 
 	return 0;
@@ -1066,6 +1815,8 @@ static struct pci_driver tw68_pci_driver = {
 
 static int tw68_init(void)
 {
+	int err;
+
 	if (core_debug & DBG_FLOW)
 		printk(KERN_DEBUG "%s: called\n", __func__);
 	INIT_LIST_HEAD(&tw68_devlist);
@@ -1077,7 +1828,11 @@ static int tw68_init(void)
 	printk(KERN_INFO "tw68: snapshot date %04d-%02d-%02d\n",
 		SNAPSHOT/10000, (SNAPSHOT/100)%100, SNAPSHOT%100);
 #endif
-	return pci_register_driver(&tw68_pci_driver);
+	tw68_debugfs_init();
+	err = pci_register_driver(&tw68_pci_driver);
+	if (err)
+		tw68_debugfs_fini();
+	return err;
 }
 
 static void module_cleanup(void)
@@ -1085,6 +1840,7 @@ static void module_cleanup(void)
 	if (core_debug & DBG_FLOW)
 		printk(KERN_DEBUG "%s: called\n", __func__);
 	pci_unregister_driver(&tw68_pci_driver);
+	tw68_debugfs_fini();
 }
 
 module_init(tw68_init);
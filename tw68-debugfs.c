@@ -0,0 +1,466 @@
+/*
+ *  tw68-debugfs.c
+ *  Part of the device driver for Techwell 68xx based cards
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * A read-only view of the capture engine, for finding out why a channel
+ * stalled without reloading the module with debug flags.  Each device
+ * gets a directory <debugfs>/tw68/<name>/ holding
+ *
+ *	dma	the DMAP registers, and which program (stopper, input
+ *		settle or buffer), field and line TW68_DMAP_PP is in
+ *	queues	the buffers on the active and queued chains of video_q
+ *	risc	the decoded programs of the stopper, the input settle
+ *		code and every video buffer which has one, queued or not
+ *
+ * Everything is sampled under dev->slock, so a snapshot is consistent
+ * with what the interrupt handler sees, and printed after the lock is
+ * dropped.  The programs, which can run to hundreds of KB, are copied
+ * under the lock when risc is opened and decoded from that copy, so
+ * reading them doesn't keep interrupts off.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+
+#include "tw68.h"
+
+static struct dentry *tw68_debugfs_root;
+
+static const char *state_name[] = {
+	[VIDEOBUF_NEEDS_INIT]	= "needs_init",
+	[VIDEOBUF_PREPARED]	= "prepared",
+	[VIDEOBUF_QUEUED]	= "queued",
+	[VIDEOBUF_ACTIVE]	= "active",
+	[VIDEOBUF_DONE]		= "done",
+	[VIDEOBUF_ERROR]	= "error",
+	[VIDEOBUF_IDLE]		= "idle",
+};
+
+static const char *buf_state(struct tw68_buf *buf)
+{
+	if (buf->vb.state < ARRAY_SIZE(state_name) &&
+	    state_name[buf->vb.state])
+		return state_name[buf->vb.state];
+	return "?";
+}
+
+static int risc_contains(struct btcx_riscmem *risc, u32 addr)
+{
+	return risc->cpu && addr >= risc->dma && addr < risc->dma + risc->size;
+}
+
+/* where TW68_DMAP_PP is, as dma_show found it */
+struct pp_where {
+	const char		*prog;		/* NULL for no known one */
+	int			index;		/* buffer, if it's one */
+	const char		*state;
+	unsigned int		insn, field, line;
+};
+
+/*
+ * Count the fields and lines of @risc that come before the instruction
+ * at bus address @pp.  A sync starts a field, each LINESTART a line.
+ */
+static void risc_locate(struct pp_where *w, struct btcx_riscmem *risc,
+			u32 pp)
+{
+	__le32 *rp, *end = risc->cpu + (pp - risc->dma) / 4;
+	u32 op;
+
+	w->insn = (pp - risc->dma) / 8;
+	w->field = 0;
+	w->line = 0;
+	for (rp = risc->cpu; rp < end && rp <= risc->jmp; rp += 2) {
+		op = le32_to_cpu(*rp) & 0xf0000000;
+		if (RISC_SYNCO == op || RISC_SYNCE == op) {
+			w->field++;
+			w->line = 0;
+		} else if (RISC_LINESTART == op) {
+			w->line++;
+		}
+	}
+}
+
+/* everything dma_show prints, sampled under dev->slock */
+struct dma_state {
+	u32			dmac, sa, pp, intstat, intmask;
+	unsigned int		fields;
+	unsigned int		fifo_level, fifo_ffof, fifo_fferr;
+	unsigned int		fifo_lowered, fifo_raised, fifo_hold;
+	unsigned int		bw_kbps;
+	int			grouped;
+	struct tw68_group_state	group;
+	unsigned int		scan_mask, scan_settle;
+	int			scan_input;
+	struct pp_where		where;
+};
+
+static void dma_sample(struct tw68_dev *dev, struct dma_state *st)
+{
+	struct tw68_dmaqueue *q = &dev->video_q;
+	struct pp_where *w = &st->where;
+	struct tw68_buf *buf;
+
+	st->dmac = tw_readl(TW68_DMAC);
+	st->sa = tw_readl(TW68_DMAP_SA);
+	st->pp = tw_readl(TW68_DMAP_PP);
+	st->intstat = tw_readl(TW68_INTSTAT);
+	st->intmask = tw_readl(TW68_INTMASK);
+	st->fields = dev->video_fieldcount;
+	st->fifo_level = dev->fifo_level;
+	st->fifo_ffof = dev->fifo_ffof;
+	st->fifo_fferr = dev->fifo_fferr;
+	st->fifo_lowered = dev->fifo_lowered;
+	st->fifo_raised = dev->fifo_raised;
+	st->fifo_hold = dev->fifo_hold;
+	st->bw_kbps = dev->bw_kbps;
+	st->grouped = tw68_group_state(dev, &st->group);
+	st->scan_mask = dev->scan_mask;
+	st->scan_settle = dev->scan_settle;
+	st->scan_input = dev->hw_input ?
+			 (int)(dev->hw_input - &card_in(dev, 0)) : -1;
+	w->prog = NULL;
+	if (risc_contains(&q->stopper, st->pp)) {
+		w->prog = "stopper";
+		risc_locate(w, &q->stopper, st->pp);
+		return;
+	}
+	if (risc_contains(&dev->scan_risc, st->pp)) {
+		w->prog = "input settle";
+		risc_locate(w, &dev->scan_risc, st->pp);
+		return;
+	}
+	list_for_each_entry(buf, &q->active, vb.queue) {
+		if (risc_contains(&buf->risc, st->pp)) {
+			w->prog = "buffer";
+			w->index = buf->vb.i;
+			w->state = buf_state(buf);
+			risc_locate(w, &buf->risc, st->pp);
+			return;
+		}
+	}
+}
+
+static int dma_show(struct seq_file *m, void *v)
+{
+	struct tw68_dev *dev = m->private;
+	struct dma_state st;
+	struct pp_where *w = &st.where;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->slock, flags);
+	dma_sample(dev, &st);
+	spin_unlock_irqrestore(&dev->slock, flags);
+
+	seq_printf(m, "DMAC     0x%08x (dmap %s, fifo %s)\n", st.dmac,
+		   st.dmac & TW68_DMAP_EN ? "on" : "off",
+		   st.dmac & TW68_FIFO_EN ? "on" : "off");
+	seq_printf(m, "DMAP_SA  0x%08x\n", st.sa);
+	seq_printf(m, "DMAP_PP  0x%08x\n", st.pp);
+	seq_printf(m, "INTSTAT  0x%08x\n", st.intstat);
+	seq_printf(m, "INTMASK  0x%08x\n", st.intmask);
+	seq_printf(m, "fields   %u\n", st.fields);
+	seq_printf(m, "fifo     level 0x%02x, %u FFOF, %u FFERR, "
+		   "lowered %u, raised %u, hold %us\n", st.fifo_level,
+		   st.fifo_ffof, st.fifo_fferr, st.fifo_lowered,
+		   st.fifo_raised, st.fifo_hold);
+	seq_printf(m, "pci bw   %u KB/s reserved\n", st.bw_kbps);
+	if (st.grouped)
+		seq_printf(m, "group    %u: %u members, %u pending, "
+			   "%u running, frame %u, this one %s from frame %u\n",
+			   st.group.id, st.group.members, st.group.pending,
+			   st.group.running, st.group.seq, st.group.state,
+			   st.group.base);
+	if (st.scan_mask)
+		seq_printf(m, "scan     0x%02x, settle %u, on input %d\n",
+			   st.scan_mask, st.scan_settle, st.scan_input);
+	seq_printf(m, "pp in    ");
+	if (NULL == w->prog)
+		seq_printf(m, "no known program\n");
+	else if (!strcmp(w->prog, "buffer"))
+		seq_printf(m, "buffer %d (%s), ", w->index, w->state);
+	else
+		seq_printf(m, "%s, ", w->prog);
+	if (w->prog)
+		seq_printf(m, "insn %u, field %u, line %u\n",
+			   w->insn, w->field, w->line);
+	return 0;
+}
+
+/* a buffer of a chain, as queues_show found it */
+struct chain_entry {
+	int			index;
+	const char		*state;
+	unsigned int		width, height;
+	int			field;
+	unsigned long		dma;
+	unsigned int		size;
+	unsigned int		field_count;
+};
+
+/* copy up to @max entries of @head into @e; under dev->slock */
+static unsigned int chain_sample(struct list_head *head,
+				 struct chain_entry *e, unsigned int max)
+{
+	struct tw68_buf *buf;
+	unsigned int n = 0;
+
+	list_for_each_entry(buf, head, vb.queue) {
+		if (n == max)
+			break;
+		e[n].index = buf->vb.i;
+		e[n].state = buf_state(buf);
+		e[n].width = buf->vb.width;
+		e[n].height = buf->vb.height;
+		e[n].field = buf->vb.field;
+		e[n].dma = (unsigned long)buf->risc.dma;
+		e[n].size = buf->risc.size;
+		e[n].field_count = buf->vb.field_count;
+		n++;
+	}
+	return n;
+}
+
+static void show_chain(struct seq_file *m, const char *name,
+		       struct chain_entry *e, unsigned int n)
+{
+	unsigned int i;
+
+	seq_printf(m, "%s: %u\n", name, n);
+	for (i = 0; i < n; i++)
+		seq_printf(m, "  buffer %2d %-10s %ux%u field %d "
+			   "risc 0x%08lx+%u field_count %u\n",
+			   e[i].index, e[i].state, e[i].width, e[i].height,
+			   e[i].field, e[i].dma, e[i].size,
+			   e[i].field_count);
+}
+
+static int queues_show(struct seq_file *m, void *v)
+{
+	struct tw68_dev *dev = m->private;
+	struct tw68_dmaqueue *q = &dev->video_q;
+	struct chain_entry *e;
+	unsigned int n_active, n_queued;
+	unsigned long flags;
+	int pending;
+
+	/* a buffer is on one chain at a time */
+	e = kmalloc(VIDEO_MAX_FRAME * sizeof(*e), GFP_KERNEL);
+	if (NULL == e)
+		return -ENOMEM;
+	spin_lock_irqsave(&dev->slock, flags);
+	pending = timer_pending(&q->timeout);
+	n_active = chain_sample(&q->active, e, VIDEO_MAX_FRAME);
+	n_queued = chain_sample(&q->queued, e + n_active,
+				VIDEO_MAX_FRAME - n_active);
+	spin_unlock_irqrestore(&dev->slock, flags);
+
+	seq_printf(m, "timeout %s\n", pending ? "pending" : "idle");
+	show_chain(m, "active", e, n_active);
+	show_chain(m, "queued", e + n_active, n_queued);
+	kfree(e);
+	return 0;
+}
+
+/* a program copied out of the chip's view by risc_open */
+struct risc_copy {
+	int			index;		/* buffer, or one of these: */
+#define	RISC_STOPPER		-1
+#define	RISC_SETTLE		-2
+	const char		*state;
+	unsigned long		dma;
+	unsigned int		size;		/* allocated */
+	unsigned int		words;		/* copied, through the jump */
+	__le32			*cpu;
+};
+
+struct risc_snapshot {
+	unsigned int		n, max_n;
+	unsigned int		words, max_words;
+	struct risc_copy	*progs;
+	__le32			*cpu;
+};
+
+/* count @risc in, and copy it if there's still room; under dev->slock */
+static void risc_collect(struct risc_snapshot *snap, int index,
+			 const char *state, struct btcx_riscmem *risc)
+{
+	unsigned int words = 0;
+	struct risc_copy *c;
+
+	if (risc->cpu && risc->jmp)
+		words = risc->jmp - risc->cpu + 2;
+	if (snap->n < snap->max_n && snap->words + words <= snap->max_words) {
+		c = &snap->progs[snap->n];
+		c->index = index;
+		c->state = state;
+		c->dma = (unsigned long)risc->dma;
+		c->size = risc->size;
+		c->words = words;
+		c->cpu = snap->cpu + snap->words;
+		memcpy(c->cpu, risc->cpu, words * sizeof(*c->cpu));
+	}
+	snap->n++;
+	snap->words += words;
+}
+
+/* all the programs of @dev, or as many as fit; under dev->slock */
+static void risc_collect_all(struct tw68_dev *dev,
+			     struct risc_snapshot *snap)
+{
+	struct tw68_buf *buf;
+
+	snap->n = 0;
+	snap->words = 0;
+	risc_collect(snap, RISC_STOPPER, NULL, &dev->video_q.stopper);
+	if (dev->scan_risc.cpu)
+		risc_collect(snap, RISC_SETTLE, NULL, &dev->scan_risc);
+	list_for_each_entry(buf, &dev->risc_bufs, risc_list)
+		risc_collect(snap, buf->vb.i, buf_state(buf), &buf->risc);
+}
+
+static int risc_show(struct seq_file *m, void *v)
+{
+	struct risc_snapshot *snap = m->private;
+	struct risc_copy *c;
+	unsigned int i, w;
+	char line[96];
+
+	for (i = 0; i < snap->n; i++) {
+		c = &snap->progs[i];
+		if (RISC_STOPPER == c->index)
+			seq_printf(m, "stopper\n");
+		else if (RISC_SETTLE == c->index)
+			seq_printf(m, "input settle\n");
+		else
+			seq_printf(m, "buffer %d (%s)\n", c->index, c->state);
+		seq_printf(m, "  dma 0x%08lx size %u\n", c->dma, c->size);
+		for (w = 0; w < c->words; w += 2) {
+			tw68_risc_decode(line, sizeof(line),
+					 le32_to_cpu(c->cpu[w]),
+					 le32_to_cpu(c->cpu[w + 1]));
+			seq_printf(m, "  %08lx: %s\n", c->dma + w * 4, line);
+		}
+	}
+	return 0;
+}
+
+static int risc_open(struct inode *inode, struct file *file)
+{
+	struct tw68_dev *dev = inode->i_private;
+	struct risc_snapshot count, *snap;
+	unsigned long flags;
+	int rc;
+
+	for (;;) {
+		memset(&count, 0, sizeof(count));
+		spin_lock_irqsave(&dev->slock, flags);
+		risc_collect_all(dev, &count);
+		spin_unlock_irqrestore(&dev->slock, flags);
+
+		snap = vmalloc(sizeof(*snap) +
+			       count.n * sizeof(*snap->progs) +
+			       count.words * sizeof(*snap->cpu));
+		if (NULL == snap)
+			return -ENOMEM;
+		snap->max_n = count.n;
+		snap->max_words = count.words;
+		snap->progs = (struct risc_copy *)(snap + 1);
+		snap->cpu = (__le32 *)(snap->progs + count.n);
+
+		spin_lock_irqsave(&dev->slock, flags);
+		risc_collect_all(dev, snap);
+		spin_unlock_irqrestore(&dev->slock, flags);
+		if (snap->n <= snap->max_n && snap->words <= snap->max_words)
+			break;
+		/* programs were added in between: try again */
+		vfree(snap);
+	}
+	rc = single_open(file, risc_show, snap);
+	if (rc)
+		vfree(snap);
+	return rc;
+}
+
+static int risc_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *m = file->private_data;
+
+	vfree(m->private);
+	return single_release(inode, file);
+}
+
+static const struct file_operations risc_fops = {
+	.owner		= THIS_MODULE,
+	.open		= risc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= risc_release,
+};
+
+#define TW68_DEBUGFS_FOPS(name)						\
+static int name##_open(struct inode *inode, struct file *file)		\
+{									\
+	return single_open(file, name##_show, inode->i_private);	\
+}									\
+static const struct file_operations name##_fops = {			\
+	.owner		= THIS_MODULE,					\
+	.open		= name##_open,					\
+	.read		= seq_read,					\
+	.llseek		= seq_lseek,					\
+	.release	= single_release,				\
+}
+
+TW68_DEBUGFS_FOPS(dma);
+TW68_DEBUGFS_FOPS(queues);
+
+void tw68_debugfs_dev_init(struct tw68_dev *dev)
+{
+	if (IS_ERR_OR_NULL(tw68_debugfs_root))
+		return;
+	dev->debugfs = debugfs_create_dir(dev->name, tw68_debugfs_root);
+	if (IS_ERR_OR_NULL(dev->debugfs)) {
+		dev->debugfs = NULL;
+		return;
+	}
+	debugfs_create_file("dma", S_IRUGO, dev->debugfs, dev, &dma_fops);
+	debugfs_create_file("queues", S_IRUGO, dev->debugfs, dev,
+			    &queues_fops);
+	debugfs_create_file("risc", S_IRUGO, dev->debugfs, dev, &risc_fops);
+}
+
+void tw68_debugfs_dev_fini(struct tw68_dev *dev)
+{
+	debugfs_remove_recursive(dev->debugfs);
+	dev->debugfs = NULL;
+}
+
+void tw68_debugfs_init(void)
+{
+	tw68_debugfs_root = debugfs_create_dir("tw68", NULL);
+}
+
+void tw68_debugfs_fini(void)
+{
+	debugfs_remove_recursive(tw68_debugfs_root);
+	tw68_debugfs_root = NULL;
+}
@@ -0,0 +1,358 @@
+/*
+ *  tw68-group.c
+ *  Part of the device driver for Techwell 68xx based cards
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Capture groups, for boards whose decoders are fed synchronised
+ * cameras (VCNTL1 DETV, set by tw68_hw_init1) and whose frames are
+ * meant to be used together.
+ *
+ * The 'group' module option puts devices into numbered groups.  Once
+ * every member of a group has a buffer ready, their DMAP processors are
+ * enabled back to back, so that they all begin on the same odd field.
+ * Until then tw68_video_start_dma() loads the program but leaves the
+ * DMAP off.  A member which doesn't get its buffer ready within a
+ * buffer timeout isn't waited for: the members which are ready start
+ * without it (see tw68_group_expire).  Buffers started while the group
+ * is running, for example after a format change or by a late member,
+ * are not held back.
+ *
+ * While running, the members' frames are numbered on one counter for
+ * the whole group: a member which started with the group's frame n
+ * numbers the frames it completes from there, in its own fields
+ * (missed frames included, so the members stay in step), and the group
+ * counter moves on as the first member completes each frame.  Only the
+ * sequence is replaced: an ALTERNATE stream keeps its field parity.
+ * The members completing the same frame get the same timestamp, the
+ * first one's.  TW68_IOC_BATCH with TW68_BATCH_SET dequeues such a set
+ * from the member devices in one call.  A member started late begins
+ * at the group frame after the last completed one, which it may in fact
+ * have missed the start of; only the members started together are
+ * known to be numbered alike.
+ *
+ * The group's lock nests inside dev->slock of any member.  The member
+ * starting the others holds its own slock, so it only ever tries theirs;
+ * one whose slock is busy is left with group_go set and its group
+ * tasklet scheduled, which takes the locks in order and starts it as
+ * soon as the starting member lets go, well within the field the others
+ * wait for.  Whichever of the tasklet, the member's own start_dma and
+ * its buffer timeout comes first clears group_go and does the start.
+ */
+
+#include "tw68.h"
+
+#define dprintk(level, fmt, arg...)     if (video_debug & (level)) \
+	printk(KERN_DEBUG "%s/0: " fmt, dev->name , ## arg)
+
+struct tw68_group {
+	struct list_head	list;		/* on tw68_groups */
+	unsigned int		id;
+	spinlock_t		lock;
+	struct list_head	devs;		/* members, on dev->group_list */
+	unsigned int		members;
+	unsigned int		pending;	/* members waiting to start */
+	unsigned int		running;	/* members started */
+
+	/* frame numbering, from the first start until all members stop */
+	unsigned int		seq;		/* next frame to complete */
+	unsigned int		stamped;	/* last_ts is valid */
+	struct timeval		last_ts;	/* first completion of ... */
+	unsigned int		last_n;		/* ... this frame */
+};
+
+static LIST_HEAD(tw68_groups);
+static DEFINE_MUTEX(tw68_groups_lock);
+
+/* the group tasklet: start @data if another member couldn't */
+static void tw68_group_go(unsigned long data)
+{
+	struct tw68_dev *dev = (struct tw68_dev *)data;
+	struct tw68_group *g = dev->group;
+	unsigned long flags;
+	int go;
+
+	if (NULL == g)
+		return;
+	spin_lock_irqsave(&dev->slock, flags);
+	spin_lock(&g->lock);
+	go = dev->group_go;
+	dev->group_go = 0;
+	spin_unlock(&g->lock);
+	if (go) {
+		dprintk(DBG_FLOW, "%s: deferred start\n", __func__);
+		tw68_video_go(dev, dev->group_dmac);
+	}
+	spin_unlock_irqrestore(&dev->slock, flags);
+}
+
+/*
+ * tw68_group_join
+ *
+ * Called at probe time with the group the 'group' option gives the
+ * device; 0 means none.
+ */
+void tw68_group_join(struct tw68_dev *dev, unsigned int id)
+{
+	struct tw68_group *g;
+	unsigned long flags;
+
+	if (0 == id || UNSET == id)
+		return;
+	mutex_lock(&tw68_groups_lock);
+	list_for_each_entry(g, &tw68_groups, list)
+		if (g->id == id)
+			goto found;
+	g = kzalloc(sizeof(*g), GFP_KERNEL);
+	if (NULL == g) {
+		mutex_unlock(&tw68_groups_lock);
+		printk(KERN_WARNING "%s: no memory for capture group %u\n",
+		       dev->name, id);
+		return;
+	}
+	g->id = id;
+	spin_lock_init(&g->lock);
+	INIT_LIST_HEAD(&g->devs);
+	list_add_tail(&g->list, &tw68_groups);
+found:
+	tasklet_init(&dev->group_tasklet, tw68_group_go, (unsigned long)dev);
+	spin_lock_irqsave(&g->lock, flags);
+	list_add_tail(&dev->group_list, &g->devs);
+	g->members++;
+	dev->group = g;
+	spin_unlock_irqrestore(&g->lock, flags);
+	mutex_unlock(&tw68_groups_lock);
+	printk(KERN_INFO "%s: member %u of capture group %u\n",
+	       dev->name, g->members, id);
+}
+
+void tw68_group_leave(struct tw68_dev *dev)
+{
+	struct tw68_group *g = dev->group;
+	unsigned long flags;
+
+	if (NULL == g)
+		return;
+	tw68_group_stop(dev);
+	tasklet_kill(&dev->group_tasklet);
+	mutex_lock(&tw68_groups_lock);
+	spin_lock_irqsave(&g->lock, flags);
+	list_del(&dev->group_list);
+	g->members--;
+	dev->group = NULL;
+	spin_unlock_irqrestore(&g->lock, flags);
+	if (0 == g->members) {
+		list_del(&g->list);
+		kfree(g);
+	}
+	mutex_unlock(&tw68_groups_lock);
+}
+
+/*
+ * tw68_group_release
+ *
+ * Start all the waiting members of the group, under the group's lock
+ * and @dev's slock.  @dev itself is left to the caller, which is the
+ * last of them to start.  Each is numbered from the group's next frame
+ * (the DMAP was off, so its field count is not moving).
+ */
+static void tw68_group_release(struct tw68_group *g, struct tw68_dev *dev)
+{
+	struct tw68_dev *m;
+
+	list_for_each_entry(m, &g->devs, group_list) {
+		if (!m->group_pending)
+			continue;
+		m->group_pending = 0;
+		m->group_running = 1;
+		m->group_base = g->seq;
+		m->group_fc0 = m->video_fieldcount & ~1;
+		g->pending--;
+		g->running++;
+		if (m == dev)
+			continue;
+		if (spin_trylock(&m->slock)) {
+			tw68_video_go(m, m->group_dmac);
+			spin_unlock(&m->slock);
+		} else {
+			m->group_go = 1;
+			tasklet_schedule(&m->group_tasklet);
+		}
+	}
+	dprintk(DBG_FLOW, "%s: group %u started, %u of %u members\n",
+		__func__, g->id, g->running, g->members);
+}
+
+/*
+ * tw68_group_start
+ *
+ * Called by start_dma, under dev->slock, with the program loaded and
+ * @dmac the DMAC bits which start it.  Returns 1 if the caller should
+ * start the DMAP itself, 0 if that is left to the last member of the
+ * group to become ready.
+ */
+int tw68_group_start(struct tw68_dev *dev, u32 dmac)
+{
+	struct tw68_group *g = dev->group;
+
+	if (NULL == g)
+		return 1;
+	spin_lock(&g->lock);
+	if (dev->group_running) {
+		/* (re)started on its own, or owed the group's start */
+		dev->group_go = 0;
+		spin_unlock(&g->lock);
+		return 1;
+	}
+	dev->group_dmac = dmac;
+	if (!dev->group_pending) {
+		dev->group_pending = 1;
+		g->pending++;
+	}
+	if (0 == g->running && g->pending < g->members) {
+		dprintk(DBG_FLOW, "%s: %u of %u members ready\n", __func__,
+			g->pending, g->members);
+		spin_unlock(&g->lock);
+		return 0;
+	}
+	/* everybody is ready, or the group already runs */
+	tw68_group_release(g, dev);
+	spin_unlock(&g->lock);
+	return 1;
+}
+
+/*
+ * tw68_group_expire
+ *
+ * Called by tw68_buffer_timeout, under dev->slock.  If the device was
+ * waiting for the rest of its group, it has waited long enough: it
+ * starts, with whichever members are ready.  If it was owed the start
+ * by another member, it takes it now.  Returns 1 if the DMAP was
+ * started, so that the timeout is no failure of the buffers.
+ */
+int tw68_group_expire(struct tw68_dev *dev)
+{
+	struct tw68_group *g = dev->group;
+	int started = 0;
+
+	if (NULL == g)
+		return 0;
+	spin_lock(&g->lock);
+	if (dev->group_go) {
+		dev->group_go = 0;
+		started = 1;
+	} else if (dev->group_pending) {
+		printk(KERN_INFO "%s: capture group %u starting with %u of "
+		       "%u members\n", dev->name, g->id, g->pending,
+		       g->members);
+		tw68_group_release(g, dev);
+		started = 1;
+	}
+	spin_unlock(&g->lock);
+	if (started)
+		tw68_video_go(dev, dev->group_dmac);
+	return started;
+}
+
+/*
+ * tw68_group_stop
+ *
+ * The device stopped capturing: STREAMOFF, or the file which captured
+ * (by streaming or read()) was closed.  Called before its buffers are
+ * freed, so that no other member starts it on them.  When the last
+ * member stops, the group's frame numbering starts over.
+ */
+void tw68_group_stop(struct tw68_dev *dev)
+{
+	struct tw68_group *g = dev->group;
+	unsigned long flags;
+
+	if (NULL == g)
+		return;
+	spin_lock_irqsave(&g->lock, flags);
+	dev->group_go = 0;
+	if (dev->group_pending) {
+		dev->group_pending = 0;
+		g->pending--;
+	}
+	if (dev->group_running) {
+		dev->group_running = 0;
+		if (0 == --g->running) {
+			g->seq = 0;
+			g->stamped = 0;
+		}
+	}
+	spin_unlock_irqrestore(&g->lock, flags);
+}
+
+/*
+ * tw68_group_stamp
+ *
+ * Called by tw68_wakeup, under dev->slock, once buf has its own
+ * timestamp and field count: renumbers it on the group's counter, and
+ * gives it the timestamp of the group's first completion of the frame.
+ */
+void tw68_group_stamp(struct tw68_dev *dev, struct tw68_buf *buf)
+{
+	struct tw68_group *g = dev->group;
+	unsigned int n;
+
+	if (NULL == g)
+		return;
+	spin_lock(&g->lock);
+	if (!dev->group_running) {
+		spin_unlock(&g->lock);
+		return;
+	}
+	/* field_count is even for each frame's first field */
+	buf->vb.field_count += 2 * dev->group_base - dev->group_fc0;
+	n = buf->vb.field_count >> 1;
+	if (n >= g->seq)
+		g->seq = n + 1;
+	if (!g->stamped || n > g->last_n) {
+		g->stamped = 1;
+		g->last_n = n;
+		g->last_ts = buf->vb.ts;
+	} else if (n == g->last_n) {
+		buf->vb.ts = g->last_ts;
+	}
+	spin_unlock(&g->lock);
+}
+
+#ifdef CONFIG_DEBUG_FS
+/* fills in @st and returns 1 if @dev is in a group; under dev->slock */
+int tw68_group_state(struct tw68_dev *dev, struct tw68_group_state *st)
+{
+	struct tw68_group *g = dev->group;
+
+	if (NULL == g)
+		return 0;
+	spin_lock(&g->lock);
+	st->id = g->id;
+	st->members = g->members;
+	st->pending = g->pending;
+	st->running = g->running;
+	st->seq = g->seq;
+	st->base = dev->group_base;
+	st->state = dev->group_running ? "running" :
+		    dev->group_pending ? "pending" : "stopped";
+	spin_unlock(&g->lock);
+	return 1;
+}
+#endif
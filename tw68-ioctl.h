@@ -0,0 +1,168 @@
+/*
+ *  tw68-ioctl.h
+ *  Private ioctls of the device driver for Techwell 68xx based cards,
+ *  shared with applications.
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _TW68_IOCTL_H_
+#define _TW68_IOCTL_H_
+
+#include <linux/types.h>
+#include <linux/videodev2.h>
+
+/*
+ * TW68_IOC_G_META
+ *
+ * What the driver knows about how a capture buffer was filled, valid
+ * from the buffer's completion until it is queued again: typically
+ * read right after VIDIOC_DQBUF, or returned by TW68_IOC_BATCH along
+ * with the buffer.  Set index; the rest is filled in.  EINVAL if there
+ * is no such buffer.
+ *
+ * input is the one to demultiplex on when the "Input Scan Mask"
+ * control has the decoder cycle through several inputs: current
+ * kernels no longer have v4l2_buffer.input to report it in.
+ */
+struct tw68_meta {
+	__u32			index;		/* in: v4l2_buffer.index */
+	__u32			sequence;	/* v4l2_buffer.sequence */
+	__u32			input;		/* V4L2 input it came from */
+	__u32			vmux;		/* decoder mux, 0-3 */
+	__u32			status;		/* at completion, see below */
+	__u32			flags;		/* since the previous one */
+	__u32			latency;	/* usecs, field end to this call */
+	__u32			reserved;
+	struct v4l2_rect	crop;		/* in effect while filled */
+	__u32			offset;		/* v4l2_buffer.m.offset */
+	__u32			frames;		/* tap: frames taken so far */
+	__u32			dropped;	/* tap: frames missed so far */
+	__u32			reserved2;
+};
+
+/* index values for tap handles, see below */
+#define TW68_META_TAP_NEXT	0xffffffff	/* take the newest frame */
+#define TW68_META_TAP_LAST	0xfffffffe	/* the frame taken last */
+
+/* status: the decoder's STATUS1 register when the buffer completed */
+#define TW68_META_DET50		0x0001	/* 50Hz source */
+#define TW68_META_VLOCK		0x0008	/* vertical sync locked */
+#define TW68_META_SLOCK		0x0020	/* colour subcarrier locked */
+#define TW68_META_HLOCK		0x0040	/* horizontal sync locked */
+#define TW68_META_VDLOSS	0x0080	/* no video signal */
+
+/* flags: what happened between the previous completion and this one */
+#define TW68_META_RESTART	0x0001	/* DMA (re)started for it */
+#define TW68_META_STOPPER	0x0002	/* DMA ran into the stopper */
+#define TW68_META_MISSED	0x0004	/* frames were missed before it */
+#define TW68_META_SYNC		0x0008	/* sync lost or regained */
+#define TW68_META_FIFO		0x0010	/* FIFO overflow or error */
+#define TW68_META_DMAERR	0x0020	/* PCI abort or DMA error */
+
+/*
+ * TW68_META_SYNC is set when the lock bits of status differ from the
+ * previous completion's, and on 6804-class chips also when the decoder
+ * interrupted on a lock change in between; other chips have no such
+ * interrupt, so a loss of lock which is regained between two
+ * completions goes unseen there.
+ *
+ * Tap handles
+ *
+ * While one file handle streams, others opened on the same device can
+ * share its frames as "tap" handles, each with its own pace, count of
+ * frames taken and of frames missed (frames, dropped).  Their format
+ * must be the one streamed (EBUSY otherwise).  poll() tells when a
+ * newer frame is done.  read() copies it out; to share it without a
+ * copy, TW68_META_TAP_NEXT as index takes the newest frame (EAGAIN if
+ * none was done since the last one taken) and returns its meta, where
+ * index and offset name the owner's buffer holding it.  mmap() of the
+ * tap handle at offset, read-only, maps that buffer (the owner must
+ * use V4L2_MEMORY_MMAP).  The owner requeues its buffers as it likes:
+ * once done reading, G_META with the index returns the same sequence
+ * if the frame is still there, EBUSY if it is being filled again.
+ * TW68_META_TAP_LAST returns the meta of the frame taken last, by
+ * read() or TW68_META_TAP_NEXT.
+ */
+
+#define TW68_IOC_G_META	_IOWR('V', BASE_VIDIOC_PRIVATE + 1, struct tw68_meta)
+
+/*
+ * TW68_IOC_BATCH
+ *
+ * Requeues and dequeues the capture buffers of several tw68 video
+ * devices in one call, in place of a VIDIOC_QBUF and a VIDIOC_DQBUF on
+ * each.  It may be issued on any open tw68 video device; the entries
+ * name the devices by file descriptor, and may repeat one to dequeue
+ * more than a buffer from it.
+ *
+ * For each entry in turn: if TW68_BATCH_QBUF is set, buf is queued as
+ * by VIDIOC_QBUF.  Then, whether or not that was done, a buffer is
+ * dequeued as by VIDIOC_DQBUF on a non-blocking file: if one was ready
+ * it is returned in buf, with its TW68_IOC_G_META in meta, and
+ * TW68_BATCH_DONE is set; otherwise buf is cleared.  result is 0, or
+ * the negative error code of the step which failed; a failed entry
+ * does not stop the others.
+ *
+ * With TW68_BATCH_SET in flags, the entries must name different
+ * devices, typically the members of a capture group (the 'group'
+ * module option), and the buffers are dequeued as a set of the same
+ * frame: after all the QBUF steps, a buffer is dequeued from every
+ * entry if each device has one done and they all have the same
+ * sequence, and from none otherwise.  Done buffers older than the
+ * newest of them can't be part of a set any more: they are requeued
+ * on the spot and counted in dropped, and the devices looked at again.
+ * The devices' buffers must not be dequeued elsewhere meanwhile.
+ *
+ * The call only fails (EFAULT, EINVAL, ENOMEM) if the entries can't be
+ * read or written back, count is above TW68_BATCH_MAX or flags are
+ * unknown; done is set to the number of buffers dequeued.  The call
+ * never waits: poll() one of the devices first - the members of a
+ * capture group complete a frame together.
+ *
+ * 32-bit processes on a 64-bit kernel can use TW68_IOC_G_META and
+ * TW68_IOC_BATCH from Linux 3.10 on; the driver converts the
+ * v4l2_buffer in their entries, which is laid out differently.
+ */
+struct tw68_batch_entry {
+	__s32			fd;
+	__u32			flags;
+	__s32			result;		/* out */
+	__u32			reserved;
+	struct v4l2_buffer	buf;
+	struct tw68_meta	meta;		/* out, with TW68_BATCH_DONE */
+};
+
+#define TW68_BATCH_QBUF		0x0001	/* in: queue buf first */
+#define TW68_BATCH_DONE		0x0100	/* out: a buffer was dequeued */
+
+struct tw68_batch {
+	__u64			entries;	/* struct tw68_batch_entry * */
+	__u32			count;
+	__u32			done;		/* out */
+	__u32			flags;
+	__u32			dropped;	/* out, with TW68_BATCH_SET */
+	__u32			reserved[2];
+};
+
+#define TW68_BATCH_SET		0x0001	/* dequeue a frame set, or none */
+
+#define TW68_BATCH_MAX		64
+
+#define TW68_IOC_BATCH	_IOWR('V', BASE_VIDIOC_PRIVATE + 0, struct tw68_batch)
+
+#endif
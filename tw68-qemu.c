@@ -0,0 +1,241 @@
+/*
+ *  tw68-qemu.c - QEMU PCI device wrapping the TW68xx model (tw68-sim.c)
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A "tw68" PCI device for QEMU, so that the unmodified tw68.ko can be
+ * probed and driven in a VM: BAR 0 is the model's register file, its
+ * bus mastering goes through pci_dma_read/write on guest memory, its
+ * interrupt line is INTA#, and a QEMU_CLOCK_VIRTUAL timer is its field
+ * clock.  The guest sees a TW6800 (device-id property to change it)
+ * with no I2C devices, tuner or audio.
+ *
+ * It is not built here: it is written against the QEMU 8.x device API
+ * and goes into a QEMU tree, see tw68-vmtest.sh which does that and
+ * then boots a kernel with the driver on it.  In the tree, as
+ * hw/misc/tw68.c next to tw68-sim.c, tw68-sim.h and tw68-reg.h:
+ *
+ *	hw/misc/Kconfig:	config TW68
+ *				    bool
+ *				    default y if PCI_DEVICES
+ *				    depends on PCI
+ *	hw/misc/meson.build:	system_ss.add(when: 'CONFIG_TW68',
+ *				    if_true: files('tw68.c', 'tw68-sim.c'))
+ *
+ * Properties: device-id (0x6800), signal (on: input locked, off:
+ * VDLOSS), norm50 (on: 625/50 timing, off: 525/60), fifo-stall (make
+ * the FIFO overflow every that many fields, 0 for never).
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/module.h"
+#include "qemu/timer.h"
+#include "hw/pci/pci_device.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
+#include "qom/object.h"
+
+#include "tw68-sim.h"
+
+#define	TYPE_TW68	"tw68"
+OBJECT_DECLARE_SIMPLE_TYPE(TW68State, TW68)
+
+struct TW68State {
+	PCIDevice		parent_obj;
+
+	MemoryRegion		mmio;
+	QEMUTimer		*field_timer;
+	struct tw68_sim		sim;
+
+	/* properties */
+	uint16_t		device_id;
+	bool			signal;
+	bool			norm50;
+	uint32_t		fifo_stall;
+	uint32_t		fields;		/* since the last stall */
+};
+
+static int tw68_qemu_dma_read(void *opaque, uint32_t addr, void *buf,
+			      size_t len)
+{
+	TW68State *s = opaque;
+
+	return pci_dma_read(PCI_DEVICE(s), addr, buf, len) ? -1 : 0;
+}
+
+static int tw68_qemu_dma_write(void *opaque, uint32_t addr, const void *buf,
+			       size_t len)
+{
+	TW68State *s = opaque;
+
+	return pci_dma_write(PCI_DEVICE(s), addr, buf, len) ? -1 : 0;
+}
+
+static void tw68_qemu_set_irq(void *opaque, int level)
+{
+	TW68State *s = opaque;
+
+	pci_set_irq(PCI_DEVICE(s), level);
+}
+
+static const struct tw68_sim_ops tw68_qemu_sim_ops = {
+	.dma_read	= tw68_qemu_dma_read,
+	.dma_write	= tw68_qemu_dma_write,
+	.set_irq	= tw68_qemu_set_irq,
+};
+
+/* the driver only does 32 bit and byte accesses (tw_readl, tw_readb) */
+static uint64_t tw68_qemu_mmio_read(void *opaque, hwaddr addr, unsigned size)
+{
+	TW68State *s = opaque;
+
+	if (4 == size)
+		return tw68_sim_readl(&s->sim, addr);
+	if (2 == size)
+		return tw68_sim_readb(&s->sim, addr) |
+		       (tw68_sim_readb(&s->sim, addr + 1) << 8);
+	return tw68_sim_readb(&s->sim, addr);
+}
+
+static void tw68_qemu_mmio_write(void *opaque, hwaddr addr, uint64_t val,
+				 unsigned size)
+{
+	TW68State *s = opaque;
+
+	if (4 == size) {
+		tw68_sim_writel(&s->sim, addr, val);
+	} else if (2 == size) {
+		tw68_sim_writeb(&s->sim, addr, val);
+		tw68_sim_writeb(&s->sim, addr + 1, val >> 8);
+	} else {
+		tw68_sim_writeb(&s->sim, addr, val);
+	}
+}
+
+static const MemoryRegionOps tw68_qemu_mmio_ops = {
+	.read		= tw68_qemu_mmio_read,
+	.write		= tw68_qemu_mmio_write,
+	.endianness	= DEVICE_LITTLE_ENDIAN,
+	.valid		= {
+		.min_access_size = 1,
+		.max_access_size = 4,
+	},
+	.impl		= {
+		.min_access_size = 1,
+		.max_access_size = 4,
+	},
+};
+
+/* one video field, and the timer set for the next */
+static void tw68_qemu_field(void *opaque)
+{
+	TW68State *s = opaque;
+
+	if (s->fifo_stall && ++s->fields >= s->fifo_stall) {
+		s->fields = 0;
+		tw68_sim_stall_fifo(&s->sim, 1);
+	}
+	tw68_sim_field(&s->sim);
+	timer_mod(s->field_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+		  tw68_sim_field_ns(&s->sim));
+}
+
+static void tw68_qemu_realize(PCIDevice *pdev, Error **errp)
+{
+	TW68State *s = TW68(pdev);
+
+	pci_config_set_device_id(pdev->config, s->device_id);
+	pci_config_set_interrupt_pin(pdev->config, 1);
+
+	memory_region_init_io(&s->mmio, OBJECT(s), &tw68_qemu_mmio_ops, s,
+			      "tw68-mmio", TW68_SIM_BAR_SIZE);
+	pci_register_bar(pdev, 0, PCI_BASE_ADDRESS_SPACE_MEMORY, &s->mmio);
+
+	tw68_sim_init(&s->sim, &tw68_qemu_sim_ops, s);
+	tw68_sim_set_norm50(&s->sim, s->norm50);
+	tw68_sim_set_signal(&s->sim, s->signal);
+
+	s->field_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, tw68_qemu_field, s);
+	timer_mod(s->field_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+		  tw68_sim_field_ns(&s->sim));
+}
+
+static void tw68_qemu_exit(PCIDevice *pdev)
+{
+	TW68State *s = TW68(pdev);
+
+	timer_free(s->field_timer);
+}
+
+static void tw68_qemu_reset(DeviceState *dev)
+{
+	TW68State *s = TW68(dev);
+
+	tw68_sim_reset(&s->sim);
+	s->fields = 0;
+}
+
+static Property tw68_qemu_properties[] = {
+	DEFINE_PROP_UINT16("device-id", TW68State, device_id, 0x6800),
+	DEFINE_PROP_BOOL("signal", TW68State, signal, true),
+	DEFINE_PROP_BOOL("norm50", TW68State, norm50, false),
+	DEFINE_PROP_UINT32("fifo-stall", TW68State, fifo_stall, 0),
+	DEFINE_PROP_END_OF_LIST(),
+};
+
+/* the model's state is not described for migration */
+static const VMStateDescription tw68_qemu_vmstate = {
+	.name		= TYPE_TW68,
+	.unmigratable	= 1,
+};
+
+static void tw68_qemu_class_init(ObjectClass *klass, void *data)
+{
+	DeviceClass *dc = DEVICE_CLASS(klass);
+	PCIDeviceClass *k = PCI_DEVICE_CLASS(klass);
+
+	k->realize = tw68_qemu_realize;
+	k->exit = tw68_qemu_exit;
+	k->vendor_id = 0x1797;		/* Techwell */
+	k->device_id = 0x6800;
+	k->class_id = PCI_CLASS_MULTIMEDIA_VIDEO;
+	dc->desc = "Techwell TW68xx video decoder (software model)";
+	dc->reset = tw68_qemu_reset;
+	dc->vmsd = &tw68_qemu_vmstate;
+	device_class_set_props(dc, tw68_qemu_properties);
+	set_bit(DEVICE_CATEGORY_MISC, dc->categories);
+}
+
+static const TypeInfo tw68_qemu_info = {
+	.name		= TYPE_TW68,
+	.parent		= TYPE_PCI_DEVICE,
+	.instance_size	= sizeof(TW68State),
+	.class_init	= tw68_qemu_class_init,
+	.interfaces	= (InterfaceInfo[]) {
+		{ INTERFACE_CONVENTIONAL_PCI_DEVICE },
+		{ },
+	},
+};
+
+static void tw68_qemu_register_types(void)
+{
+	type_register_static(&tw68_qemu_info);
+}
+
+type_init(tw68_qemu_register_types)
@@ -88,6 +88,19 @@
 #define	TW68_SSDAT_B		(1 << TW68_SSDAT)
 #define	TW68_SBRW_B		(1 << TW68_SBRW)
 
+/* define the decoder status (STATUS1) register bits */
+#define	TW68_STATUS1_VLOCK	(1 << 3)	/* vertical sync locked */
+#define	TW68_STATUS1_HLOCK	(1 << 6)	/* horizontal sync locked */
+#define	TW68_STATUS1_VDLOSS	(1 << 7)	/* no video signal */
+
+/* define the Analog Control register bits */
+#define	TW68_ACNTL_SRESET	(1 << 7)	/* soft reset */
+#define	TW68_ACNTL_CLK_SLEEP	(1 << 3)	/* decoder clock power down */
+#define	TW68_ACNTL_Y_SLEEP	(1 << 2)	/* luma ADC power down */
+#define	TW68_ACNTL_C_SLEEP	(1 << 1)	/* chroma ADC power down */
+#define	TW68_ACNTL_SLEEP	(TW68_ACNTL_CLK_SLEEP | TW68_ACNTL_Y_SLEEP | \
+				 TW68_ACNTL_C_SLEEP)
+
 #define	TW68_GPDATA		0x100
 #define	TW68_STATUS1		0x204
 #define	TW68_INFORM		0x208
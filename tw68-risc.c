@@ -26,7 +26,11 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#ifdef TW68_USERSPACE
+#include "tw68-shim.h"		/* 'make risctest' */
+#else
 #include "tw68.h"
+#endif
 
 #define NO_SYNC_LINE (-1U)
 
@@ -94,8 +98,8 @@ static __le32 *tw68_risc_field(__le32 *rp, struct scatterlist *sglist,
 						sg_dma_len(sg));
 				*(rp++) = cpu_to_le32(sg_dma_address(sg));
 				todo -= sg_dma_len(sg);
-				sg++;
 				done += sg_dma_len(sg);
+				sg++;
 			}
 			if (todo) {
 				/* final chunk - offset 0, count 'todo' */
@@ -157,9 +161,11 @@ int tw68_risc_buffer(struct pci_dev *pci,
 	 * estimate risc mem: worst case is one write per page border +
 	 * one write per scan line + syncs + jump (all 2 dwords).
 	 * Padding can cause next bpl to start close to a page border.
-	 * First DMA region may be smaller than PAGE_SIZE
+	 * First DMA region may be smaller than PAGE_SIZE, which can add
+	 * one more page border to each field (user pointers which are
+	 * not page aligned).
 	 */
-	instructions  = fields * (1 + (((bpl + padding) * lines) /
+	instructions  = fields * (2 + (((bpl + padding) * lines) /
 			 PAGE_SIZE) + lines) + 2;
 	rc = btcx_riscmem_alloc(pci, risc, instructions * 8);
 	if (rc < 0)
@@ -181,57 +187,110 @@ int tw68_risc_buffer(struct pci_dev *pci,
 	return 0;
 }
 
-#if 0
+/**
+ * tw68_risc_frame
+ *
+ * 	Build the program for a whole buffer of @height lines of @bpl
+ * 	bytes, laid out as @field asks.  This is the one place which
+ * 	knows how each V4L2 field order maps onto the two video fields;
+ * 	buffer_prepare() and the user space tools both come through here.
+ *
+ * 	@stride is the distance between the starts of two lines of the
+ * 	buffer (the V4L2 bytesperline), at least @bpl; the bytes between
+ * 	the end of a line and the start of the next are left untouched.
+ */
+int tw68_risc_frame(struct pci_dev *pci, struct btcx_riscmem *risc,
+		    struct scatterlist *sglist, enum v4l2_field field,
+		    unsigned int bpl, unsigned int stride,
+		    unsigned int height)
+{
+	if (stride < bpl)
+		return -EINVAL;
+	switch (field) {
+	case V4L2_FIELD_TOP:
+	case V4L2_FIELD_ALTERNATE:	/* first sync set when queued */
+		return tw68_risc_buffer(pci, risc, sglist,
+					0, UNSET, bpl, stride - bpl, height);
+	case V4L2_FIELD_BOTTOM:
+		return tw68_risc_buffer(pci, risc, sglist,
+					UNSET, 0, bpl, stride - bpl, height);
+	case V4L2_FIELD_INTERLACED:
+		return tw68_risc_buffer(pci, risc, sglist,
+					0, stride, bpl, 2 * stride - bpl,
+					height >> 1);
+	case V4L2_FIELD_SEQ_TB:
+		return tw68_risc_buffer(pci, risc, sglist,
+					0, stride * (height >> 1),
+					bpl, stride - bpl, height >> 1);
+	case V4L2_FIELD_SEQ_BT:
+		return tw68_risc_buffer(pci, risc, sglist,
+					stride * (height >> 1), 0,
+					bpl, stride - bpl, height >> 1);
+	default:
+		return -EINVAL;
+	}
+}
+
 /* ------------------------------------------------------------------ */
 /* debug helper code                                                  */
 
-static void tw68_risc_decode(u32 risc, u32 addr)
-{
 #define	RISC_OP(reg)	(((reg) >> 28) & 7)
-	static struct instr_details {
-		char *name;
-		u8 has_data_type;
-		u8 has_byte_info;
-		u8 has_addr;
-	} instr[8] = {
-		[RISC_OP(RISC_SYNCO)]	  = {"syncOdd", 0, 0, 0},
-		[RISC_OP(RISC_SYNCE)]	  = {"syncEven", 0, 0, 0},
-		[RISC_OP(RISC_JUMP)]	  = {"jump", 0, 0, 1},
-		[RISC_OP(RISC_LINESTART)] = {"lineStart", 1, 1, 1},
-		[RISC_OP(RISC_INLINE)]	  = {"inline", 1, 1, 1},
-	};
+
+static const struct instr_details {
+	char *name;
+	u8 has_data_type;
+	u8 has_byte_info;
+	u8 has_addr;
+} instr[8] = {
+	[RISC_OP(RISC_SYNCO)]	  = {"syncOdd", 0, 0, 0},
+	[RISC_OP(RISC_SYNCE)]	  = {"syncEven", 0, 0, 0},
+	[RISC_OP(RISC_JUMP)]	  = {"jump", 0, 0, 1},
+	[RISC_OP(RISC_LINESTART)] = {"lineStart", 1, 1, 1},
+	[RISC_OP(RISC_INLINE)]	  = {"inline", 1, 1, 1},
+};
+
+/*
+ * tw68_risc_decode
+ *
+ *	Format the instruction @risc, with its address dword @addr, into
+ *	@buf as one line of text.  Returns the length written.
+ */
+int tw68_risc_decode(char *buf, size_t len, u32 risc, u32 addr)
+{
 	u32 p;
+	int n;
 
 	p = RISC_OP(risc);
-	if (!(risc & 0x80000000) || !instr[p].name) {
-		printk(KERN_DEBUG "0x%08x [ INVALID ]\n", risc);
-		return;
-	}
-	printk(KERN_DEBUG "0x%08x %-9s IRQ=%d",
-		risc, instr[p].name, (risc >> 27) & 1);
+	if (!(risc & 0x80000000) || !instr[p].name)
+		return scnprintf(buf, len, "0x%08x [ INVALID ]", risc);
+	n = scnprintf(buf, len, "0x%08x %-9s IRQ=%d",
+		      risc, instr[p].name, (risc >> 27) & 1);
 	if (instr[p].has_data_type)
-		printk(KERN_DEBUG " Type=%d", (risc >> 24) & 7);
+		n += scnprintf(buf + n, len - n, " Type=%d",
+			       (risc >> 24) & 7);
 	if (instr[p].has_byte_info)
-		printk(KERN_DEBUG " Start=0x%03x Count=%03u",
-			(risc >> 12) & 0xfff, risc & 0xfff);
+		n += scnprintf(buf + n, len - n, " Start=0x%03x Count=%03u",
+			       (risc >> 12) & 0xfff, risc & 0xfff);
 	if (instr[p].has_addr)
-		printk(KERN_DEBUG " StartAddr=0x%08x", addr);
-	printk(KERN_DEBUG "\n");
+		n += scnprintf(buf + n, len - n, " StartAddr=0x%08x", addr);
+	return n;
 }
 
-void tw68_risc_program_dump(struct tw68_core *core,
+void tw68_risc_program_dump(struct tw68_dev *dev,
 			    struct btcx_riscmem *risc)
 {
 	__le32 *addr;
+	char line[96];
 
 	printk(KERN_DEBUG "%s: risc_program_dump: risc=%p, "
 			  "risc->cpu=0x%p, risc->jmp=0x%p\n",
-			  core->name, risc, risc->cpu, risc->jmp);
-	for (addr = risc->cpu; addr <= risc->jmp; addr += 2)
-		tw68_risc_decode(*addr, *(addr+1));
+			  dev->name, risc, risc->cpu, risc->jmp);
+	for (addr = risc->cpu; addr <= risc->jmp; addr += 2) {
+		tw68_risc_decode(line, sizeof(line), le32_to_cpu(addr[0]),
+				 le32_to_cpu(addr[1]));
+		printk(KERN_DEBUG "%s: %s\n", dev->name, line);
+	}
 }
-EXPORT_SYMBOL_GPL(tw68_risc_program_dump);
-#endif
 
 /*
  * tw68_risc_stopper
@@ -266,3 +325,28 @@ int tw68_risc_stopper(struct pci_dev *pci, struct btcx_riscmem *risc)
 	risc->jmp = risc->cpu;
 	return 0;
 }
+
+/**
+ * tw68_risc_skip
+ *
+ * 	Fill @risc, allocated for at least @fields + 1 instructions, with
+ * 	a program which lets @fields video fields go by without writing
+ * 	anything and then jumps to @next.  @sync is the first instruction
+ * 	of @next: the skipped fields alternate so that the last one is of
+ * 	the other parity, and @next starts on the field right after it.
+ */
+void tw68_risc_skip(struct btcx_riscmem *risc, unsigned int fields,
+		    u32 sync, u32 next)
+{
+	u32 other = (RISC_SYNCO == sync) ? RISC_SYNCE : RISC_SYNCO;
+	__le32 *rp = risc->cpu;
+	unsigned int i;
+
+	for (i = fields; i > 0; i--) {
+		*(rp++) = cpu_to_le32((i & 1) ? other : sync);
+		*(rp++) = 0;
+	}
+	risc->jmp = rp;
+	*(rp++) = cpu_to_le32(RISC_JUMP);
+	*(rp++) = cpu_to_le32(next);
+}
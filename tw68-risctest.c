@@ -0,0 +1,463 @@
+/*
+ *  tw68-risctest.c - check the RISC programs built by tw68-risc.c
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Builds tw68-risc.c unchanged (through tw68-shim.h), generates programs
+ * for every format depth, a range of sizes (with and without padding
+ * at the end of each line), every field layout the driver uses and
+ * several shapes of scatter-gather list, runs each one on the tw68-sim
+ * DMAP processor and checks that
+ *
+ *	- every byte of every line is written exactly once, with the data
+ *	  belonging to that line and position, and nothing else is written;
+ *	- the program fits in its btcx_riscmem allocation;
+ *	- the program is made of valid instructions, and its only JUMP
+ *	  (patched in like tw68_buffer_queue does) goes to the stopper.
+ *
+ * Usage: tw68-risctest [-v] [-d]	(-v lists every case, -d also
+ *					 dumps the failing programs)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tw68-shim.h"
+#include "tw68-sim.h"
+
+#define	BUS_SIZE	(16 << 20)
+#define	BUS_BASE	0x10000		/* nothing lives at bus address 0 */
+#define	GUARD		64		/* canary after each riscmem */
+#define	CANARY		0x5a
+
+/*
+ * Field layouts.  run_case() works out independently where each line
+ * should land and checks tw68_risc_frame() against that.
+ */
+enum layout { TOP, BOTTOM, INTERLACED, SEQ_TB, SEQ_BT, ALT_BOTTOM };
+static const char *layout_name[] = {
+	"top", "bottom", "interlaced", "seq-tb", "seq-bt", "alt-bottom",
+};
+static const enum v4l2_field layout_field[] = {
+	V4L2_FIELD_TOP, V4L2_FIELD_BOTTOM, V4L2_FIELD_INTERLACED,
+	V4L2_FIELD_SEQ_TB, V4L2_FIELD_SEQ_BT, V4L2_FIELD_ALTERNATE,
+};
+
+/* shapes of the sg list handed to tw68_risc_frame() */
+enum sgshape { SG_CONTIG, SG_PAGES, SG_OFFSET, SG_MERGED };
+static const char *sgshape_name[] = {
+	"contig", "pages", "offset", "merged",
+};
+
+static uint8_t *bus;			/* the simulated bus memory */
+static uint32_t bus_top;		/* bump allocator */
+static uint8_t *written;		/* times each bus byte was written */
+static uint8_t *wfield;			/* field number of the last write */
+
+static struct tw68_sim sim;
+static int verbose, dump, bugs;
+
+void tw68_shim_bug(const char *file, int line, const char *cond)
+{
+	fprintf(stderr, "BUG at %s:%d: %s\n", file, line, cond);
+	bugs++;
+}
+
+static uint32_t bus_alloc(uint32_t size, uint32_t align)
+{
+	uint32_t addr = (bus_top + align - 1) & ~(align - 1);
+
+	if (addr + size > BUS_SIZE) {
+		fprintf(stderr, "out of bus memory\n");
+		exit(2);
+	}
+	bus_top = addr + size;
+	return addr;
+}
+
+int btcx_riscmem_alloc(struct pci_dev *pci, struct btcx_riscmem *risc,
+		       unsigned int size)
+{
+	risc->dma = bus_alloc(size + GUARD, 8);
+	risc->cpu = (__le32 *)(bus + risc->dma);
+	risc->size = size;
+	memset(risc->cpu, 0, size);
+	memset((uint8_t *)risc->cpu + size, CANARY, GUARD);
+	return 0;
+}
+
+void btcx_riscmem_free(struct pci_dev *pci, struct btcx_riscmem *risc)
+{
+	memset(risc, 0, sizeof(*risc));
+}
+
+static int bus_read(void *opaque, uint32_t addr, void *buf, size_t len)
+{
+	if (addr < BUS_BASE || addr > bus_top || len > bus_top - addr)
+		return -1;
+	memcpy(buf, bus + addr, len);
+	return 0;
+}
+
+static int bus_write(void *opaque, uint32_t addr, const void *buf,
+		     size_t len)
+{
+	size_t i;
+
+	if (addr < BUS_BASE || addr > bus_top || len > bus_top - addr)
+		return -1;
+	memcpy(bus + addr, buf, len);
+	for (i = 0; i < len; i++) {
+		if (written[addr + i] < 255)
+			written[addr + i]++;
+		wfield[addr + i] = sim.stats.fields;
+	}
+	return 0;
+}
+
+static const struct tw68_sim_ops bus_ops = {
+	.dma_read	= bus_read,
+	.dma_write	= bus_write,
+};
+
+/*
+ * Lay out @npages pages of a buffer on the bus and describe them with
+ * an sg list of the requested shape.  page_addr[] receives the bus
+ * address of each page, so buffer offsets can be translated.
+ */
+static int build_sg(enum sgshape shape, unsigned int npages,
+		    unsigned int offset, struct scatterlist *sg,
+		    uint32_t *page_addr)
+{
+	unsigned int i, n = 0, run;
+	uint32_t base;
+
+	switch (shape) {
+	case SG_CONTIG:
+		base = bus_alloc(npages * PAGE_SIZE, PAGE_SIZE);
+		for (i = 0; i < npages; i++)
+			page_addr[i] = base + i * PAGE_SIZE;
+		sg[n].dma_address = base;
+		sg[n++].dma_length = npages * PAGE_SIZE;
+		break;
+	case SG_PAGES:
+	case SG_OFFSET:
+		/* pages scattered in reverse order, one entry each */
+		base = bus_alloc(npages * PAGE_SIZE, PAGE_SIZE);
+		for (i = 0; i < npages; i++) {
+			page_addr[i] = base + (npages - 1 - i) * PAGE_SIZE;
+			sg[n].dma_address = page_addr[i];
+			sg[n++].dma_length = PAGE_SIZE;
+		}
+		break;
+	case SG_MERGED:
+		/* runs of 1..4 contiguous pages, as an IOMMU might merge */
+		for (i = 0; i < npages; i += run) {
+			run = 1 + (i * 7 + 3) % 4;
+			if (run > npages - i)
+				run = npages - i;
+			base = bus_alloc(run * PAGE_SIZE, PAGE_SIZE);
+			bus_alloc(PAGE_SIZE, PAGE_SIZE);	/* a gap */
+			sg[n].dma_address = base;
+			sg[n++].dma_length = run * PAGE_SIZE;
+			for (base = 0; base < run; base++)
+				page_addr[i + base] = sg[n - 1].dma_address +
+						      base * PAGE_SIZE;
+		}
+		break;
+	}
+	/* a user pointer which does not start on a page boundary */
+	if (offset) {
+		sg[0].dma_address += offset;
+		sg[0].dma_length -= offset;
+	}
+	return n;
+}
+
+static uint32_t buf_to_bus(const uint32_t *page_addr, unsigned int offset,
+			   unsigned int pos)
+{
+	pos += offset;
+	return page_addr[pos / PAGE_SIZE] + pos % PAGE_SIZE;
+}
+
+/* static checks on a program: opcodes, size, jump targets */
+static int check_program(const struct btcx_riscmem *risc,
+			 const struct btcx_riscmem *stopper)
+{
+	const __le32 *rp;
+	unsigned int i, used;
+	int errs = 0;
+
+	used = (risc->jmp - risc->cpu + 2) * sizeof(*risc->cpu);
+	if (used > risc->size) {
+		printf("    program uses %u bytes of %u allocated\n",
+		       used, risc->size);
+		errs++;
+	}
+	for (i = 0; i < GUARD; i++) {
+		if (((uint8_t *)risc->cpu)[risc->size + i] != CANARY) {
+			printf("    write past end of riscmem (+%u)\n", i);
+			errs++;
+			break;
+		}
+	}
+	for (rp = risc->cpu; rp <= risc->jmp; rp += 2) {
+		u32 op = le32_to_cpu(rp[0]) & 0xf0000000;
+
+		switch (op) {
+		case RISC_SYNCO:
+		case RISC_SYNCE:
+		case RISC_LINESTART:
+		case RISC_INLINE:
+			if (rp == risc->jmp) {
+				printf("    last instruction is not a jump\n");
+				errs++;
+			}
+			break;
+		case RISC_JUMP:
+			if (rp != risc->jmp) {
+				printf("    jump inside program at +%u\n",
+				       (unsigned int)(rp - risc->cpu) * 4);
+				errs++;
+			} else if (le32_to_cpu(rp[1]) != stopper->dma) {
+				printf("    jump to 0x%08x, stopper is at "
+				       "0x%08x\n", le32_to_cpu(rp[1]),
+				       stopper->dma);
+				errs++;
+			}
+			break;
+		default:
+			printf("    invalid instruction 0x%08x at +%u\n",
+			       le32_to_cpu(rp[0]),
+			       (unsigned int)(rp - risc->cpu) * 4);
+			errs++;
+		}
+	}
+	return errs;
+}
+
+struct field_desc {
+	unsigned int	offset;		/* of line 0 in the buffer, or UNSET */
+	unsigned int	field;		/* sim field number it is taken in */
+};
+
+static int run_case(unsigned int depth, unsigned int width,
+		    unsigned int height, unsigned int align, enum layout layout,
+		    enum sgshape shape, struct btcx_riscmem *stopper)
+{
+	struct tw68_dev dev = { .name = "risctest" };
+	static struct scatterlist sg[1024];
+	static uint32_t page_addr[1024];
+	struct btcx_riscmem risc;
+	struct field_desc f[2];
+	unsigned int bpl, bytesperline, lines, size, npages, offset;
+	unsigned int i, line, x, pos, stride;
+	uint32_t addr, stop_top;
+	int errs = 0, bugs_before = bugs;
+
+	bpl = width * depth / 8;
+	bytesperline = (bpl + align - 1) / align * align;
+	size = bytesperline * height;
+	offset = SG_OFFSET == shape ? 0xa40 : 0;
+	npages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	bus_top = stopper->dma + stopper->size + GUARD;
+	build_sg(shape, npages, offset, sg, page_addr);
+
+	/* stride: from one line of a field to the next */
+	stride = bytesperline;
+	lines = height;
+	f[0].offset = f[1].offset = UNSET;
+	switch (layout) {
+	case TOP:
+		f[0].offset = 0;
+		break;
+	case BOTTOM:
+		f[1].offset = 0;
+		break;
+	case INTERLACED:
+		f[0].offset = 0;
+		f[1].offset = bytesperline;
+		stride = 2 * bytesperline;
+		lines = height >> 1;
+		break;
+	case SEQ_TB:
+		f[0].offset = 0;
+		f[1].offset = bytesperline * (height >> 1);
+		lines = height >> 1;
+		break;
+	case SEQ_BT:
+		f[0].offset = bytesperline * (height >> 1);
+		f[1].offset = 0;
+		lines = height >> 1;
+		break;
+	case ALT_BOTTOM:
+		f[1].offset = 0;
+		break;
+	}
+
+	if (tw68_risc_frame(NULL, &risc, sg, layout_field[layout], bpl,
+			    bytesperline, height) < 0) {
+		printf("    tw68_risc_frame failed\n");
+		return 1;
+	}
+	/* an ALTERNATE buffer after a top field, as buffer_activate() */
+	if (ALT_BOTTOM == layout)
+		risc.cpu[0] = cpu_to_le32(RISC_SYNCE);
+	/* chain to the stopper, as tw68_buffer_queue() does */
+	risc.jmp[0] = cpu_to_le32(RISC_JUMP | RISC_INT_BIT);
+	risc.jmp[1] = cpu_to_le32(stopper->dma);
+	errs += check_program(&risc, stopper);
+	if (errs || bugs != bugs_before)
+		goto out;
+
+	/* run one odd and one even field */
+	memset(written, 0, BUS_SIZE);
+	tw68_sim_reset(&sim);
+	tw68_sim_writel(&sim, TW68_DMAP_SA, risc.dma);
+	tw68_sim_writel(&sim, TW68_DMAC, TW68_DMAP_EN | TW68_FIFO_EN);
+	tw68_sim_field(&sim);
+	f[0].field = sim.stats.fields;
+	tw68_sim_field(&sim);
+	f[1].field = sim.stats.fields;
+
+	if (sim.stats.errors) {
+		printf("    DMAP fault, INTSTAT 0x%08x PP 0x%08x\n",
+		       tw68_sim_readl(&sim, TW68_INTSTAT),
+		       tw68_sim_readl(&sim, TW68_DMAP_PP));
+		errs++;
+		goto out;
+	}
+	stop_top = stopper->dma + stopper->size;
+	addr = tw68_sim_readl(&sim, TW68_DMAP_PP);
+	if (sim.stats.irqs != 1 || addr < stopper->dma || addr >= stop_top) {
+		printf("    %llu DMAPI, ended at 0x%08x, not in the stopper\n",
+		       (unsigned long long)sim.stats.irqs, addr);
+		errs++;
+	}
+
+	/* every line byte exactly once, with the right contents */
+	for (i = 0; i < 2; i++) {
+		if (UNSET == f[i].offset)
+			continue;
+		for (line = 0; line < lines; line++) {
+			for (x = 0; x < bpl; x++) {
+				pos = f[i].offset + line * stride + x;
+				addr = buf_to_bus(page_addr, offset, pos);
+				if (1 != written[addr] ||
+				    f[i].field != wfield[addr] ||
+				    bus[addr] != tw68_sim_pattern(f[i].field,
+								  line, x)) {
+					printf("    field %u line %u byte %u: "
+					       "written %u times, data 0x%02x"
+					       "\n", i, line, x,
+					       written[addr], bus[addr]);
+					errs++;
+					goto out;
+				}
+				written[addr] = 0;
+			}
+		}
+	}
+	/* and nothing else */
+	for (addr = 0; addr < BUS_SIZE; addr++) {
+		if (written[addr]) {
+			printf("    stray write at bus address 0x%08x\n", addr);
+			errs++;
+			break;
+		}
+	}
+out:
+	if (errs && dump)
+		tw68_risc_program_dump(&dev, &risc);
+	btcx_riscmem_free(NULL, &risc);
+	return errs + bugs - bugs_before;
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned int depths[] = { 16, 24, 32 };
+	static const unsigned int widths[] = { 48, 176, 320, 352, 640, 704,
+					       720, 768 };
+	static const unsigned int heights[] = { 16, 120, 144, 240, 288, 480,
+						576 };
+	/* bytesperline rounded up to this, as an application may ask */
+	static const unsigned int aligns[] = { 1, 64 };
+	struct btcx_riscmem stopper;
+	unsigned int d, w, h, a, l, s, cases = 0, failed = 0;
+	int c, errs;
+
+	while ((c = getopt(argc, argv, "vd")) != -1) {
+		switch (c) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 'd':
+			dump = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-v] [-d]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	bus = calloc(1, BUS_SIZE);
+	written = calloc(1, BUS_SIZE);
+	wfield = calloc(1, BUS_SIZE);
+	if (!bus || !written || !wfield)
+		return 2;
+	tw68_sim_init(&sim, &bus_ops, NULL);
+	bus_top = BUS_BASE;
+	tw68_risc_stopper(NULL, &stopper);
+
+	for (d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+	for (w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+	for (h = 0; h < sizeof(heights) / sizeof(heights[0]); h++)
+	for (a = 0; a < sizeof(aligns) / sizeof(aligns[0]); a++)
+	for (l = TOP; l <= ALT_BOTTOM; l++)
+	for (s = SG_CONTIG; s <= SG_MERGED; s++) {
+		/* single field layouts only go up to one field's lines */
+		if ((TOP == l || BOTTOM == l || ALT_BOTTOM == l) &&
+		    heights[h] > 288)
+			continue;
+		/* lines which are already aligned were done with 1 */
+		if (aligns[a] > 1 && 0 == widths[w] * depths[d] / 8 % aligns[a])
+			continue;
+		cases++;
+		if (verbose)
+			printf("%2ubpp %3ux%-3u/%-2u %-10s %-6s\n", depths[d],
+			       widths[w], heights[h], aligns[a],
+			       layout_name[l], sgshape_name[s]);
+		errs = run_case(depths[d], widths[w], heights[h], aligns[a],
+				l, s, &stopper);
+		if (errs) {
+			if (!verbose)
+				printf("%2ubpp %3ux%-3u/%-2u %-10s %-6s\n",
+				       depths[d], widths[w], heights[h],
+				       aligns[a], layout_name[l],
+				       sgshape_name[s]);
+			printf("    FAILED\n");
+			failed++;
+		}
+	}
+	printf("%u cases, %u failed\n", cases, failed);
+	return failed ? 1 : 0;
+}
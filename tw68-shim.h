@@ -0,0 +1,111 @@
+/*
+ *  tw68-shim.h - just enough of the kernel to build tw68-risc.c
+ *  in user space
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * tw68-risc.c includes this instead of tw68.h when built with
+ * -DTW68_USERSPACE (see 'make risctest').  Whoever links it must
+ * provide btcx_riscmem_alloc()/btcx_riscmem_free(), i.e. own the
+ * "bus" the programs and buffers live on, and tw68_shim_bug().
+ */
+
+#ifndef _TW68_SHIM_H_
+#define _TW68_SHIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <linux/videodev2.h>
+
+#include "tw68-reg.h"
+
+typedef uint8_t		u8;
+typedef uint16_t	u16;
+typedef uint32_t	u32;
+typedef uint32_t	__le32;
+typedef uint32_t	dma_addr_t;
+
+/* every host this is built on is little-endian, like the chip */
+#define	cpu_to_le32(x)		((u32)(x))
+#define	le32_to_cpu(x)		((u32)(x))
+
+#define	PAGE_SIZE		4096UL
+#define	UNSET			(-1U)
+
+#define	KERN_DEBUG		""
+#define	printk			printf
+#define	scnprintf		snprintf
+#define	EXPORT_SYMBOL_GPL(sym)
+
+void tw68_shim_bug(const char *file, int line, const char *cond);
+#define	BUG_ON(cond)							\
+	do {								\
+		if (cond)						\
+			tw68_shim_bug(__FILE__, __LINE__, #cond);	\
+	} while (0)
+
+struct pci_dev;
+
+struct scatterlist {
+	dma_addr_t	dma_address;
+	unsigned int	dma_length;
+};
+#define	sg_dma_address(sg)	((sg)->dma_address)
+#define	sg_dma_len(sg)		((sg)->dma_length)
+
+struct btcx_riscmem {
+	unsigned int	size;
+	__le32		*cpu;
+	__le32		*jmp;
+	dma_addr_t	dma;
+};
+
+int  btcx_riscmem_alloc(struct pci_dev *pci, struct btcx_riscmem *risc,
+			unsigned int size);
+void btcx_riscmem_free(struct pci_dev *pci, struct btcx_riscmem *risc);
+
+struct tw68_dev {
+	char		name[32];
+};
+
+struct tw68_format {
+	char	*name;
+	u32	fourcc;
+	u32	depth;
+	u32	twformat;
+};
+
+/* tw68-risc.c, as declared in tw68.h */
+int tw68_risc_buffer(struct pci_dev *pci, struct btcx_riscmem *risc,
+	struct scatterlist *sglist, unsigned int top_offset,
+	unsigned int bottom_offset, unsigned int bpl,
+	unsigned int padding, unsigned int lines);
+int tw68_risc_frame(struct pci_dev *pci, struct btcx_riscmem *risc,
+	struct scatterlist *sglist, enum v4l2_field field,
+	unsigned int bpl, unsigned int stride, unsigned int height);
+int tw68_risc_stopper(struct pci_dev *pci, struct btcx_riscmem *risc);
+void tw68_risc_skip(struct btcx_riscmem *risc, unsigned int fields,
+	u32 sync, u32 next);
+int tw68_risc_decode(char *buf, size_t len, u32 risc, u32 addr);
+void tw68_risc_program_dump(struct tw68_dev *dev,
+			    struct btcx_riscmem *risc);
+
+#endif /* _TW68_SHIM_H_ */
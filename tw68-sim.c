@@ -0,0 +1,492 @@
+/*
+ *  tw68-sim.c - software model of a TW68xx PCI video decoder
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <string.h>
+
+#include "tw68-reg.h"
+#include "tw68-sim.h"
+
+#define	REG(off)	(sim->regs[(off) >> 2])
+
+/*
+ * The RISC opcode is in bits 28-30, bit 31 is always set.  Bits 24-26
+ * of a data instruction give the data type (ignored here), bits 12-23
+ * the start offset within the line and bits 0-11 the byte count.
+ */
+#define	RISC_OPMASK	0xf0000000
+#define	RISC_START(x)	(((x) >> 12) & 0xfff)
+#define	RISC_COUNT(x)	((x) & 0xfff)
+
+/* status bits which only reflect the state of the input */
+#define	SIM_LIVE_BITS	(TW68_DET50 | TW68_FIELD | TW68_VLOCK | \
+			 TW68_HLOCK | TW68_SLOCK | TW68_FLOCK)
+
+static void sim_update_irq(struct tw68_sim *sim)
+{
+	int level = 0 != (REG(TW68_INTSTAT) & REG(TW68_INTMASK));
+
+	if (level != sim->irq_level) {
+		sim->irq_level = level;
+		if (sim->ops && sim->ops->set_irq)
+			sim->ops->set_irq(sim->opaque, level);
+	}
+}
+
+static void sim_raise(struct tw68_sim *sim, uint32_t bits)
+{
+	REG(TW68_INTSTAT) |= bits;
+	sim_update_irq(sim);
+}
+
+/* reflect the input state in the read-only status bits */
+static void sim_update_status(struct tw68_sim *sim)
+{
+	uint32_t st = REG(TW68_INTSTAT) & ~SIM_LIVE_BITS;
+
+	if (sim->signal) {
+		st |= TW68_VLOCK | TW68_HLOCK | TW68_SLOCK | TW68_FLOCK;
+		if (sim->norm50)
+			st |= TW68_DET50;
+	}
+	if (!sim->odd)
+		st |= TW68_FIELD;
+	REG(TW68_INTSTAT) = st;
+}
+
+/* stop the DMAP processor after a fault, like the chip does */
+static void sim_dmap_fault(struct tw68_sim *sim, uint32_t bits)
+{
+	REG(TW68_DMAC) &= ~TW68_DMAP_EN;
+	sim->waiting = 0;
+	sim->stats.errors++;
+	sim_raise(sim, bits);
+}
+
+void tw68_sim_reset(struct tw68_sim *sim)
+{
+	memset(sim->regs, 0, sizeof(sim->regs));
+	memset(&sim->stats, 0, sizeof(sim->stats));
+	sim->pc = 0;
+	sim->waiting = 0;
+	sim->odd = 1;
+	sim->fifo_stall = 0;
+	sim_update_status(sim);
+	sim_update_irq(sim);
+}
+
+void tw68_sim_init(struct tw68_sim *sim, const struct tw68_sim_ops *ops,
+		   void *opaque)
+{
+	memset(sim, 0, sizeof(*sim));
+	sim->ops = ops;
+	sim->opaque = opaque;
+	sim->signal = 1;
+	tw68_sim_reset(sim);
+}
+
+uint32_t tw68_sim_readl(struct tw68_sim *sim, uint32_t off)
+{
+	off &= ~3;
+	if (off >= TW68_SIM_BAR_SIZE)
+		return ~0;
+	if (TW68_DMAP_PP == off)
+		return sim->pc;
+	return REG(off);
+}
+
+void tw68_sim_writel(struct tw68_sim *sim, uint32_t off, uint32_t val)
+{
+	uint32_t old;
+
+	off &= ~3;
+	if (off >= TW68_SIM_BAR_SIZE)
+		return;
+	old = REG(off);
+	switch (off) {
+	case TW68_INTSTAT:
+		/* write one to clear; the live status bits are read-only */
+		REG(off) &= ~(val & ~SIM_LIVE_BITS);
+		sim_update_irq(sim);
+		break;
+	case TW68_INTMASK:
+		REG(off) = val;
+		sim_update_irq(sim);
+		break;
+	case TW68_DMAC:
+		REG(off) = val;
+		/* enabling the DMAP processor loads the program pointer */
+		if (!(old & TW68_DMAP_EN) && (val & TW68_DMAP_EN)) {
+			sim->pc = REG(TW68_DMAP_SA);
+			sim->waiting = 1;
+		}
+		if (!(val & TW68_DMAP_EN))
+			sim->waiting = 0;
+		break;
+	case TW68_DMAP_PP:
+		break;			/* read only */
+	case TW68_ACNTL:
+		/* soft reset of the decoder is self clearing */
+		REG(off) = val & ~TW68_ACNTL_SRESET;
+		break;
+	default:
+		REG(off) = val;
+		break;
+	}
+}
+
+/*
+ * The decoder registers are 8 bits wide on a 32 bit stride; byte
+ * accesses to the other lanes are merged into the 32 bit register.
+ */
+uint8_t tw68_sim_readb(struct tw68_sim *sim, uint32_t off)
+{
+	return tw68_sim_readl(sim, off) >> (8 * (off & 3));
+}
+
+void tw68_sim_writeb(struct tw68_sim *sim, uint32_t off, uint8_t val)
+{
+	unsigned int shift = 8 * (off & 3);
+	uint32_t reg;
+
+	if (off >= TW68_SIM_BAR_SIZE)
+		return;
+	reg = REG(off & ~3) & ~(0xffu << shift);
+	tw68_sim_writel(sim, off, reg | ((uint32_t)val << shift));
+}
+
+uint64_t tw68_sim_field_ns(const struct tw68_sim *sim)
+{
+	if (sim->norm50)
+		return 20000000;		/* 50 fields/s */
+	return 1001000000ull / 60;		/* 59.94 fields/s */
+}
+
+unsigned int tw68_sim_field_lines(const struct tw68_sim *sim)
+{
+	return sim->norm50 ? 288 : 240;
+}
+
+void tw68_sim_set_signal(struct tw68_sim *sim, int present)
+{
+	present = !!present;
+	if (present == sim->signal)
+		return;
+	sim->signal = present;
+	sim_update_status(sim);
+	sim_raise(sim, TW68_VDLOSS);
+}
+
+void tw68_sim_set_norm50(struct tw68_sim *sim, int norm50)
+{
+	sim->norm50 = !!norm50;
+	sim_update_status(sim);
+}
+
+void tw68_sim_stall_fifo(struct tw68_sim *sim, unsigned int fields)
+{
+	sim->fifo_stall = fields;
+}
+
+/*
+ * Eight vertical colour bars in YUYV order (so they show as bars in
+ * the default format and as some other stripes in the others), with
+ * the field number stamped in the first eight bytes of the first line
+ * so a reader can tell fresh data from stale.
+ */
+uint8_t tw68_sim_pattern(uint64_t field, unsigned int line, unsigned int x)
+{
+	static const uint8_t bars[8][4] = {
+		{ 235, 128, 235, 128 },		/* white */
+		{ 210,  16, 210, 146 },		/* yellow */
+		{ 170, 166, 170,  16 },		/* cyan */
+		{ 145,  54, 145,  34 },		/* green */
+		{ 106, 202, 106, 222 },		/* magenta */
+		{  81,  90,  81, 240 },		/* red */
+		{  41, 240,  41, 110 },		/* blue */
+		{  16, 128,  16, 128 },		/* black */
+	};
+
+	if (0 == line && x < 8)
+		return field >> (8 * x);
+	return bars[(x / 180) & 7][x & 3];
+}
+
+static int sim_write_line(struct tw68_sim *sim, uint32_t addr,
+			  unsigned int line, unsigned int pos,
+			  unsigned int count)
+{
+	uint8_t data[RISC_COUNT(~0u) + 1];
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		data[i] = tw68_sim_pattern(sim->stats.fields, line, pos + i);
+	if (sim->ops->dma_write(sim->opaque, addr, data, count))
+		return -1;
+	sim->stats.bytes += count;
+	return 0;
+}
+
+/*
+ * Run the DMAP processor for one field of parity @odd.
+ *
+ * The processor is parked on a sync instruction between fields.  If
+ * the sync matches the field it starts executing, and keeps going
+ * (through jumps) until it reaches the next sync, where it parks again
+ * for the next field.  A sync of the wrong parity lets the whole field
+ * go by.  Returns the number of bytes stored.
+ */
+static uint64_t sim_run_dmap(struct tw68_sim *sim, unsigned int odd)
+{
+	uint64_t bytes = sim->stats.bytes;
+	unsigned int line = 0, pos = 0, n;
+	int synced = 0;
+	uint32_t insn[2];
+
+	for (n = 0; n < TW68_SIM_MAX_INSNS; n++) {
+		if (sim->ops->dma_read(sim->opaque, sim->pc, insn,
+				       sizeof(insn))) {
+			sim_dmap_fault(sim, TW68_PABORT);
+			goto out;
+		}
+		/* the chip is little-endian, so is every host we run on */
+		sim->stats.insns++;
+
+		switch (insn[0] & RISC_OPMASK) {
+		case RISC_SYNCO:
+		case RISC_SYNCE:
+			if (synced || odd != (RISC_SYNCO ==
+					      (insn[0] & RISC_OPMASK)))
+				goto out;
+			synced = 1;
+			sim->pc += 8;
+			break;
+		case RISC_JUMP:
+			sim->pc = insn[1];
+			if (insn[0] & RISC_INT_BIT) {
+				sim->stats.irqs++;
+				sim_raise(sim, TW68_DMAPI);
+			}
+			break;
+		case RISC_LINESTART:
+		case RISC_INLINE:
+			if (RISC_LINESTART == (insn[0] & RISC_OPMASK)) {
+				if (synced > 1)
+					line++;
+				pos = 0;
+			} else {
+				pos = RISC_START(insn[0]);
+			}
+			synced = 2;
+			if (sim_write_line(sim, insn[1], line, pos,
+					   RISC_COUNT(insn[0]))) {
+				sim_dmap_fault(sim, TW68_PABORT);
+				goto out;
+			}
+			sim->pc += 8;
+			break;
+		default:
+			sim_dmap_fault(sim, TW68_DMAPERR);
+			goto out;
+		}
+	}
+	/* a program which never syncs (e.g. jump to self) */
+	sim_dmap_fault(sim, TW68_DMAPERR);
+out:
+	return sim->stats.bytes - bytes;
+}
+
+/*
+ * tw68_sim_field
+ *
+ * One tick of the field clock: run the DMAP program for the field
+ * which has just been received, then flip to the other field.
+ */
+void tw68_sim_field(struct tw68_sim *sim)
+{
+	uint32_t dmac = REG(TW68_DMAC);
+	uint64_t stored = 0;
+
+	sim->stats.fields++;
+	if (sim->signal && (dmac & TW68_DMAP_EN) && (dmac & TW68_FIFO_EN)) {
+		if (sim->fifo_stall) {
+			/* the field never made it out of the FIFO */
+			sim->fifo_stall--;
+			sim->stats.fifo_overflows++;
+			sim_raise(sim, TW68_FFOF);
+		} else if (sim->waiting) {
+			stored = sim_run_dmap(sim, sim->odd);
+		}
+	}
+	if (!stored)
+		sim->stats.fields_dropped++;
+
+	sim->odd ^= 1;
+	sim_update_status(sim);
+	sim_update_irq(sim);
+}
+
+#ifdef TW68_SIM_MAIN
+/* ------------------------------------------------------------------ */
+/*
+ * 'make sim': drive the model the way the driver does, with a ring of
+ * frame buffers in a flat "guest memory", and report what came out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define	SIM_MEM_SIZE	(64 << 20)
+#define	SIM_BUFFERS	4
+#define	SIM_WIDTH	720
+#define	SIM_BPP		2
+
+static uint8_t *mem;
+static int irq_line;
+
+static int mem_read(void *opaque, uint32_t addr, void *buf, size_t len)
+{
+	if (addr > SIM_MEM_SIZE || len > SIM_MEM_SIZE - addr)
+		return -1;
+	memcpy(buf, mem + addr, len);
+	return 0;
+}
+
+static int mem_write(void *opaque, uint32_t addr, const void *buf,
+		     size_t len)
+{
+	if (addr > SIM_MEM_SIZE || len > SIM_MEM_SIZE - addr)
+		return -1;
+	memcpy(mem + addr, buf, len);
+	return 0;
+}
+
+static void set_irq(void *opaque, int level)
+{
+	irq_line = level;
+}
+
+static const struct tw68_sim_ops mem_ops = {
+	.dma_read	= mem_read,
+	.dma_write	= mem_write,
+	.set_irq	= set_irq,
+};
+
+static uint32_t *emit(uint32_t *rp, uint32_t insn, uint32_t addr)
+{
+	*(rp++) = insn;
+	*(rp++) = addr;
+	return rp;
+}
+
+/* an interlaced frame program, split in 4k pages like a vmalloc buffer */
+static uint32_t build_frame(uint32_t prog, uint32_t data,
+			    unsigned int lines, uint32_t next)
+{
+	uint32_t *rp = (uint32_t *)(mem + prog);
+	unsigned int bpl = SIM_WIDTH * SIM_BPP, field, line, done;
+	uint32_t addr;
+
+	for (field = 0; field < 2; field++) {
+		rp = emit(rp, field ? RISC_SYNCE : RISC_SYNCO, 0);
+		for (line = field; line < 2 * lines; line += 2) {
+			addr = data + line * bpl;
+			done = 4096 - (addr & 4095);
+			if (done >= bpl) {
+				rp = emit(rp, RISC_LINESTART | bpl, addr);
+				continue;
+			}
+			rp = emit(rp, RISC_LINESTART | (7 << 24) | done, addr);
+			rp = emit(rp, RISC_INLINE | (done << 12) |
+				  (bpl - done), addr + done);
+		}
+	}
+	rp = emit(rp, RISC_JUMP | RISC_INT_BIT, next);
+	return (uint8_t *)rp - mem - prog;
+}
+
+int main(int argc, char **argv)
+{
+	struct tw68_sim sim;
+	unsigned int fields = argc > 1 ? atoi(argv[1]) : 500;
+	unsigned int lines, i, done = 0, stale = 0;
+	uint32_t prog[SIM_BUFFERS], data[SIM_BUFFERS];
+	uint64_t stamp, last = 0;
+	struct timespec t0, t1;
+	double secs;
+
+	mem = calloc(1, SIM_MEM_SIZE);
+	if (!mem)
+		return 1;
+	tw68_sim_init(&sim, &mem_ops, NULL);
+	tw68_sim_set_norm50(&sim, 1);
+	lines = tw68_sim_field_lines(&sim);
+
+	for (i = 0; i < SIM_BUFFERS; i++) {
+		prog[i] = 0x10000 * (i + 1);
+		data[i] = 0x200000 + i * 0x100000 + 0x40;
+	}
+	for (i = 0; i < SIM_BUFFERS; i++)
+		build_frame(prog[i], data[i], lines,
+			    prog[(i + 1) % SIM_BUFFERS]);
+
+	tw68_sim_writel(&sim, TW68_INTMASK, TW68_DMAPI | TW68_FFOF |
+			TW68_DMAPERR | TW68_PABORT | TW68_VDLOSS);
+	tw68_sim_writel(&sim, TW68_DMAP_SA, prog[0]);
+	tw68_sim_writel(&sim, TW68_DMAC, TW68_DMAP_EN | TW68_FIFO_EN);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < fields; i++) {
+		if (i == fields / 2)
+			tw68_sim_stall_fifo(&sim, 3);
+		tw68_sim_field(&sim);
+		if (!irq_line)
+			continue;
+		if (tw68_sim_readl(&sim, TW68_INTSTAT) & TW68_DMAPI) {
+			/* the buffer before the one now running is done */
+			memcpy(&stamp, mem + data[done % SIM_BUFFERS],
+			       sizeof(stamp));
+			if (stamp <= last)
+				stale++;
+			last = stamp;
+			done++;
+		}
+		tw68_sim_writel(&sim, TW68_INTSTAT,
+				tw68_sim_readl(&sim, TW68_INTSTAT));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	printf("fields %llu dropped %llu frames %u stale %u ffof %llu "
+	       "errors %llu\n",
+	       (unsigned long long)sim.stats.fields,
+	       (unsigned long long)sim.stats.fields_dropped, done, stale,
+	       (unsigned long long)sim.stats.fifo_overflows,
+	       (unsigned long long)sim.stats.errors);
+	printf("insns %llu bytes %llu, %.1f MB/s simulated, "
+	       "%.1fx real time\n",
+	       (unsigned long long)sim.stats.insns,
+	       (unsigned long long)sim.stats.bytes,
+	       sim.stats.bytes / secs / 1e6,
+	       fields * tw68_sim_field_ns(&sim) / 1e9 / secs);
+	free(mem);
+	return sim.stats.errors || stale ? 1 : 0;
+}
+#endif
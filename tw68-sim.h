@@ -0,0 +1,113 @@
+/*
+ *  tw68-sim.h - software model of a TW68xx PCI video decoder
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * The model covers what the driver core actually drives: the BAR 0
+ * register file (DMAC, DMAP_SA, DMAP_PP, INTSTAT, INTMASK plus plain
+ * storage for the decoder registers), the DMAP processor executing the
+ * RISC programs built by tw68-risc.c, and a field clock which writes a
+ * test pattern and raises DMAPI, FFOF and VDLOSS.
+ *
+ * It knows nothing about its host.  Bus mastering and the interrupt
+ * line go through struct tw68_sim_ops, so the same code can sit behind
+ * a PCI device in an emulator or, as in 'make sim', behind a flat
+ * array in a test program.  Time is whatever the host says it is: each
+ * call to tw68_sim_field() is one video field.
+ *
+ * tw68-qemu.c puts the model behind a QEMU PCI device, and 'make vmtest'
+ * (tw68-vmtest.sh) boots a VM with it that loads the real tw68.ko and
+ * captures with videotest, so the driver's probe, interrupt, queue and
+ * ioctl code runs on it.  Without a VM, tw68-risc.c ('make risctest')
+ * and the small capture loop of 'make sim' run on it directly.
+ */
+
+#ifndef _TW68_SIM_H_
+#define _TW68_SIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define	TW68_SIM_BAR_SIZE	0x400		/* BAR 0 as mapped by tw68 */
+#define	TW68_SIM_MAX_INSNS	(1 << 16)	/* per field, before DMAPERR */
+
+struct tw68_sim_ops {
+	/* bus master access, return 0 or -1 for an unmapped address */
+	int	(*dma_read)(void *opaque, uint32_t addr, void *buf,
+			    size_t len);
+	int	(*dma_write)(void *opaque, uint32_t addr, const void *buf,
+			     size_t len);
+	/* level of the INTA# line */
+	void	(*set_irq)(void *opaque, int level);
+};
+
+struct tw68_sim_stats {
+	uint64_t	fields;		/* field clock ticks */
+	uint64_t	fields_dropped;	/* no DMA program took the field */
+	uint64_t	insns;		/* RISC instructions executed */
+	uint64_t	bytes;		/* pixel data written to memory */
+	uint64_t	irqs;		/* DMAPI raised */
+	uint64_t	fifo_overflows;	/* FFOF raised */
+	uint64_t	errors;		/* DMAPERR / PABORT raised */
+};
+
+struct tw68_sim {
+	uint32_t			regs[TW68_SIM_BAR_SIZE / 4];
+
+	const struct tw68_sim_ops	*ops;
+	void				*opaque;
+	int				irq_level;
+
+	/* video source */
+	int				signal;	/* input has a signal */
+	int				norm50;	/* 625/50 rather than 525/60 */
+	unsigned int			odd;	/* next field is odd */
+	unsigned int			fifo_stall; /* fields to overflow */
+
+	/* DMAP processor */
+	uint32_t			pc;	/* next instruction */
+	int				waiting; /* parked on a sync */
+
+	struct tw68_sim_stats		stats;
+};
+
+void	 tw68_sim_init(struct tw68_sim *sim, const struct tw68_sim_ops *ops,
+		       void *opaque);
+void	 tw68_sim_reset(struct tw68_sim *sim);
+
+/* BAR 0 accesses, as done by tw_readl() / tw_readb() and friends */
+uint32_t tw68_sim_readl(struct tw68_sim *sim, uint32_t off);
+void	 tw68_sim_writel(struct tw68_sim *sim, uint32_t off, uint32_t val);
+uint8_t	 tw68_sim_readb(struct tw68_sim *sim, uint32_t off);
+void	 tw68_sim_writeb(struct tw68_sim *sim, uint32_t off, uint8_t val);
+
+/* field clock */
+void	 tw68_sim_field(struct tw68_sim *sim);
+uint64_t tw68_sim_field_ns(const struct tw68_sim *sim);
+unsigned int tw68_sim_field_lines(const struct tw68_sim *sim);
+
+/* disturbances a test can inject */
+void	 tw68_sim_set_signal(struct tw68_sim *sim, int present);
+void	 tw68_sim_set_norm50(struct tw68_sim *sim, int norm50);
+void	 tw68_sim_stall_fifo(struct tw68_sim *sim, unsigned int fields);
+
+/* test pattern byte @x of line @line in field number @field */
+uint8_t	 tw68_sim_pattern(uint64_t field, unsigned int line, unsigned int x);
+
+#endif /* _TW68_SIM_H_ */
@@ -0,0 +1,345 @@
+/*
+ *  tw68-userptr.c
+ *  Part of the device driver for Techwell 68xx based cards
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Cache of pinned user pages for V4L2_MEMORY_USERPTR.
+ *
+ * videobuf releases a userptr buffer - unpinning its pages, unmapping
+ * its sg list and so making us free its RISC program - whenever the
+ * buffer is queued with a different address than last time, and on
+ * every STREAMOFF.  Applications keep handing in the same few regions,
+ * so instead of freeing them tw68_dma_free() parks the pinned and
+ * mapped region, together with its program, on the file handle, keyed
+ * by address and length.  buffer_prepare() takes it back from there in
+ * place of calling videobuf_iolock(), and reuses the program if it was
+ * built for the same format.
+ *
+ * A region must not be reused once the user mapping behind it changed
+ * (munmap, mremap, a new mmap at the same address), so a mmu notifier
+ * on the owning mm marks every region overlapping an invalidated range
+ * as stale - parked or in use.  Stale regions are freed when next
+ * released, and a stale buffer is pinned again before being queued.
+ *
+ * Everything but the notifier runs under the videobuf queue lock; the
+ * list and the stale flags are also protected by cache->lock.
+ */
+
+#include <linux/version.h>
+#include <linux/mmu_notifier.h>
+#include <linux/sched.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/mm.h>
+#endif
+
+#include "tw68.h"
+
+static unsigned int userptr_cache = 16;
+module_param(userptr_cache, int, 0644);
+MODULE_PARM_DESC(userptr_cache, "userptr regions kept pinned per open file "
+		 "when not queued (0 to disable)");
+
+#define dprintk(level, fmt, arg...)     if (video_debug & (level)) \
+	printk(KERN_DEBUG "%s/0: " fmt, dev->name , ## arg)
+
+struct tw68_upin_cache {
+	struct mmu_notifier	mn;
+	struct mm_struct	*mm;
+	spinlock_t		lock;
+	struct list_head	list;		/* most recently parked first */
+	unsigned int		parked;
+	unsigned int		seq;		/* counts invalidations */
+};
+
+struct tw68_upin {
+	struct list_head	list;
+	unsigned long		baddr;
+	size_t			bsize;
+	int			stale;
+	struct tw68_buf		*buf;		/* owner, or NULL if parked */
+
+	/* while parked: the pinned pages and the program built on them */
+	struct videobuf_dmabuf	dma;
+	struct btcx_riscmem	risc;
+	struct tw68_format	*fmt;
+	unsigned int		width, height, bpl;
+	enum v4l2_field		field;
+};
+
+static void upin_invalidate(struct tw68_upin_cache *c,
+			    unsigned long start, unsigned long end)
+{
+	struct tw68_upin *e;
+
+	spin_lock(&c->lock);
+	c->seq++;
+	list_for_each_entry(e, &c->list, list)
+		if (e->baddr < end && start < e->baddr + e->bsize)
+			e->stale = 1;
+	spin_unlock(&c->lock);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,19,0)
+static void tw68_upin_invalidate_range_start(struct mmu_notifier *mn,
+		struct mm_struct *mm, unsigned long start, unsigned long end)
+{
+	upin_invalidate(container_of(mn, struct tw68_upin_cache, mn),
+			start, end);
+}
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(5,0,0)
+static int tw68_upin_invalidate_range_start(struct mmu_notifier *mn,
+		struct mm_struct *mm, unsigned long start, unsigned long end,
+		bool blockable)
+{
+	upin_invalidate(container_of(mn, struct tw68_upin_cache, mn),
+			start, end);
+	return 0;
+}
+#else
+static int tw68_upin_invalidate_range_start(struct mmu_notifier *mn,
+		const struct mmu_notifier_range *range)
+{
+	upin_invalidate(container_of(mn, struct tw68_upin_cache, mn),
+			range->start, range->end);
+	return 0;
+}
+#endif
+
+/* the process is exiting: nothing can be reused any more */
+static void tw68_upin_release(struct mmu_notifier *mn, struct mm_struct *mm)
+{
+	upin_invalidate(container_of(mn, struct tw68_upin_cache, mn),
+			0, ~0UL);
+}
+
+static const struct mmu_notifier_ops tw68_upin_ops = {
+	.invalidate_range_start	= tw68_upin_invalidate_range_start,
+	.release		= tw68_upin_release,
+};
+
+/* the cache of @fh, created on first use; NULL if it can't be used */
+static struct tw68_upin_cache *upin_cache(struct tw68_fh *fh)
+{
+	struct tw68_upin_cache *c = fh->upin;
+
+	if (c)
+		return c->mm == current->mm ? c : NULL;
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if (NULL == c)
+		return NULL;
+	spin_lock_init(&c->lock);
+	INIT_LIST_HEAD(&c->list);
+	c->mn.ops = &tw68_upin_ops;
+	c->mm = current->mm;
+	if (mmu_notifier_register(&c->mn, c->mm)) {
+		kfree(c);
+		return NULL;
+	}
+	/* keep the mm_struct around for mmu_notifier_unregister */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+	mmgrab(c->mm);
+#else
+	atomic_inc(&c->mm->mm_count);
+#endif
+	fh->upin = c;
+	return c;
+}
+
+static void upin_free(struct tw68_fh *fh, struct tw68_upin *e)
+{
+	struct videobuf_queue *q = &fh->cap;
+
+#if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,35)
+	videobuf_dma_unmap(q, &e->dma);
+#else
+	videobuf_dma_unmap(q->dev, &e->dma);
+#endif
+	videobuf_dma_free(&e->dma);
+	btcx_riscmem_free(fh->dev->pci, &e->risc);
+	kfree(e);
+}
+
+/*
+ * tw68_userptr_get
+ *
+ * Called by buffer_prepare() for a buffer needing videobuf_iolock().
+ * If a parked region matches the buffer's address and length, its
+ * pages and program are moved into the buffer.  Returns 2 if the
+ * program fits the buffer's format as well, 1 if only the pages could
+ * be reused, 0 (with *seq set for tw68_userptr_pinned) otherwise.
+ */
+int tw68_userptr_get(struct tw68_fh *fh, struct tw68_buf *buf,
+		     unsigned int *seq)
+{
+	struct tw68_dev *dev = fh->dev;
+	struct tw68_upin_cache *c;
+	struct tw68_upin *e, *found = NULL;
+
+	if (0 == userptr_cache || V4L2_MEMORY_USERPTR != buf->vb.memory ||
+	    0 == buf->vb.baddr || fh->cap.read_buf == &buf->vb)
+		return 0;
+	c = upin_cache(fh);
+	if (NULL == c)
+		return 0;
+	spin_lock(&c->lock);
+	*seq = c->seq;
+	list_for_each_entry(e, &c->list, list) {
+		if (NULL == e->buf && !e->stale &&
+		    e->baddr == buf->vb.baddr && e->bsize == buf->vb.bsize) {
+			found = e;
+			found->buf = buf;
+			c->parked--;
+			break;
+		}
+	}
+	spin_unlock(&c->lock);
+	if (NULL == found)
+		return 0;
+
+	*videobuf_to_dma(&buf->vb) = found->dma;
+	buf->risc = found->risc;
+	memset(&found->risc, 0, sizeof(found->risc));
+	buf->upin = found;
+	dprintk(DBG_BUFF, "%s: [%p/%d] reusing 0x%08lx+%zu\n", __func__,
+		buf, buf->vb.i, found->baddr, found->bsize);
+	if (found->fmt    == buf->fmt       &&
+	    found->width  == buf->vb.width  &&
+	    found->height == buf->vb.height &&
+	    found->bpl    == buf->bpl       &&
+	    found->field  == buf->field)
+		return 2;
+	return 1;
+}
+
+/*
+ * tw68_userptr_pinned
+ *
+ * Called after videobuf_iolock() pinned a userptr buffer, to start
+ * tracking the region.  @seq comes from tw68_userptr_get, so that an
+ * invalidation which raced with the pinning is not missed.
+ */
+void tw68_userptr_pinned(struct tw68_fh *fh, struct tw68_buf *buf,
+			 unsigned int seq)
+{
+	struct tw68_upin_cache *c = fh->upin;
+	struct tw68_upin *e;
+
+	if (0 == userptr_cache || NULL == c || c->mm != current->mm ||
+	    V4L2_MEMORY_USERPTR != buf->vb.memory || 0 == buf->vb.baddr ||
+	    fh->cap.read_buf == &buf->vb)
+		return;
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if (NULL == e)
+		return;		/* just not cached */
+	e->baddr = buf->vb.baddr;
+	e->bsize = buf->vb.bsize;
+	e->buf = buf;
+	spin_lock(&c->lock);
+	e->stale = (seq != c->seq);
+	list_add(&e->list, &c->list);
+	spin_unlock(&c->lock);
+	buf->upin = e;
+}
+
+/* has the user mapping behind this buffer changed since it was pinned */
+int tw68_userptr_stale(struct tw68_buf *buf)
+{
+	return buf->upin && buf->upin->stale;
+}
+
+/*
+ * tw68_userptr_put
+ *
+ * Called by tw68_dma_free() once the hardware and any readers are done
+ * with the buffer.  Parks the buffer's region and program and returns
+ * 1, or returns 0 if the caller should free them as usual.
+ */
+int tw68_userptr_put(struct tw68_fh *fh, struct tw68_buf *buf)
+{
+	struct tw68_upin_cache *c = fh->upin;
+	struct tw68_upin *e = buf->upin, *n;
+	struct videobuf_dmabuf *dma = videobuf_to_dma(&buf->vb);
+	LIST_HEAD(evict);
+
+	if (NULL == e)
+		return 0;
+	buf->upin = NULL;
+	e->dma    = *dma;
+	e->risc   = buf->risc;
+	e->fmt    = buf->fmt;
+	e->width  = buf->vb.width;
+	e->height = buf->vb.height;
+	e->field  = buf->field;
+	e->bpl    = buf->bpl;
+
+	spin_lock(&c->lock);
+	if (e->stale || 0 == userptr_cache || 0 == dma->sglen) {
+		list_del(&e->list);
+		spin_unlock(&c->lock);
+		kfree(e);
+		return 0;
+	}
+	e->buf = NULL;
+	list_move(&e->list, &c->list);
+	c->parked++;
+	/* drop stale regions, and the oldest beyond the limit */
+	list_for_each_entry_safe_reverse(e, n, &c->list, list) {
+		if (NULL != e->buf)
+			continue;
+		if (e->stale || c->parked > userptr_cache) {
+			list_move(&e->list, &evict);
+			c->parked--;
+		}
+	}
+	spin_unlock(&c->lock);
+
+	videobuf_dma_init(dma);
+	memset(&buf->risc, 0, sizeof(buf->risc));
+	list_for_each_entry_safe(e, n, &evict, list)
+		upin_free(fh, e);
+	return 1;
+}
+
+/*
+ * tw68_userptr_fini
+ *
+ * Called on close, after all buffers of the file handle were released.
+ */
+void tw68_userptr_fini(struct tw68_fh *fh)
+{
+	struct tw68_upin_cache *c = fh->upin;
+	struct tw68_upin *e, *n;
+
+	if (NULL == c)
+		return;
+	mmu_notifier_unregister(&c->mn, c->mm);
+	mmdrop(c->mm);
+	list_for_each_entry_safe(e, n, &c->list, list) {
+		list_del(&e->list);
+		if (NULL == e->buf) {
+			upin_free(fh, e);
+		} else {
+			e->buf->upin = NULL;
+			kfree(e);
+		}
+	}
+	kfree(c);
+	fh->upin = NULL;
+}
@@ -28,9 +28,13 @@
 #include <linux/module.h>
 #include <media/v4l2-common.h>
 #include <linux/sort.h>
+#include <linux/file.h>
+#include <linux/uaccess.h>
+#include <linux/compat.h>
 
 #include "tw68.h"
 #include "tw68-reg.h"
+#include "tw68-ioctl.h"
 
 unsigned int video_debug;
 
@@ -54,66 +58,8 @@ MODULE_PARM_DESC(secam, "force SECAM variant, either DK,L or Lc");
 
 /* ------------------------------------------------------------------ */
 /* data structs for video                                             */
-/*
- * FIXME -
- * Note that the saa7134 has formats, e.g. YUV420, which are classified
- * as "planar".  These affect overlay mode, and are flagged with a field
- * ".planar" in the format.  Do we need to implement this in this driver?
- */
-static struct tw68_format formats[] = {
-	{
-		.name		= "15 bpp RGB, le",
-		.fourcc		= V4L2_PIX_FMT_RGB555,
-		.depth		= 16,
-		.twformat	= ColorFormatRGB15,
-	}, {
-		.name		= "15 bpp RGB, be",
-		.fourcc		= V4L2_PIX_FMT_RGB555X,
-		.depth		= 16,
-		.twformat	= ColorFormatRGB15 | ColorFormatBSWAP,
-	}, {
-		.name		= "16 bpp RGB, le",
-		.fourcc		= V4L2_PIX_FMT_RGB565,
-		.depth		= 16,
-		.twformat	= ColorFormatRGB16,
-	}, {
-		.name		= "16 bpp RGB, be",
-		.fourcc		= V4L2_PIX_FMT_RGB565X,
-		.depth		= 16,
-		.twformat	= ColorFormatRGB16 | ColorFormatBSWAP,
-	}, {
-		.name		= "24 bpp RGB, le",
-		.fourcc		= V4L2_PIX_FMT_BGR24,
-		.depth		= 24,
-		.twformat	= ColorFormatRGB24,
-	}, {
-		.name		= "24 bpp RGB, be",
-		.fourcc		= V4L2_PIX_FMT_RGB24,
-		.depth		= 24,
-		.twformat	= ColorFormatRGB24 | ColorFormatBSWAP,
-	}, {
-		.name		= "32 bpp RGB, le",
-		.fourcc		= V4L2_PIX_FMT_BGR32,
-		.depth		= 32,
-		.twformat	= ColorFormatRGB32,
-	}, {
-		.name		= "32 bpp RGB, be",
-		.fourcc		= V4L2_PIX_FMT_RGB32,
-		.depth		= 32,
-		.twformat	= ColorFormatRGB32 | ColorFormatBSWAP |
-				  ColorFormatWSWAP,
-	}, {
-		.name		= "4:2:2 packed, YUYV",
-		.fourcc		= V4L2_PIX_FMT_YUYV,
-		.depth		= 16,
-		.twformat	= ColorFormatYUY2,
-	}, {
-		.name		= "4:2:2 packed, UYVY",
-		.fourcc		= V4L2_PIX_FMT_UYVY,
-		.depth		= 16,
-		.twformat	= ColorFormatYUY2 | ColorFormatBSWAP,
-	}
-};
+
+#include "tw68-formats.h"
 #define FORMATS ARRAY_SIZE(formats)
 
 #define NORM_625_50			\
@@ -343,6 +289,24 @@ static struct tw68_tvnorm tvnorms[]		= {
 };
 #define TVNORMS ARRAY_SIZE(tvnorms)
 
+/*
+ * Named capture sizes, for V4L2_CID_PRIVATE_PRESET.
+ * The smaller ones take a single field, so that the scaler only has to
+ * shrink horizontally and by at most 2 vertically, and a buffer is a
+ * quarter (CIF) or a sixteenth (QCIF) of a full frame.
+ */
+static const struct tw68_preset {
+	char			*name;
+	unsigned int		width;
+	unsigned int		height_625, height_525;
+	enum v4l2_field		field;
+} presets[] = {
+	{ "D1",   720, 576, 480, V4L2_FIELD_INTERLACED },
+	{ "CIF",  352, 288, 240, V4L2_FIELD_TOP },
+	{ "QCIF", 176, 144, 120, V4L2_FIELD_TOP },
+};
+#define PRESETS ARRAY_SIZE(presets)
+
 static const struct v4l2_queryctrl no_ctrl		= {
 	.name		= "42",
 	.flags		= V4L2_CTRL_FLAG_DISABLED,
@@ -411,6 +375,32 @@ static const struct v4l2_queryctrl video_ctrls[]		= {
 		.step		= 1,
 		.default_value	= 0,
 		.type		= V4L2_CTRL_TYPE_INTEGER,
+	},
+	/* --- private --- */
+	{
+		.id		= V4L2_CID_PRIVATE_PRESET,
+		.name		= "Capture Size",
+		.minimum	= 0,
+		.maximum	= PRESETS,
+		.step		= 1,
+		.default_value	= 0,
+		.type		= V4L2_CTRL_TYPE_MENU,
+	}, {
+		.id		= V4L2_CID_PRIVATE_SCAN,
+		.name		= "Input Scan Mask",
+		.minimum	= 0,
+		.maximum	= (1 << TW68_INPUT_MAX) - 1,
+		.step		= 1,
+		.default_value	= 0,
+		.type		= V4L2_CTRL_TYPE_INTEGER,
+	}, {
+		.id		= V4L2_CID_PRIVATE_SCAN_SETTLE,
+		.name		= "Input Scan Settle Fields",
+		.minimum	= 0,
+		.maximum	= TW68_SCAN_SETTLE_MAX,
+		.step		= 1,
+		.default_value	= 2,
+		.type		= V4L2_CTRL_TYPE_INTEGER,
 	}
 };
 static const unsigned int CTRLS = ARRAY_SIZE(video_ctrls);
@@ -442,6 +432,15 @@ static struct tw68_format *format_by_fourcc(unsigned int fourcc)
 /* ----------------------------------------------------------------------- */
 /* resource management                                                     */
 
+/* reserve the PCI bandwidth of a stream in fh's format, see pci_budget */
+static int res_bw(struct tw68_fh *fh)
+{
+	struct tw68_dev *dev = fh->dev;
+
+	return tw68_bw_reserve(fh, tw68_bw_demand(dev, fh->fmt, fh->width,
+						  fh->height, fh->cap.field));
+}
+
 static int res_get(struct tw68_fh *fh, unsigned int bit)
 {
 	struct tw68_dev *dev = fh->dev;
@@ -460,8 +459,12 @@ static int res_get(struct tw68_fh *fh, unsigned int bit)
 	/* it's free, grab it */
 	fh->resources  |= bit;
 	dev->resources |= bit;
+	if (RESOURCE_VIDEO == bit)
+		dev->video_owner = fh;
 	dprintk(DBG_FLOW, "%s: %d\n", __func__, bit);
 	mutex_unlock(&dev->lock);
+	/* a capture: the decoder must be up, see tw68_power_get */
+	tw68_power_get(dev);
 	return 1;
 }
 
@@ -485,8 +488,17 @@ static void res_free(struct tw68_fh *fh,
 	mutex_lock(&fh->dev->lock);
 	fh->resources  &= ~bits;
 	fh->dev->resources &= ~bits;
+	if (bits & RESOURCE_VIDEO)
+		dev->video_owner = NULL;
 	dprintk(DBG_FLOW, "%s: %d\n", __func__, bits);
 	mutex_unlock(&fh->dev->lock);
+	if (bits & RESOURCE_VIDEO) {
+		tw68_group_stop(dev);
+		tw68_bw_release(fh);
+		tw68_power_put(dev);
+	}
+	if (bits & RESOURCE_VBI)
+		tw68_power_put(dev);
 }
 
 /* ------------------------------------------------------------------ */
@@ -557,12 +569,14 @@ static void video_mux(struct tw68_dev *dev, int input)
  * Parameters:
  * 	@dev		pointer to the device structure, needed for
  * 			getting current norm (as well as debug print)
+ * 	@crop		cropping rectangle, within dev->crop_bounds
  * 	@width		actual image width (from user buffer)
  * 	@height		actual image height
  * 	@field		indicates Top, Bottom or Interlaced
  */
-static int tw68_set_scale(struct tw68_dev *dev, unsigned int width,
-			  unsigned int height, enum v4l2_field field)
+static int tw68_set_scale(struct tw68_dev *dev, struct v4l2_rect *crop,
+			  unsigned int width, unsigned int height,
+			  enum v4l2_field field)
 {
 
 	/* set individually for debugging clarity */
@@ -578,8 +592,7 @@ static int tw68_set_scale(struct tw68_dev *dev, unsigned int width,
 		    "  tvnorm h_delay=%d, h_start=%d, h_stop=%d, "
 		    "v_delay=%d, v_start=%d, v_stop=%d\n" , __func__,
 		width, height, V4L2_FIELD_HAS_BOTH(field),
-		dev->crop_bounds.top, dev->crop_bounds.left,
-		dev->crop_bounds.width, dev->crop_bounds.height,
+		crop->top, crop->left, crop->width, crop->height,
 		dev->tvnorm->h_delay, dev->tvnorm->h_start, dev->tvnorm->h_stop,
 		dev->tvnorm->v_delay, dev->tvnorm->video_v_start,
 		dev->tvnorm->video_v_stop);
@@ -592,14 +605,13 @@ static int tw68_set_scale(struct tw68_dev *dev, unsigned int width,
 		hdelay = dev->tvnorm->h_delay;
 		break;
 	}
-	hdelay += dev->crop_bounds.left;
-	hactive = dev->crop_bounds.width;
+	hdelay += crop->left;
+	hactive = crop->width;
 
 	hscale = (hactive * 256) / (width);
 
-	vdelay = dev->tvnorm->v_delay + dev->crop_bounds.top -
-		 dev->crop_defrect.top;
-	vactive = dev->crop_bounds.height;
+	vdelay = dev->tvnorm->v_delay + crop->top - dev->crop_defrect.top;
+	vactive = crop->height;
 	vscale = (vactive * 256) / height;
 
 	dprintk(DBG_FLOW, "%s: %dx%d [%s%s,%s]\n", __func__,
@@ -630,38 +642,131 @@ static int tw68_set_scale(struct tw68_dev *dev, unsigned int width,
 	tw_writeb(TW68_SCALE_HI, comb);
 	tw_writeb(TW68_VSCALE_LO, vscale);
 	tw_writeb(TW68_HSCALE_LO, hscale);
+	dev->crop_hw = *crop;
 
 	return 0;
 }
 
+/*
+ * tw68_commit_crop
+ *
+ * Called from the DMAPI interrupt, i.e. between two frames, with the
+ * DMAP waiting on the first sync of the next buffer.  A crop set while
+ * streaming is written to the scaler here and so applies from the next
+ * field on.  With nothing active, start_dma will set it instead.
+ */
+static void tw68_commit_crop(struct tw68_dev *dev, struct tw68_dmaqueue *q)
+{
+	struct tw68_buf *buf;
+
+	assert_spin_locked(&dev->slock);
+	if (list_empty(&q->active))
+		return;
+	buf = list_entry(q->active.next, struct tw68_buf, vb.queue);
+	tw68_set_scale(dev, &dev->crop_current, buf->vb.width,
+		       buf->vb.height, buf->vb.field);
+	dev->crop_dirty = 0;
+	dprintk(DBG_FLOW, "%s: crop %dx%d+%d+%d from buffer %d\n", __func__,
+		dev->crop_hw.width, dev->crop_hw.height, dev->crop_hw.left,
+		dev->crop_hw.top, buf->vb.i);
+}
+
+/*
+ * tw68_scan_next
+ *
+ * The input after the current one in dev->scan_mask, for round robin
+ * capture.  Bits for inputs the card doesn't have are ignored.
+ */
+static struct tw68_input *tw68_scan_next(struct tw68_dev *dev)
+{
+	unsigned int i, n;
+
+	n = dev->hw_input ? dev->hw_input - &card_in(dev, 0)
+			  : TW68_INPUT_MAX - 1;
+	for (i = 0; i < TW68_INPUT_MAX; i++) {
+		n = (n + 1) % TW68_INPUT_MAX;
+		if ((dev->scan_mask & (1 << n)) && card_in(dev, n).name)
+			return &card_in(dev, n);
+	}
+	return dev->input;
+}
+
 /* ------------------------------------------------------------------ */
 
 static int tw68_video_start_dma(struct tw68_dev *dev, struct tw68_dmaqueue *q,
 				struct tw68_buf *buf) {
+	struct tw68_input *input = dev->input;
+	u32 start = buf->risc.dma, dmac;
+	int switched = 0;
 
 	dprintk(DBG_FLOW, "%s: Starting risc program\n", __func__);
+	/*
+	 * While scanning, every buffer is started here (buf_compat
+	 * keeps them off the active chain) on the next input of the
+	 * mask, and tagged with it: meta.input, returned by
+	 * TW68_IOC_G_META and TW68_IOC_BATCH, is how applications
+	 * demultiplex.  Headers old enough to still have
+	 * v4l2_buffer.input (now reserved2) get it at DQBUF as well.
+	 */
+	if (dev->scan_mask) {
+		input = tw68_scan_next(dev);
+#ifdef V4L2_BUF_FLAG_INPUT
+		buf->vb.input = input - &card_in(dev, 0);
+#endif
+	}
 	/* Assure correct input */
-	if (dev->hw_input != dev->input) {
-		dev->hw_input = dev->input;
-		tw_andorb(TW68_INFORM, 0x03 << 2, dev->input->vmux << 2);
+	if (dev->hw_input != input) {
+		dev->hw_input = input;
+		tw_andorb(TW68_INFORM, 0x03 << 2, input->vmux << 2);
+		switched = 1;
 	}
+	buf->meta.input = input - &card_in(dev, 0);
+	buf->meta.vmux = input->vmux;
+	dev->meta_flags |= TW68_META_RESTART;
 	/* Set cropping and scaling */
-	tw68_set_scale(dev, buf->vb.width, buf->vb.height, buf->vb.field);
+	tw68_set_scale(dev, &dev->crop_current, buf->vb.width,
+		       buf->vb.height, buf->vb.field);
+	dev->crop_dirty = 0;
 	/*
 	 *  Set start address for RISC program.  Note that if the DMAP
 	 *  processor is currently running, it must be stopped before
 	 *  a new address can be set.
 	 */
 	tw_clearl(TW68_DMAC, TW68_DMAP_EN);
-	tw_writel(TW68_DMAP_SA, cpu_to_le32(buf->risc.dma));
+	/*
+	 * A scanned input was just switched to: let the decoder lock
+	 * on it for scan_settle fields before the buffer is written.
+	 */
+	if (switched && dev->scan_mask && dev->scan_settle &&
+	    dev->scan_risc.cpu) {
+		tw68_risc_skip(&dev->scan_risc, dev->scan_settle,
+			       le32_to_cpu(buf->risc.cpu[0]) & 0xf0000000,
+			       buf->risc.dma);
+		wmb();
+		start = dev->scan_risc.dma;
+	}
+	tw_writel(TW68_DMAP_SA, cpu_to_le32(start));
 	/* Clear any pending interrupts */
 	tw_writel(TW68_INTSTAT, dev->board_virqmask);
-	/* Enable the risc engine and the fifo */
-	tw_andorl(TW68_DMAC, 0xff, buf->fmt->twformat |
-		ColorFormatGamma | TW68_DMAP_EN | TW68_FIFO_EN);
+	/* Enable the risc engine and the fifo, with the rest of the group */
+	dmac = buf->fmt->twformat | ColorFormatGamma |
+	       TW68_DMAP_EN | TW68_FIFO_EN;
+	if (tw68_group_start(dev, dmac))
+		tw68_video_go(dev, dmac);
+	return 0;
+}
+
+/*
+ * tw68_video_go
+ *
+ * Start the DMAP on the program loaded by start_dma.  Also called by
+ * tw68_group_start for the members of a group which were waiting.
+ */
+void tw68_video_go(struct tw68_dev *dev, u32 dmac)
+{
+	tw_andorl(TW68_DMAC, 0xff, dmac);
 	dev->pci_irqmask |= dev->board_virqmask;
 	tw_setl(TW68_INTMASK, dev->pci_irqmask);
-	return 0;
 }
 
 /* ------------------------------------------------------------------ */
@@ -672,12 +777,20 @@ static int tw68_video_start_dma(struct tw68_dev *dev, struct tw68_dmaqueue *q,
  *
  * callback from tw68-core buffer_queue to determine whether the
  * current buffer and the previous one are "compatible" (i.e. the
- * risc programs can be chained without requiring a format change)
+ * risc programs can be chained without requiring a format change).
+ * The field layout only matters to the scaler in as far as one or
+ * both fields are captured: interlaced and sequential buffers of the
+ * same size chain fine, as do top, bottom and alternate ones.
  */
 static int tw68_check_video_fmt(struct tw68_buf *prev, struct tw68_buf *buf)
 {
+	/* when scanning inputs, each buffer is started on its own */
+	if (prev->dmaq->dev->scan_mask)
+		return 0;
 	return (prev->vb.width  == buf->vb.width  &&
 		prev->vb.height == buf->vb.height &&
+		V4L2_FIELD_HAS_BOTH(prev->field) ==
+			V4L2_FIELD_HAS_BOTH(buf->field) &&
 		prev->fmt       == buf->fmt);
 }
 
@@ -692,25 +805,43 @@ buffer_setup(struct videobuf_queue *q, unsigned int *count,
 {
 	struct tw68_fh *fh = q->priv_data;
 
-	*size = fh->fmt->depth * fh->width * fh->height >> 3;
+	*size = fh->bytesperline * fh->height;
 	if (0 == *count)
 		*count = gbuffers;
 	*count = tw68_buffer_count(*size, *count);
-	return 0;
+	return *count ? 0 : -ENOMEM;
 }
 
 static int buffer_activate(struct tw68_dev *dev, struct tw68_buf *buf,
-			   struct tw68_buf *next)
+			   struct tw68_buf *prev)
 {
-	dprintk(DBG_BUFF, "%s: dev=%p, buf=%p, next=%p\n",
-		__func__, dev, buf, next);
-	if (dev->hw_input != dev->input) {
+	dprintk(DBG_BUFF, "%s: dev=%p, buf=%p, prev=%p\n",
+		__func__, dev, buf, prev);
+	/* (while scanning, start_dma picks the input) */
+	if (!dev->scan_mask && dev->hw_input != dev->input) {
 		dev->hw_input = dev->input;
 		tw_andorb(TW68_INFORM, 0x03 << 2,
 			  dev->hw_input->vmux << 2);
 	}
+	if (!dev->scan_mask) {
+		buf->meta.input = dev->hw_input - &card_in(dev, 0);
+		buf->meta.vmux = dev->hw_input->vmux;
+	}
 	buf->vb.state = VIDEOBUF_ACTIVE;
-	/* TODO - need to assure scaling/cropping are set correctly */
+	/*
+	 * A field of an ALTERNATE stream is the opposite one of the
+	 * buffer it follows, so pick the first sync accordingly: the
+	 * program is otherwise the same for either field.
+	 */
+	if (V4L2_FIELD_ALTERNATE == buf->field) {
+		u32 sync = RISC_SYNCO;
+
+		if (prev && V4L2_FIELD_ALTERNATE == prev->field &&
+		    RISC_SYNCO == (le32_to_cpu(prev->risc.cpu[0]) &
+				   0xf0000000))
+			sync = RISC_SYNCE;
+		buf->risc.cpu[0] = cpu_to_le32(sync);
+	}
 	mod_timer(&dev->video_q.timeout, jiffies+BUFFER_TIMEOUT);
 	return 0;
 }
@@ -735,7 +866,7 @@ buffer_prepare(struct videobuf_queue *q, struct videobuf_buffer *vb,
 	struct tw68_buf *buf = container_of(vb, struct tw68_buf, vb);
 	struct videobuf_dmabuf *dma = videobuf_to_dma(&buf->vb);
 	int rc, init_buffer = 0;
-	unsigned int maxw, maxh;
+	unsigned int maxw, maxh, seq = 0;
 
 	BUG_ON(NULL == fh->fmt);
 	maxw = dev->tvnorm->h_stop - dev->tvnorm->h_start + 1;
@@ -747,80 +878,62 @@ buffer_prepare(struct videobuf_queue *q, struct videobuf_buffer *vb,
 			__func__, fh->width, fh->height, maxw, maxh);
 		return -EINVAL;
 	}
-	buf->vb.size = (fh->width * fh->height * (fh->fmt->depth)) >> 3;
+	buf->vb.size = fh->bytesperline * fh->height;
 	if (0 != buf->vb.baddr  &&  buf->vb.bsize < buf->vb.size)
 		return -EINVAL;
 
 	if (buf->fmt       != fh->fmt    ||
 	    buf->vb.width  != fh->width  ||
 	    buf->vb.height != fh->height ||
-	    buf->vb.field  != field) {
+	    buf->bpl       != fh->bytesperline ||
+	    buf->field     != field) {
 		dprintk(DBG_BUFF, "%s: buf - fmt=%p, width=%3d, height=%3d, "
-			"field=%d\n%s: fh  - fmt=%p, width=%3d, height=%3d, "
-			"field=%d\n", __func__, buf->fmt, buf->vb.width,
-			buf->vb.height, buf->vb.field, __func__, fh->fmt,
-			fh->width, fh->height, field);
+			"bpl=%d, field=%d\n%s: fh  - fmt=%p, width=%3d, "
+			"height=%3d, bpl=%d, field=%d\n", __func__, buf->fmt,
+			buf->vb.width, buf->vb.height, buf->bpl, buf->field,
+			__func__, fh->fmt, fh->width, fh->height,
+			fh->bytesperline, field);
 		buf->fmt       = fh->fmt;
 		buf->vb.width  = fh->width;
 		buf->vb.height = fh->height;
-		buf->vb.field  = field;
+		buf->bpl       = fh->bytesperline;
+		buf->field     = field;
 		init_buffer = 1;	/* force risc code re-generation */
 	}
+	buf->vb.field = field;	/* tw68_wakeup may have changed it */
 	buf->input = dev->input;
 
+	/* the user unmapped or remapped the pages: pin them again */
+	if (VIDEOBUF_NEEDS_INIT != buf->vb.state && tw68_userptr_stale(buf))
+		tw68_dma_free(q, buf);
+
 	if (VIDEOBUF_NEEDS_INIT == buf->vb.state) {
-		rc = videobuf_iolock(q, &buf->vb, NULL);
-		if (0 != rc)
-			goto fail;
-		init_buffer = 1;	/* force risc code re-generation */
+		rc = tw68_userptr_get(fh, buf, &seq);
+		if (rc > 0) {
+			/* still pinned from an earlier use */
+			init_buffer = (rc == 1);
+		} else {
+			rc = videobuf_iolock(q, &buf->vb, NULL);
+			if (0 != rc)
+				goto fail;
+			tw68_userptr_pinned(fh, buf, seq);
+			init_buffer = 1;	/* force risc code re-generation */
+		}
 	}
 	dprintk(DBG_BUFF, "%s: q=%p, vb=%p, init_buffer=%d\n",
 		__func__, q, vb, init_buffer);
 
 	if (init_buffer) {
-		buf->bpl = buf->vb.width * (buf->fmt->depth) >> 3;
+		tw68_buf_untrack(dev, buf);
 		dprintk(DBG_TESTING, "%s: Generating new risc code "
 			"[%dx%dx%d](%d)\n", __func__, buf->vb.width,
 			buf->vb.height, buf->fmt->depth, buf->bpl);
-		switch (buf->vb.field) {
-		case V4L2_FIELD_TOP:
-			tw68_risc_buffer(dev->pci, &buf->risc,
-					 dma->sglist,
-					 0, UNSET,
-					 buf->bpl, 0,
-					 buf->vb.height);
-			break;
-		case V4L2_FIELD_BOTTOM:
-			tw68_risc_buffer(dev->pci, &buf->risc,
-					 dma->sglist,
-					 UNSET, 0,
-					 buf->bpl, 0,
-					 buf->vb.height);
-			break;
-		case V4L2_FIELD_INTERLACED:
-			tw68_risc_buffer(dev->pci, &buf->risc,
-					 dma->sglist,
-					 0, buf->bpl,
-					 buf->bpl, buf->bpl,
-					 buf->vb.height >> 1);
-			break;
-		case V4L2_FIELD_SEQ_TB:
-			tw68_risc_buffer(dev->pci, &buf->risc,
-					 dma->sglist,
-					 0, buf->bpl * (buf->vb.height >> 1),
-					 buf->bpl, 0,
-					 buf->vb.height >> 1);
-			break;
-		case V4L2_FIELD_SEQ_BT:
-			tw68_risc_buffer(dev->pci, &buf->risc,
-					 dma->sglist,
-					 buf->bpl * (buf->vb.height >> 1), 0,
-					 buf->bpl, 0,
-					 buf->vb.height >> 1);
-			break;
-		default:
-			BUG();
-		}
+		rc = tw68_risc_frame(dev->pci, &buf->risc, dma->sglist,
+				     buf->field,
+				     buf->vb.width * buf->fmt->depth >> 3,
+				     buf->bpl, buf->vb.height);
+		if (0 != rc)
+			goto fail;
 	}
 	dprintk(DBG_BUFF, "%s: [%p/%d] - %dx%d %dbpp \"%s\" - dma=0x%08lx\n",
 		__func__, buf, buf->vb.i, fh->width, fh->height,
@@ -828,6 +941,8 @@ buffer_prepare(struct videobuf_queue *q, struct videobuf_buffer *vb,
 
 	buf->vb.state = VIDEOBUF_PREPARED;
 	buf->activate = buffer_activate;
+	buf->fh = fh;
+	tw68_buf_track(dev, buf);
 	return 0;
 
  fail:
@@ -903,6 +1018,12 @@ static int tw68_g_ctrl_internal(struct tw68_dev *dev, struct tw68_fh *fh,
 		/*hack to suppresss tvtime complaint */
 		c->value = 0;
 		break;
+	case V4L2_CID_PRIVATE_SCAN:
+		c->value = dev->scan_mask;
+		break;
+	case V4L2_CID_PRIVATE_SCAN_SETTLE:
+		c->value = dev->scan_settle;
+		break;
 #if 0
 	case V4L2_CID_AUDIO_VOLUME:
 		c->value = dev->ctl_volume;
@@ -914,15 +1035,23 @@ static int tw68_g_ctrl_internal(struct tw68_dev *dev, struct tw68_fh *fh,
 	return 0;
 }
 
+static int tw68_g_preset(struct tw68_fh *fh, struct v4l2_control *c);
+static int tw68_s_preset(struct file *file, struct tw68_fh *fh,
+			 struct v4l2_control *c);
+
 static int tw68_g_ctrl(struct file *file, void *priv, struct v4l2_control *c)
 {
 	struct tw68_fh *fh = priv;
 
+	/* the capture size belongs to the file handle, not the chip */
+	if (V4L2_CID_PRIVATE_PRESET == c->id)
+		return tw68_g_preset(fh, c);
 	return tw68_g_ctrl_internal(fh->dev, fh, c);
 }
 
 static int tw68_s_ctrl_value(struct tw68_dev *dev, __u32 id, int val)
 {
+	unsigned long flags;
 	int err = 0;
 
 	dprintk(DBG_FLOW, "%s\n", __func__);
@@ -955,6 +1084,17 @@ static int tw68_s_ctrl_value(struct tw68_dev *dev, __u32 id, int val)
 	case V4L2_CID_AUDIO_MUTE:
 		/* hack to suppress tvtime complaint */
 		break;
+	case V4L2_CID_PRIVATE_SCAN:
+		/* applies from the next buffer started */
+		spin_lock_irqsave(&dev->slock, flags);
+		dev->scan_mask = val;
+		spin_unlock_irqrestore(&dev->slock, flags);
+		break;
+	case V4L2_CID_PRIVATE_SCAN_SETTLE:
+		spin_lock_irqsave(&dev->slock, flags);
+		dev->scan_settle = val;
+		spin_unlock_irqrestore(&dev->slock, flags);
+		break;
 #if 0
 	case V4L2_CID_AUDIO_VOLUME:
 		dev->ctl_volume = val;
@@ -1038,6 +1178,8 @@ static int tw68_s_ctrl(struct file *file, void *f, struct v4l2_control *c)
 {
 	struct tw68_fh *fh = f;
 
+	if (V4L2_CID_PRIVATE_PRESET == c->id)
+		return tw68_s_preset(file, fh, c);
 	return tw68_s_ctrl_internal(fh->dev, fh, c);
 }
 
@@ -1077,33 +1219,25 @@ static int tw68_resource(struct tw68_fh *fh)
 
 static int video_open(struct file *file)
 {
-	int minor = video_devdata(file)->minor;
-	struct tw68_dev *dev;
+	struct video_device *vdev = video_devdata(file);
+	struct tw68_dev *dev = video_get_drvdata(vdev);
 	struct tw68_fh *fh;
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	int radio = 0;
 
-	mutex_lock(&tw68_devlist_lock);
-	list_for_each_entry(dev, &tw68_devlist, devlist) {
-		if (dev->video_dev && (dev->video_dev->minor == minor))
-			goto found;
-		if (dev->radio_dev && (dev->radio_dev->minor == minor)) {
-			radio = 1;
-			goto found;
-		}
-		if (dev->vbi_dev && (dev->vbi_dev->minor == minor)) {
-			type = V4L2_BUF_TYPE_VBI_CAPTURE;
-			goto found;
-		}
+	if (NULL == dev)
+		return -ENODEV;
+	switch (vdev->vfl_type) {
+	case VFL_TYPE_RADIO:
+		radio = 1;
+		break;
+	case VFL_TYPE_VBI:
+		type = V4L2_BUF_TYPE_VBI_CAPTURE;
+		break;
 	}
-	mutex_unlock(&tw68_devlist_lock);
-	return -ENODEV;
-
-found:
-	mutex_unlock(&tw68_devlist_lock);
 
-	dprintk(DBG_FLOW, "%s: minor=%d radio=%d type=%s\n", __func__, minor,
-		radio, v4l2_type_names[type]);
+	dprintk(DBG_FLOW, "%s: minor=%d radio=%d type=%s\n", __func__,
+		vdev->minor, radio, v4l2_type_names[type]);
 
 	/* allocate + initialize per filehandle data */
 	fh = kzalloc(sizeof(*fh), GFP_KERNEL);
@@ -1117,30 +1251,36 @@ found:
 	fh->fmt      = format_by_fourcc(V4L2_PIX_FMT_BGR24);
 	fh->width    = 720;
 	fh->height   = 576;
+	fh->bytesperline = (fh->width * fh->fmt->depth) >> 3;
+	init_waitqueue_head(&fh->done_wait);
+	INIT_LIST_HEAD(&fh->bw_list);
 	v4l2_prio_open(&dev->prio, &fh->prio);
 
-	videobuf_queue_sg_init(&fh->cap, &video_qops,
-			    &dev->pci->dev, &dev->slock,
-			    V4L2_BUF_TYPE_VIDEO_CAPTURE,
-			    V4L2_FIELD_INTERLACED,
-			    sizeof(struct tw68_buf),
+	/* only the queue used by this kind of node is set up */
+	if (V4L2_BUF_TYPE_VIDEO_CAPTURE == type)
+		videobuf_queue_sg_init(&fh->cap, &video_qops,
+				    &dev->pci->dev, &dev->slock,
+				    V4L2_BUF_TYPE_VIDEO_CAPTURE,
+				    V4L2_FIELD_INTERLACED,
+				    sizeof(struct tw68_buf),
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,37)
-			    fh
+				    fh
 #else
-			    fh, &dev->lock
+				    fh, &dev->lock
 #endif
-             );
-	videobuf_queue_sg_init(&fh->vbi, &tw68_vbi_qops,
-			    &dev->pci->dev, &dev->slock,
-			    V4L2_BUF_TYPE_VBI_CAPTURE,
-			    V4L2_FIELD_SEQ_TB,
-			    sizeof(struct tw68_buf),
+	             );
+	else
+		videobuf_queue_sg_init(&fh->vbi, &tw68_vbi_qops,
+				    &dev->pci->dev, &dev->slock,
+				    V4L2_BUF_TYPE_VBI_CAPTURE,
+				    V4L2_FIELD_SEQ_TB,
+				    sizeof(struct tw68_buf),
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,37)
-			    fh
+				    fh
 #else
-			    fh, &dev->lock
+				    fh, &dev->lock
 #endif
-             );
+	             );
 	if (fh->radio) {
 		/* switch to radio mode */
 		tw68_tvaudio_setinput(dev, &card(dev).radio);
@@ -1156,14 +1296,37 @@ static ssize_t
 video_read(struct file *file, char __user *data, size_t count, loff_t *ppos)
 {
 	struct tw68_fh *fh = file->private_data;
+	ssize_t ret;
 
 	switch (fh->type) {
 	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
-		if (res_locked(fh->dev, RESOURCE_VIDEO))
+		if (res_check(fh, RESOURCE_VIDEO))
 			return -EBUSY;
-		return videobuf_read_one(tw68_queue(fh),
-					 data, count, ppos,
-					 file->f_flags & O_NONBLOCK);
+		/* another handle is streaming - share its frames */
+		if (res_locked(fh->dev, RESOURCE_VIDEO))
+			return tw68_tap_read(fh, data, count,
+					     file->f_flags & O_NONBLOCK);
+		if (0 == tw68_buffer_count(fh->bytesperline * fh->height, 1))
+			return -ENOMEM;
+		/* a read() capture takes the PCI bus like a stream */
+		if (res_bw(fh))
+			return -ENOSPC;
+		/* and the decoder, woken up by the first read */
+		if (!fh->read_power) {
+			tw68_power_get(fh->dev);
+			fh->read_power = 1;
+		}
+		ret = videobuf_read_one(tw68_queue(fh),
+					data, count, ppos,
+					file->f_flags & O_NONBLOCK);
+		/* once the frame is read out, the capture is over */
+		if (NULL == fh->cap.read_buf) {
+			tw68_group_stop(fh->dev);
+			tw68_bw_release(fh);
+			fh->read_power = 0;
+			tw68_power_put(fh->dev);
+		}
+		return ret;
 	case V4L2_BUF_TYPE_VBI_CAPTURE:
 		if (!res_get(fh, RESOURCE_VBI))
 			return -EBUSY;
@@ -1177,77 +1340,104 @@ video_read(struct file *file, char __user *data, size_t count, loff_t *ppos)
 	}
 }
 
+/*
+ * video_poll
+ *
+ * In streaming mode this is lock-free: every completion of one of our
+ * buffers bumps fh->done_cnt (see tw68_buf_done in tw68-core.c), and
+ * every successful DQBUF bumps fh->dq_cnt, so a buffer is ready exactly
+ * when the two differ.  Poll never prepares or queues a buffer; in
+ * read() mode, if no frame is being captured, it reports the handle as
+ * readable and leaves it to read() to start the capture.
+ */
 static unsigned int
 video_poll(struct file *file, struct poll_table_struct *wait)
 {
 	struct tw68_fh *fh = file->private_data;
-	struct videobuf_buffer *buf = NULL;
+	struct videobuf_buffer *buf;
+	unsigned int rc;
 
 	if (V4L2_BUF_TYPE_VBI_CAPTURE == fh->type)
 		return videobuf_poll_stream(file, &fh->vbi, wait);
 
 	if (res_check(fh, RESOURCE_VIDEO)) {
-		if (!list_empty(&fh->cap.stream))
-			buf = list_entry(fh->cap.stream.next,
-				struct videobuf_buffer, stream);
-	} else {
-		mutex_lock(&fh->cap.vb_lock);
-		if (UNSET == fh->cap.read_off) {
-			/* need to capture a new frame */
-			if (res_locked(fh->dev, RESOURCE_VIDEO))
-				goto err;
-			if (0 != fh->cap.ops->buf_prepare(&fh->cap,
-					fh->cap.read_buf, fh->cap.field))
-				goto err;
-			fh->cap.ops->buf_queue(&fh->cap, fh->cap.read_buf);
-			fh->cap.read_off = 0;
-		}
-		mutex_unlock(&fh->cap.vb_lock);
-		buf = fh->cap.read_buf;
+		if (!fh->cap.streaming)
+			return POLLERR;
+		poll_wait(file, &fh->done_wait, wait);
+		if (atomic_read(&fh->done_cnt) != atomic_read(&fh->dq_cnt))
+			return POLLIN | POLLRDNORM;
+		return 0;
 	}
 
-	if (!buf)
-		return POLLERR;
+	if (res_locked(fh->dev, RESOURCE_VIDEO)) {
+		/* tap reader of a stream owned by another handle */
+		struct tw68_dmaqueue *q = &fh->dev->video_q;
 
-	poll_wait(file, &buf->done, wait);
-	if (buf->state == VIDEOBUF_DONE ||
-	    buf->state == VIDEOBUF_ERROR)
-		return POLLIN | POLLRDNORM;
-	return 0;
+		poll_wait(file, &q->tap_wait, wait);
+		if (ACCESS_ONCE(q->done_seq) != fh->tap_seq)
+			return POLLIN | POLLRDNORM;
+		return 0;
+	}
 
-err:
-	mutex_unlock(&fh->cap.vb_lock);
-	return POLLERR;
+	/* dev->lock is the queue's ext_lock, see tw68_g_meta */
+	mutex_lock(&fh->dev->lock);
+	buf = fh->cap.read_buf;
+	if (UNSET == fh->cap.read_off || NULL == buf) {
+		/* nothing in progress - read() will start a capture */
+		rc = POLLIN | POLLRDNORM;
+	} else {
+		poll_wait(file, &buf->done, wait);
+		rc = 0;
+		if (buf->state == VIDEOBUF_DONE ||
+		    buf->state == VIDEOBUF_ERROR)
+			rc = POLLIN | POLLRDNORM;
+	}
+	mutex_unlock(&fh->dev->lock);
+	return rc;
 }
 
 static int video_release(struct file *file)
 {
 	struct tw68_fh  *fh  = file->private_data;
 	struct tw68_dev *dev = fh->dev;
+	int video = res_check(fh, RESOURCE_VIDEO);
+	int vbi = res_check(fh, RESOURCE_VBI);
 
+	/* res_free takes dev->lock itself, so it comes last */
+	if (video)
+		tw68_group_stop(dev);
+	mutex_lock(&dev->lock);
 	/* stop video capture */
-	if (res_check(fh, RESOURCE_VIDEO)) {
+	if (video)
 		videobuf_streamoff(&fh->cap);
-		res_free(fh , RESOURCE_VIDEO);
-	}
 	if (fh->cap.read_buf) {
+		/* read() started captures too */
+		tw68_group_stop(dev);
+		tw68_bw_release(fh);
 		buffer_release(&fh->cap, fh->cap.read_buf);
 		kfree(fh->cap.read_buf);
 	}
 
 	/* stop vbi capture */
-	if (res_check(fh, RESOURCE_VBI)) {
+	if (vbi)
 		videobuf_stop(&fh->vbi);
-		res_free(fh, RESOURCE_VBI);
-	}
 
 #if 0
 	tw_call_all(dev, core, s_standby, 0);
 #endif
 
 	/* free stuff */
-	videobuf_mmap_free(&fh->cap);
-	videobuf_mmap_free(&fh->vbi);
+	videobuf_mmap_free(tw68_queue(fh));
+	tw68_userptr_fini(fh);
+	mutex_unlock(&dev->lock);
+	if (video)
+		res_free(fh, RESOURCE_VIDEO);
+	if (vbi)
+		res_free(fh, RESOURCE_VBI);
+	/* whatever capture it was, fh is going */
+	tw68_bw_release(fh);
+	if (fh->read_power)
+		tw68_power_put(dev);
 
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,34)
 	v4l2_prio_close(&dev->prio, &fh->prio);
@@ -1259,11 +1449,75 @@ static int video_release(struct file *file)
 	return 0;
 }
 
+/*
+ * The queue of the stream @fh taps, if it is a tap handle: one not
+ * streaming itself, and with no buffers of its own, on a device whose
+ * video another handle is streaming.  Under dev->lock.
+ */
+static struct videobuf_queue *tw68_tap_queue(struct tw68_fh *fh)
+{
+	struct tw68_fh *owner = fh->dev->video_owner;
+
+	if (NULL == owner || owner == fh || NULL != fh->cap.bufs[0])
+		return NULL;
+	return &owner->cap;
+}
+
+/*
+ * mmap() of a buffer of the stream's owner by a tap handle, at the
+ * offset TW68_IOC_G_META gives: the owner's pages are inserted in the
+ * mapping, read-only, so that the frames are shared rather than copied.
+ * Only buffers the owner mmaps qualify (userptr memory is the owner's
+ * anonymous memory), once they have been queued.  If the owner frees
+ * its buffers, the pages stay in the mapping, no longer filled, until
+ * it goes.  Under dev->lock.
+ */
+static int tw68_tap_mmap(struct videobuf_queue *q, struct vm_area_struct *vma)
+{
+	unsigned long off = vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long addr, size = vma->vm_end - vma->vm_start;
+	struct videobuf_dmabuf *dma;
+	unsigned int i, n;
+	int err;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EACCES;
+	for (i = 0; i < VIDEO_MAX_FRAME; i++)
+		if (q->bufs[i] && q->bufs[i]->boff == off)
+			break;
+	if (VIDEO_MAX_FRAME == i || V4L2_MEMORY_MMAP != q->bufs[i]->memory)
+		return -EINVAL;
+	dma = videobuf_to_dma(q->bufs[i]);
+	if (NULL == dma->pages || dma->offset ||
+	    size > ((unsigned long)dma->nr_pages << PAGE_SHIFT))
+		return -EINVAL;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTEXPAND;
+	for (n = 0, addr = vma->vm_start; addr < vma->vm_end;
+	     n++, addr += PAGE_SIZE) {
+		err = vm_insert_page(vma, addr, dma->pages[n]);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
 static int video_mmap(struct file *file, struct vm_area_struct * vma)
 {
 	struct tw68_fh *fh = file->private_data;
+	struct videobuf_queue *tap = NULL;
+	int err;
 
-	return videobuf_mmap_mapper(tw68_queue(fh), vma);
+	if (mutex_lock_interruptible(&fh->dev->lock))
+		return -ERESTARTSYS;
+	if (V4L2_BUF_TYPE_VIDEO_CAPTURE == fh->type)
+		tap = tw68_tap_queue(fh);
+	if (tap)
+		err = tw68_tap_mmap(tap, vma);
+	else
+		err = videobuf_mmap_mapper(tw68_queue(fh), vma);
+	mutex_unlock(&fh->dev->lock);
+	return err;
 }
 
 /* ------------------------------------------------------------------ */
@@ -1312,8 +1566,7 @@ static int tw68_g_fmt_vid_cap(struct file *file, void *priv,
 	f->fmt.pix.height       = fh->height;
 	f->fmt.pix.field        = fh->cap.field;
 	f->fmt.pix.pixelformat  = fh->fmt->fourcc;
-	f->fmt.pix.bytesperline =
-		(f->fmt.pix.width * (fh->fmt->depth)) >> 3;
+	f->fmt.pix.bytesperline = fh->bytesperline;
 	f->fmt.pix.sizeimage =
 		f->fmt.pix.height * f->fmt.pix.bytesperline;
 	f->fmt.pix.colorspace	= V4L2_COLORSPACE_SMPTE170M;
@@ -1327,7 +1580,7 @@ static int tw68_try_fmt_vid_cap(struct file *file, void *priv,
 	struct tw68_dev *dev = fh->dev;
 	struct tw68_format *fmt;
 	enum v4l2_field field;
-	unsigned int maxw, maxh;
+	unsigned int maxw, maxh, bpl;
 
 	dprintk(DBG_FLOW, "%s\n", __func__);
 	fmt = format_by_fourcc(f->fmt.pix.pixelformat);
@@ -1346,8 +1599,11 @@ static int tw68_try_fmt_vid_cap(struct file *file, void *priv,
 	switch (field) {
 	case V4L2_FIELD_TOP:
 	case V4L2_FIELD_BOTTOM:
+	case V4L2_FIELD_ALTERNATE:	/* one field per buffer */
 		break;
 	case V4L2_FIELD_INTERLACED:
+	case V4L2_FIELD_SEQ_TB:		/* whole top field, then bottom */
+	case V4L2_FIELD_SEQ_BT:		/* whole bottom field, then top */
 		maxh = maxh * 2;
 		break;
 	default:
@@ -1363,9 +1619,21 @@ static int tw68_try_fmt_vid_cap(struct file *file, void *priv,
 		f->fmt.pix.width = maxw;
 	if (f->fmt.pix.height > maxh)
 		f->fmt.pix.height = maxh;
+	/* both fields get the same number of lines */
+	if (V4L2_FIELD_HAS_BOTH(field))
+		f->fmt.pix.height &= ~0x01;
 	f->fmt.pix.width &= ~0x03;
-	f->fmt.pix.bytesperline =
-		(f->fmt.pix.width * (fmt->depth)) >> 3;
+	/*
+	 * A larger bytesperline than the line needs is honoured (rounded
+	 * up to whole dwords, and at most a page more than the line), so
+	 * that applications can have every line start aligned; the risc
+	 * program skips the padding.
+	 */
+	bpl = (f->fmt.pix.width * (fmt->depth)) >> 3;
+	if (f->fmt.pix.bytesperline > bpl)
+		bpl = min_t(unsigned int, ALIGN(f->fmt.pix.bytesperline, 4),
+			    bpl + PAGE_SIZE);
+	f->fmt.pix.bytesperline = bpl;
 	f->fmt.pix.sizeimage =
 		f->fmt.pix.height * f->fmt.pix.bytesperline;
 
@@ -1390,9 +1658,17 @@ static int tw68_s_fmt_vid_cap(struct file *file, void *priv,
 	if (0 != err)
 		return err;
 
+	/* while streaming, the new format must fit the PCI bus too */
+	if (res_check(fh, RESOURCE_VIDEO) &&
+	    tw68_bw_reserve(fh, tw68_bw_demand(dev,
+				format_by_fourcc(f->fmt.pix.pixelformat),
+				f->fmt.pix.width, f->fmt.pix.height,
+				f->fmt.pix.field)))
+		return -ENOSPC;
 	fh->fmt       = format_by_fourcc(f->fmt.pix.pixelformat);
 	fh->width     = f->fmt.pix.width;
 	fh->height    = f->fmt.pix.height;
+	fh->bytesperline = f->fmt.pix.bytesperline;
 	fh->cap.field = f->fmt.pix.field;
 	/*
 	 * The following lines are to make v4l2-test program happy.
@@ -1403,6 +1679,102 @@ static int tw68_s_fmt_vid_cap(struct file *file, void *priv,
 	return 0;
 }
 
+static unsigned int preset_height(struct tw68_dev *dev,
+				  const struct tw68_preset *p)
+{
+	return (dev->tvnorm->id & V4L2_STD_525_60) ?
+		p->height_525 : p->height_625;
+}
+
+/*
+ * The capture size control reads back as the preset the file handle's
+ * format matches (1 based), or 0 for any other size; a single field
+ * preset matches either field.  Setting it is a S_FMT to that preset's
+ * size and field in the current pixel format; setting 0 changes
+ * nothing.
+ */
+static int preset_field(enum v4l2_field field)
+{
+	return V4L2_FIELD_BOTTOM == field ? V4L2_FIELD_TOP : field;
+}
+
+static int tw68_g_preset(struct tw68_fh *fh, struct v4l2_control *c)
+{
+	struct tw68_dev *dev = fh->dev;
+	unsigned int i;
+
+	c->value = 0;
+	for (i = 0; i < PRESETS; i++) {
+		if (fh->width == presets[i].width &&
+		    fh->height == preset_height(dev, &presets[i]) &&
+		    preset_field(fh->cap.field) == presets[i].field) {
+			c->value = i + 1;
+			break;
+		}
+	}
+	return 0;
+}
+
+static int tw68_s_preset(struct file *file, struct tw68_fh *fh,
+			 struct v4l2_control *c)
+{
+	struct tw68_dev *dev = fh->dev;
+	const struct tw68_preset *p;
+	struct v4l2_format f;
+
+	if (c->value < 0 || c->value > PRESETS)
+		return -ERANGE;
+	if (0 == c->value)
+		return 0;
+	p = &presets[c->value - 1];
+	memset(&f, 0, sizeof(f));
+	f.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	f.fmt.pix.pixelformat = fh->fmt->fourcc;
+	f.fmt.pix.width = p->width;
+	f.fmt.pix.height = preset_height(dev, p);
+	f.fmt.pix.field = p->field;
+	dprintk(DBG_FLOW, "%s: %s\n", __func__, p->name);
+	return tw68_s_fmt_vid_cap(file, fh, &f);
+}
+
+static int tw68_querymenu(struct file *file, void *priv,
+			  struct v4l2_querymenu *m)
+{
+	if (V4L2_CID_PRIVATE_PRESET != m->id || m->index > PRESETS)
+		return -EINVAL;
+	strlcpy(m->name, m->index ? presets[m->index - 1].name : "Custom",
+		sizeof(m->name));
+	return 0;
+}
+
+/*
+ * The scaler takes any size within the limits tw68_try_fmt_vid_cap
+ * applies, so report those rather than the presets (which stay a menu
+ * control): the width in steps of 4, and up to both fields' worth of
+ * lines of the current crop, in steps of 2 as both fields get the same
+ * number of lines (a single field could take any height).
+ */
+static int tw68_enum_framesizes(struct file *file, void *priv,
+				struct v4l2_frmsizeenum *fsize)
+{
+	struct tw68_fh *fh = priv;
+	struct tw68_dev *dev = fh->dev;
+
+	if (NULL == format_by_fourcc(fsize->pixel_format) ||
+	    fsize->index > 0)
+		return -EINVAL;
+	fsize->type = V4L2_FRMSIZE_TYPE_STEPWISE;
+	fsize->stepwise.min_width = 48;
+	fsize->stepwise.max_width = min(dev->crop_current.width * 4,
+					dev->crop_bounds.width) & ~0x03;
+	fsize->stepwise.step_width = 4;
+	fsize->stepwise.min_height = 32;
+	fsize->stepwise.max_height = min(dev->crop_current.height * 4,
+					 dev->crop_bounds.height) * 2;
+	fsize->stepwise.step_height = 2;
+	return 0;
+}
+
 static int tw68_queryctrl(struct file *file, void *priv,
 			  struct v4l2_queryctrl *c)
 {
@@ -1412,10 +1784,8 @@ static int tw68_queryctrl(struct file *file, void *priv,
 
 	dprintk(DBG_FLOW, "%s\n", __func__);
 	if ((c->id <  V4L2_CID_BASE || c->id >= V4L2_CID_LASTP1)
-#if 0
 	     && (c->id <  V4L2_CID_PRIVATE_BASE ||
 	     c->id >= V4L2_CID_PRIVATE_LASTP1)
-#endif
 	)
 		return -EINVAL;
 	ctrl = ctrl_by_id(c->id);
@@ -1587,6 +1957,12 @@ static int tw68_s_std_internal(struct tw68_dev *dev, struct tw68_fh *fh,
 
 	*id = tvnorms[i].id;
 	mutex_lock(&dev->lock);
+	/* the captures under way must still fit the PCI bus */
+	err = tw68_bw_renorm(dev, &tvnorms[i]);
+	if (err) {
+		mutex_unlock(&dev->lock);
+		return err;
+	}
 	set_tvnorm(dev, &tvnorms[i]);	/* do the actual setting */
 	tw68_tvaudio_do_scan(dev);
 	mutex_unlock(&dev->lock);
@@ -1816,11 +2192,11 @@ static int tw68_s_crop(struct file *file, void *f, struct v4l2_crop *crop)
 	struct tw68_fh *fh = f;
 	struct tw68_dev *dev = fh->dev;
 	struct v4l2_rect *b = &dev->crop_bounds;
+	struct tw68_buf *buf;
+	unsigned long flags;
+	unsigned int lines;
 
 	dprintk(DBG_FLOW, "%s\n", __func__);
-	if (res_locked(fh->dev, RESOURCE_VIDEO))
-		return -EBUSY;
-
 	if ((crop->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) ||
 	    (crop->c.height < 0) || (crop->c.width < 0)) {
 		dprintk(DBG_UNEXPECTED, "%s: invalid request\n", __func__);
@@ -1841,10 +2217,30 @@ static int tw68_s_crop(struct file *file, void *f, struct v4l2_crop *crop)
 	if (crop->c.width > b->left - crop->c.left + b->width)
 		crop->c.width = b->left - crop->c.left + b->width;
 
+	spin_lock_irqsave(&dev->slock, flags);
+	if (!list_empty(&dev->video_q.active)) {
+		/*
+		 * Streaming: the buffer size is fixed, and the scaler can
+		 * enlarge at most 4 times (as allowed by try_fmt).
+		 */
+		buf = list_entry(dev->video_q.active.next, struct tw68_buf,
+				 vb.queue);
+		lines = buf->vb.height;
+		if (V4L2_FIELD_HAS_BOTH(buf->vb.field))
+			lines /= 2;
+		if (crop->c.width * 4 < buf->vb.width)
+			crop->c.width = DIV_ROUND_UP(buf->vb.width, 4);
+		if (crop->c.height * 4 < lines)
+			crop->c.height = DIV_ROUND_UP(lines, 4);
+	}
 	dprintk(DBG_FLOW, "%s: setting cropping rectangle: top=%d, left=%d, "
 		    "width=%d, height=%d\n", __func__, crop->c.top,
 		    crop->c.left, crop->c.width, crop->c.height);
 	dev->crop_current = crop->c;
+	/* while streaming, tw68_irq_video_done commits it between frames */
+	if (res_locked(dev, RESOURCE_VIDEO))
+		dev->crop_dirty = 1;
+	spin_unlock_irqrestore(&dev->slock, flags);
 	return 0;
 }
 
@@ -1859,31 +2255,462 @@ static int vidiocgmbuf(struct file *file, void *priv, struct video_mbuf *mbuf)
 }
 #endif
 
+/*
+ * The buffer ioctls run under dev->lock, the ext_lock of the videobuf
+ * queues, as videobuf expects and as TW68_IOC_BATCH relies on when it
+ * works on the queues of other file handles.
+ */
 static int tw68_reqbufs(struct file *file, void *priv,
 					struct v4l2_requestbuffers *p)
 {
 	struct tw68_fh *fh = priv;
-	return videobuf_reqbufs(tw68_queue(fh), p);
+	int err;
+
+	/* videobuf ignores buf_setup's ENOMEM, and would grant none */
+	if (V4L2_BUF_TYPE_VIDEO_CAPTURE == fh->type && p->count &&
+	    0 == tw68_buffer_count(fh->bytesperline * fh->height, p->count))
+		return -ENOMEM;
+	if (mutex_lock_interruptible(&fh->dev->lock))
+		return -ERESTARTSYS;
+	err = videobuf_reqbufs(tw68_queue(fh), p);
+	mutex_unlock(&fh->dev->lock);
+	return err;
 }
 
 static int tw68_querybuf(struct file *file, void *priv,
 					struct v4l2_buffer *b)
 {
 	struct tw68_fh *fh = priv;
-	return videobuf_querybuf(tw68_queue(fh), b);
+	int err;
+
+	if (mutex_lock_interruptible(&fh->dev->lock))
+		return -ERESTARTSYS;
+	err = videobuf_querybuf(tw68_queue(fh), b);
+	mutex_unlock(&fh->dev->lock);
+	return err;
 }
 
 static int tw68_qbuf(struct file *file, void *priv, struct v4l2_buffer *b)
 {
 	struct tw68_fh *fh = priv;
-	return videobuf_qbuf(tw68_queue(fh), b);
+	int err;
+
+	if (mutex_lock_interruptible(&fh->dev->lock))
+		return -ERESTARTSYS;
+	err = videobuf_qbuf(tw68_queue(fh), b);
+	mutex_unlock(&fh->dev->lock);
+	return err;
 }
 
+/*
+ * A blocking DQBUF of video doesn't sleep in videobuf with dev->lock
+ * held: it waits, unlocked, for a completion the way video_poll does
+ * and tries again.  VBI is left to videobuf, which drops the ext_lock
+ * while it waits.
+ */
 static int tw68_dqbuf(struct file *file, void *priv, struct v4l2_buffer *b)
 {
 	struct tw68_fh *fh = priv;
-	return videobuf_dqbuf(tw68_queue(fh), b,
-				file->f_flags & O_NONBLOCK);
+	int video = V4L2_BUF_TYPE_VIDEO_CAPTURE == fh->type;
+	int nonblock = file->f_flags & O_NONBLOCK;
+	int err;
+
+	for (;;) {
+		if (mutex_lock_interruptible(&fh->dev->lock))
+			return -ERESTARTSYS;
+		err = videobuf_dqbuf(tw68_queue(fh), b, nonblock || video);
+		if (0 == err && video)
+			atomic_inc(&fh->dq_cnt);
+		mutex_unlock(&fh->dev->lock);
+		if (-EAGAIN != err || nonblock || !video)
+			return err;
+		if (wait_event_interruptible(fh->done_wait,
+				atomic_read(&fh->done_cnt) !=
+				atomic_read(&fh->dq_cnt) ||
+				!ACCESS_ONCE(fh->cap.streaming)))
+			return -ERESTARTSYS;
+	}
+}
+
+/* ------------------------------------------------------------------ */
+/* TW68_IOC_G_META and TW68_IOC_BATCH, see tw68-ioctl.h               */
+
+/* the meta of @buf (index @index), under slock */
+static void tw68_meta_fill(struct tw68_buf *buf, unsigned int index,
+			   struct tw68_meta *m)
+{
+	*m = buf->meta;
+	m->index = index;
+	m->sequence = buf->vb.field_count >> 1;
+	m->offset = buf->vb.boff;
+	/* done (or dequeued since): from the field's end to now */
+	if (VIDEOBUF_DONE == buf->vb.state || VIDEOBUF_IDLE == buf->vb.state)
+		m->latency = ktime_us_delta(ktime_get(), buf->done_time);
+}
+
+/* TW68_META_TAP_NEXT and TW68_META_TAP_LAST, see tw68-ioctl.h */
+static int tw68_tap_meta(struct tw68_fh *fh, struct tw68_meta *m)
+{
+	struct tw68_dev *dev = fh->dev;
+	struct tw68_dmaqueue *q = &dev->video_q;
+	struct tw68_buf *buf;
+	unsigned long flags;
+	int err = 0;
+
+	if (TW68_META_TAP_LAST == m->index) {
+		if (0 == fh->tap_frames)
+			return -EINVAL;
+		*m = fh->tap_meta;
+	} else {
+		if (NULL == tw68_tap_queue(fh))
+			return -EINVAL;
+		spin_lock_irqsave(&dev->slock, flags);
+		buf = q->last;
+		if (NULL == buf || q->done_seq == fh->tap_seq) {
+			err = -EAGAIN;
+		} else if (!tw68_tap_fmt_ok(fh, buf)) {
+			err = -EBUSY;
+		} else {
+			tw68_tap_count(fh, q->done_seq);
+			fh->tap_frames++;
+			tw68_meta_fill(buf, buf->vb.i, m);
+			fh->tap_meta = *m;
+		}
+		spin_unlock_irqrestore(&dev->slock, flags);
+		if (err)
+			return err;
+	}
+	m->frames = fh->tap_frames;
+	m->dropped = fh->tap_dropped;
+	return 0;
+}
+
+/*
+ * Called with dev->lock held: it is the videobuf queue's ext_lock, so
+ * it keeps the buffers from being freed under us (q->vb_lock is not
+ * used by videobuf once an ext_lock is set).  A tap handle is told
+ * about the buffers of the stream's owner, while they hold a frame.
+ */
+static int tw68_g_meta(struct tw68_fh *fh, struct tw68_meta *m)
+{
+	struct tw68_dev *dev = fh->dev;
+	struct videobuf_queue *q = &fh->cap;
+	struct videobuf_queue *tap = NULL;
+	struct tw68_buf *buf;
+	unsigned long flags;
+	unsigned int index = m->index;
+	int err = 0;
+
+	if (V4L2_BUF_TYPE_VIDEO_CAPTURE != fh->type)
+		return -EINVAL;
+	if (TW68_META_TAP_NEXT == index || TW68_META_TAP_LAST == index)
+		return tw68_tap_meta(fh, m);
+	if (index >= VIDEO_MAX_FRAME)
+		return -EINVAL;
+	if (NULL == q->bufs[index])
+		tap = tw68_tap_queue(fh);
+	if (tap)
+		q = tap;
+	if (NULL == q->bufs[index])
+		return -EINVAL;
+	buf = container_of(q->bufs[index], struct tw68_buf, vb);
+	spin_lock_irqsave(&dev->slock, flags);
+	if (tap && VIDEOBUF_DONE != buf->vb.state &&
+	    VIDEOBUF_IDLE != buf->vb.state)
+		err = -EBUSY;		/* being filled again */
+	else
+		tw68_meta_fill(buf, index, m);
+	spin_unlock_irqrestore(&dev->slock, flags);
+	if (tap && 0 == err) {
+		m->frames = fh->tap_frames;
+		m->dropped = fh->tap_dropped;
+	}
+	return err;
+}
+
+static const struct v4l2_file_operations video_fops;
+
+/* the capture file handle behind @file, or NULL if it isn't one of ours */
+static struct tw68_fh *tw68_batch_fh(struct file *file)
+{
+	struct video_device *vdev;
+	struct tw68_fh *fh;
+
+	if (VIDEO_MAJOR != imajor(file->f_path.dentry->d_inode))
+		return NULL;
+	vdev = video_devdata(file);
+	if (NULL == vdev || vdev->fops != &video_fops)
+		return NULL;
+	fh = file->private_data;
+	if (NULL == fh || fh->radio ||
+	    V4L2_BUF_TYPE_VIDEO_CAPTURE != fh->type)
+		return NULL;
+	return fh;
+}
+
+/*
+ * The steps of an entry, each on the device @e->fd is open on and
+ * under that device's dev->lock, which the buffer ioctls, STREAMON,
+ * STREAMOFF and close take around their videobuf calls as well.  The
+ * batch's own device is not locked by the ioctl core (its video_device
+ * has no lock), and the entries are handled one at a time, so no two
+ * devices' locks are ever held together and the order doesn't matter.
+ */
+static int tw68_batch_qbuf(struct tw68_fh *fh, struct tw68_batch_entry *e)
+{
+	int err;
+
+	if (!(e->flags & TW68_BATCH_QBUF))
+		return 0;
+	if (mutex_lock_interruptible(&fh->dev->lock))
+		return -EINTR;
+	err = videobuf_qbuf(&fh->cap, &e->buf);
+	mutex_unlock(&fh->dev->lock);
+	return err;
+}
+
+static int tw68_batch_dqbuf(struct tw68_fh *fh, struct tw68_batch_entry *e)
+{
+	int err;
+
+	if (mutex_lock_interruptible(&fh->dev->lock))
+		return -EINTR;
+	memset(&e->buf, 0, sizeof(e->buf));
+	e->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	err = videobuf_dqbuf(&fh->cap, &e->buf, 1);
+	if (0 == err) {
+		atomic_inc(&fh->dq_cnt);
+		e->flags |= TW68_BATCH_DONE;
+		e->meta.index = e->buf.index;
+		err = tw68_g_meta(fh, &e->meta);
+	} else if (-EAGAIN == err) {
+		memset(&e->buf, 0, sizeof(e->buf));
+		err = 0;
+	}
+	mutex_unlock(&fh->dev->lock);
+	return err;
+}
+
+/*
+ * For TW68_BATCH_SET: the sequence of the buffer a non-blocking DQBUF
+ * on @fh would return, or -EAGAIN if it isn't done yet.
+ */
+static int tw68_batch_peek(struct tw68_fh *fh, unsigned int *seq)
+{
+	struct videobuf_queue *q = &fh->cap;
+	struct videobuf_buffer *vb;
+	unsigned long flags;
+	int err = -EAGAIN;
+
+	if (mutex_lock_interruptible(&fh->dev->lock))
+		return -EINTR;
+	if (!q->streaming) {
+		err = -EINVAL;
+	} else if (!list_empty(&q->stream)) {
+		vb = list_entry(q->stream.next, struct videobuf_buffer, stream);
+		spin_lock_irqsave(&fh->dev->slock, flags);
+		if (VIDEOBUF_DONE == vb->state ||
+		    VIDEOBUF_ERROR == vb->state) {
+			*seq = vb->field_count >> 1;
+			err = 0;
+		}
+		spin_unlock_irqrestore(&fh->dev->slock, flags);
+	}
+	mutex_unlock(&fh->dev->lock);
+	return err;
+}
+
+/* For TW68_BATCH_SET: dequeue a frame no set can have, and requeue it */
+static int tw68_batch_drop(struct tw68_fh *fh)
+{
+	struct v4l2_buffer b;
+	int err;
+
+	if (mutex_lock_interruptible(&fh->dev->lock))
+		return -EINTR;
+	memset(&b, 0, sizeof(b));
+	b.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	err = videobuf_dqbuf(&fh->cap, &b, 1);
+	if (0 == err) {
+		atomic_inc(&fh->dq_cnt);
+		err = videobuf_qbuf(&fh->cap, &b);
+	}
+	mutex_unlock(&fh->dev->lock);
+	return err;
+}
+
+/* what tw68_batch keeps of each entry besides the entry itself */
+struct tw68_batch_dev {
+	struct file		*file;
+	struct tw68_fh		*fh;
+	unsigned int		seq;		/* TW68_BATCH_SET */
+};
+
+/*
+ * For TW68_BATCH_SET, once the entries' buffers are queued: while every
+ * device has a frame done, drop those older than the newest of them,
+ * and dequeue them all once they are of the same frame.  Returns 0 with
+ * the set in the entries, or -EAGAIN if a device has no frame ready.
+ */
+static int tw68_batch_set(struct tw68_batch *b, struct tw68_batch_entry *e,
+			  struct tw68_batch_dev *d)
+{
+	unsigned int i, n, newest = 0;
+	int err, behind;
+
+	for (n = 0; n < VIDEO_MAX_FRAME; n++) {
+		behind = 0;
+		for (i = 0; i < b->count; i++) {
+			err = tw68_batch_peek(d[i].fh, &d[i].seq);
+			if (err) {
+				if (-EAGAIN != err)
+					e[i].result = err;
+				return err;
+			}
+			if (0 == i || (int)(d[i].seq - newest) > 0)
+				newest = d[i].seq;
+		}
+		for (i = 0; i < b->count; i++) {
+			if (d[i].seq == newest)
+				continue;
+			err = tw68_batch_drop(d[i].fh);
+			if (err) {
+				e[i].result = err;
+				return err;
+			}
+			b->dropped++;
+			behind = 1;
+		}
+		if (behind)
+			continue;
+		for (i = 0; i < b->count; i++) {
+			e[i].result = tw68_batch_dqbuf(d[i].fh, &e[i]);
+			if (e[i].flags & TW68_BATCH_DONE)
+				b->done++;
+		}
+		return 0;
+	}
+	return -EAGAIN;
+}
+
+/*
+ * The batch @b on its @e entries, already copied in; the caller copies
+ * them back.  b->count has been checked against TW68_BATCH_MAX.
+ */
+static long tw68_batch_run(struct tw68_fh *fh, struct tw68_batch *b,
+			   struct tw68_batch_entry *e)
+{
+	struct tw68_dev *dev = fh->dev;
+	struct tw68_batch_dev *d;
+	unsigned int i, j;
+
+	if (b->flags & ~TW68_BATCH_SET)
+		return -EINVAL;
+	b->done = 0;
+	b->dropped = 0;
+	if (0 == b->count)
+		return 0;
+	d = kcalloc(b->count, sizeof(*d), GFP_KERNEL);
+	if (NULL == d)
+		return -ENOMEM;
+	for (i = 0; i < b->count; i++) {
+		e[i].flags &= ~TW68_BATCH_DONE;
+		e[i].result = 0;
+		memset(&e[i].meta, 0, sizeof(e[i].meta));
+		d[i].file = fget(e[i].fd);
+		if (NULL == d[i].file) {
+			e[i].result = -EBADF;
+			continue;
+		}
+		d[i].fh = tw68_batch_fh(d[i].file);
+		if (NULL == d[i].fh) {
+			e[i].result = -EINVAL;
+			continue;
+		}
+		/* a set takes one frame of each device */
+		for (j = 0; j < i && (b->flags & TW68_BATCH_SET); j++)
+			if (d[j].fh && d[j].fh->dev == d[i].fh->dev)
+				e[i].result = -EINVAL;
+		if (0 == e[i].result)
+			e[i].result = tw68_batch_qbuf(d[i].fh, &e[i]);
+	}
+	if (!(b->flags & TW68_BATCH_SET)) {
+		for (i = 0; i < b->count; i++) {
+			if (e[i].result)
+				continue;
+			e[i].result = tw68_batch_dqbuf(d[i].fh, &e[i]);
+			if (e[i].flags & TW68_BATCH_DONE)
+				b->done++;
+		}
+	} else {
+		/* with an entry failed, there can't be a set */
+		for (i = 0; i < b->count; i++)
+			if (e[i].result)
+				break;
+		if (i == b->count)
+			tw68_batch_set(b, e, d);
+		for (i = 0; i < b->count; i++)
+			if (!(e[i].flags & TW68_BATCH_DONE))
+				memset(&e[i].buf, 0, sizeof(e[i].buf));
+	}
+	for (i = 0; i < b->count; i++)
+		if (d[i].file)
+			fput(d[i].file);
+	kfree(d);
+	dprintk(DBG_BUFF, "%s: %u of %u dequeued, %u dropped\n", __func__,
+		b->done, b->count, b->dropped);
+	return 0;
+}
+
+static long tw68_batch(struct tw68_fh *fh, struct tw68_batch *b)
+{
+	struct tw68_batch_entry __user *ue;
+	struct tw68_batch_entry *e;
+	long err;
+
+	if (b->count > TW68_BATCH_MAX)
+		return -EINVAL;
+	ue = (struct tw68_batch_entry __user *)(unsigned long)b->entries;
+	e = kmalloc(b->count * sizeof(*e), GFP_KERNEL);
+	if (NULL == e)
+		return -ENOMEM;
+	if (copy_from_user(e, ue, b->count * sizeof(*e))) {
+		err = -EFAULT;
+		goto free;
+	}
+	err = tw68_batch_run(fh, b, e);
+	if (0 == err && copy_to_user(ue, e, b->count * sizeof(*e)))
+		err = -EFAULT;
+free:
+	kfree(e);
+	return err;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,39)
+static long tw68_default(struct file *file, void *priv, int cmd, void *arg)
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
+static long tw68_default(struct file *file, void *priv, bool valid_prio,
+			 int cmd, void *arg)
+#else
+static long tw68_default(struct file *file, void *priv, bool valid_prio,
+			 unsigned int cmd, void *arg)
+#endif
+{
+	struct tw68_fh *fh = priv;
+	long err;
+
+	switch (cmd) {
+	case TW68_IOC_G_META:
+		if (mutex_lock_interruptible(&fh->dev->lock))
+			return -ERESTARTSYS;
+		err = tw68_g_meta(fh, arg);
+		mutex_unlock(&fh->dev->lock);
+		return err;
+	case TW68_IOC_BATCH:
+		return tw68_batch(fh, arg);
+	default:
+		return -ENOTTY;
+	}
 }
 
 static int tw68_streamon(struct file *file, void *priv,
@@ -1892,13 +2719,32 @@ static int tw68_streamon(struct file *file, void *priv,
 	struct tw68_fh *fh = priv;
 	struct tw68_dev *dev = fh->dev;
 	int res = tw68_resource(fh);
+	unsigned long flags;
+	int err;
 
 	dprintk(DBG_FLOW, "%s\n", __func__);
 	if (!res_get(fh, res))
 		return -EBUSY;
+	/* refuse a stream the PCI bus can't carry (see pci_budget) */
+	if (RESOURCE_VIDEO == res && res_bw(fh)) {
+		res_free(fh, res);
+		return -ENOSPC;
+	}
 
+	atomic_set(&fh->done_cnt, 0);
+	atomic_set(&fh->dq_cnt, 0);
+	/* sequence numbers start from 0 for each stream */
+	spin_lock_irqsave(&dev->slock, flags);
+	dev->video_fieldcount = 0;
+	memset(&dev->video_q.last_ts, 0, sizeof(dev->video_q.last_ts));
+	dev->meta_status = tw_readl(TW68_STATUS1) & 0xff;
+	tw68_fifo_start(dev);
 	tw68_buffer_requeue(dev, &dev->video_q);
-	return videobuf_streamon(tw68_queue(fh));
+	spin_unlock_irqrestore(&dev->slock, flags);
+	mutex_lock(&dev->lock);
+	err = videobuf_streamon(tw68_queue(fh));
+	mutex_unlock(&dev->lock);
+	return err;
 }
 
 static int tw68_streamoff(struct file *file, void *priv,
@@ -1910,9 +2756,18 @@ static int tw68_streamoff(struct file *file, void *priv,
 	int res = tw68_resource(fh);
 
 	dprintk(DBG_FLOW, "%s\n", __func__);
+	/* before the buffers go: no group member may start us on them */
+	if (RESOURCE_VIDEO == res && res_check(fh, res))
+		tw68_group_stop(dev);
+	mutex_lock(&dev->lock);
 	err = videobuf_streamoff(tw68_queue(fh));
+	mutex_unlock(&dev->lock);
 	if (err < 0)
 		return err;
+	atomic_set(&fh->done_cnt, 0);
+	atomic_set(&fh->dq_cnt, 0);
+	/* a blocking DQBUF finds the stream gone */
+	wake_up(&fh->done_wait);
 	res_free(fh, res);
 	return 0;
 }
@@ -2008,6 +2863,150 @@ static int vidioc_s_register(struct file *file, void *priv,
 }
 #endif
 
+#if defined(CONFIG_COMPAT) && LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0)
+/*
+ * The v4l2 compat layer converts the standard ioctls of 32-bit
+ * processes and hands us the private ones.  struct tw68_meta and
+ * struct tw68_batch have the same layout for them; the v4l2_buffer in
+ * a struct tw68_batch_entry hasn't, so the entries are converted here.
+ */
+struct tw68_v4l2_buffer32 {
+	__u32			index;
+	__u32			type;
+	__u32			bytesused;
+	__u32			flags;
+	__u32			field;
+	struct compat_timeval	timestamp;
+	struct v4l2_timecode	timecode;
+	__u32			sequence;
+	__u32			memory;
+	union {
+		__u32		offset;
+		compat_long_t	userptr;
+	} m;
+	__u32			length;
+	__u32			reserved2;
+	__u32			reserved;
+};
+
+struct tw68_batch_entry32 {
+	__s32			fd;
+	__u32			flags;
+	__s32			result;
+	__u32			reserved;
+	struct tw68_v4l2_buffer32 buf;
+	struct tw68_meta	meta;
+};
+
+static void tw68_batch_from32(struct tw68_batch_entry *e,
+			      const struct tw68_batch_entry32 *e32)
+{
+	const struct tw68_v4l2_buffer32 *b32 = &e32->buf;
+	struct v4l2_buffer *b = &e->buf;
+
+	memset(e, 0, sizeof(*e));
+	e->fd = e32->fd;
+	e->flags = e32->flags;
+	b->index = b32->index;
+	b->type = b32->type;
+	b->bytesused = b32->bytesused;
+	b->flags = b32->flags;
+	b->field = b32->field;
+	b->timestamp.tv_sec = b32->timestamp.tv_sec;
+	b->timestamp.tv_usec = b32->timestamp.tv_usec;
+	b->timecode = b32->timecode;
+	b->sequence = b32->sequence;
+	b->memory = b32->memory;
+	if (V4L2_MEMORY_USERPTR == b32->memory)
+		b->m.userptr = (unsigned long)compat_ptr(b32->m.userptr);
+	else
+		b->m.offset = b32->m.offset;
+	b->length = b32->length;
+}
+
+static void tw68_batch_to32(struct tw68_batch_entry32 *e32,
+			    const struct tw68_batch_entry *e)
+{
+	struct tw68_v4l2_buffer32 *b32 = &e32->buf;
+	const struct v4l2_buffer *b = &e->buf;
+
+	e32->flags = e->flags;
+	e32->result = e->result;
+	memset(b32, 0, sizeof(*b32));
+	b32->index = b->index;
+	b32->type = b->type;
+	b32->bytesused = b->bytesused;
+	b32->flags = b->flags;
+	b32->field = b->field;
+	b32->timestamp.tv_sec = b->timestamp.tv_sec;
+	b32->timestamp.tv_usec = b->timestamp.tv_usec;
+	b32->timecode = b->timecode;
+	b32->sequence = b->sequence;
+	b32->memory = b->memory;
+	if (V4L2_MEMORY_USERPTR == b->memory)
+		b32->m.userptr = (compat_long_t)b->m.userptr;
+	else
+		b32->m.offset = b->m.offset;
+	b32->length = b->length;
+	e32->meta = e->meta;
+}
+
+static long tw68_compat_batch(struct tw68_fh *fh,
+			      struct tw68_batch __user *ub)
+{
+	struct tw68_batch_entry32 __user *ue;
+	struct tw68_batch_entry32 *e32;
+	struct tw68_batch_entry *e;
+	struct tw68_batch b;
+	unsigned int i;
+	long err;
+
+	if (copy_from_user(&b, ub, sizeof(b)))
+		return -EFAULT;
+	if (b.count > TW68_BATCH_MAX)
+		return -EINVAL;
+	ue = compat_ptr((compat_uptr_t)b.entries);
+	e32 = kmalloc(b.count * sizeof(*e32), GFP_KERNEL);
+	e = kmalloc(b.count * sizeof(*e), GFP_KERNEL);
+	if (NULL == e32 || NULL == e) {
+		err = -ENOMEM;
+		goto free;
+	}
+	if (copy_from_user(e32, ue, b.count * sizeof(*e32))) {
+		err = -EFAULT;
+		goto free;
+	}
+	for (i = 0; i < b.count; i++)
+		tw68_batch_from32(&e[i], &e32[i]);
+	err = tw68_batch_run(fh, &b, e);
+	if (err)
+		goto free;
+	for (i = 0; i < b.count; i++)
+		tw68_batch_to32(&e32[i], &e[i]);
+	if (copy_to_user(ue, e32, b.count * sizeof(*e32)) ||
+	    copy_to_user(ub, &b, sizeof(b)))
+		err = -EFAULT;
+free:
+	kfree(e);
+	kfree(e32);
+	return err;
+}
+
+static long video_compat_ioctl32(struct file *file, unsigned int cmd,
+				 unsigned long arg)
+{
+	switch (cmd) {
+	case TW68_IOC_G_META:
+		return video_ioctl2(file, cmd,
+				    (unsigned long)compat_ptr(arg));
+	case TW68_IOC_BATCH:
+		return tw68_compat_batch(file->private_data, compat_ptr(arg));
+	default:
+		return -ENOIOCTLCMD;
+	}
+}
+#endif
+
 static const struct v4l2_file_operations video_fops = {
 	.owner			= THIS_MODULE,
 	.open			= video_open,
@@ -2016,6 +3015,9 @@ static const struct v4l2_file_operations video_fops = {
 	.poll			= video_poll,
 	.mmap			= video_mmap,
 	.ioctl			= video_ioctl2,
+#if defined(CONFIG_COMPAT) && LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0)
+	.compat_ioctl32		= video_compat_ioctl32,
+#endif
 };
 
 static const struct v4l2_ioctl_ops video_ioctl_ops = {
@@ -2031,6 +3033,7 @@ static const struct v4l2_ioctl_ops video_ioctl_ops = {
 	.vidioc_g_input			= tw68_g_input,
 	.vidioc_s_input			= tw68_s_input,
 	.vidioc_queryctrl		= tw68_queryctrl,
+	.vidioc_querymenu		= tw68_querymenu,
 	.vidioc_g_ctrl			= tw68_g_ctrl,
 	.vidioc_s_ctrl			= tw68_s_ctrl,
 	.vidioc_streamon		= tw68_streamon,
@@ -2040,9 +3043,11 @@ static const struct v4l2_ioctl_ops video_ioctl_ops = {
 	.vidioc_g_fmt_vid_cap		= tw68_g_fmt_vid_cap,
 	.vidioc_try_fmt_vid_cap		= tw68_try_fmt_vid_cap,
 	.vidioc_s_fmt_vid_cap		= tw68_s_fmt_vid_cap,
+	.vidioc_enum_framesizes		= tw68_enum_framesizes,
 	.vidioc_cropcap			= tw68_cropcap,
 	.vidioc_g_crop			= tw68_g_crop,
 	.vidioc_s_crop			= tw68_s_crop,
+	.vidioc_default			= tw68_default,
 /*
  * Functions not yet implemented / not yet passing tests.
  */
@@ -2117,6 +3122,8 @@ int tw68_video_init1(struct tw68_dev *dev)
 #endif
 	INIT_LIST_HEAD(&dev->video_q.queued);
 	INIT_LIST_HEAD(&dev->video_q.active);
+	INIT_LIST_HEAD(&dev->risc_bufs);
+	init_waitqueue_head(&dev->video_q.tap_wait);
 	init_timer(&dev->video_q.timeout);
 	dev->video_q.timeout.function	= tw68_buffer_timeout;
 	dev->video_q.timeout.data	= (unsigned long)(&dev->video_q);
@@ -2124,6 +3131,8 @@ int tw68_video_init1(struct tw68_dev *dev)
 	dev->video_q.buf_compat		= tw68_check_video_fmt;
 	dev->video_q.start_dma		= tw68_video_start_dma;
 	tw68_risc_stopper(dev->pci, &dev->video_q.stopper);
+	btcx_riscmem_alloc(dev->pci, &dev->scan_risc,
+			   (TW68_SCAN_SETTLE_MAX + 1) * 8);
 
 	if (tw68_boards[dev->board].video_out)
 		tw68_videoport_init(dev);
@@ -2160,46 +3169,27 @@ void tw68_irq_video_signalchange(struct tw68_dev *dev)
  */
 void tw68_irq_video_done(struct tw68_dev *dev, unsigned long status)
 {
-	__u32 reg;
+	__u32 reg, events = 0;
 
+	dev->irq_time = ktime_get();
 	/* reset interrupts handled by this routine */
 	tw_writel(TW68_INTSTAT, status);
 	/*
-	 * Check most likely first
-	 *
-	 * DMAPI shows we have reached the end of the risc code
-	 * for the current buffer.
+	 * Errors first: when they come in the same interrupt as DMAPI,
+	 * they happened while the buffer completing now was filled, and
+	 * go to its meta rather than the next one's.
 	 */
-	if (status & TW68_DMAPI) {
-		struct tw68_dmaqueue *q = &dev->video_q;
-		dprintk(DBG_FLOW | DBG_TESTING, "DMAPI interrupt\n");
-		spin_lock(&dev->slock);
-		/*
-		 * tw68_wakeup will take care of the buffer handling,
-		 * plus any non-video requirements.
-		 */
-		tw68_wakeup(q, &dev->video_fieldcount);
-		spin_unlock(&dev->slock);
-		/* Check whether we have gotten into 'stopper' code */
-		reg = tw_readl(TW68_DMAP_PP);
-		if ((reg >= q->stopper.dma) &&
-		    (reg < q->stopper.dma + q->stopper.size)) {
-			/* Yes - log the information */
-			dprintk(DBG_FLOW | DBG_TESTING,
-				"%s: stopper risc code entered\n", __func__);
-		}
-		status &= ~(TW68_DMAPI);
-		if (0 == status)
-			return;
-	}
 	if (status & (TW68_VLOCK | TW68_HLOCK)) { /* lost sync */
 		dprintk(DBG_UNUSUAL, "Lost sync\n");
+		events |= TW68_META_SYNC;
 	}
 	if (status & TW68_PABORT) {	/* TODO - what should we do? */
 		dprintk(DBG_UNEXPECTED, "PABORT interrupt\n");
+		events |= TW68_META_DMAERR;
 	}
 	if (status & TW68_DMAPERR) {
 		dprintk(DBG_UNEXPECTED, "DMAPERR interrupt\n");
+		events |= TW68_META_DMAERR;
 #if 0
 		/* Stop risc & fifo */
 		tw_clearl(TW68_DMAC, TW68_DMAP_EN | TW68_FIFO_EN);
@@ -2223,8 +3213,47 @@ void tw68_irq_video_done(struct tw68_dev *dev, unsigned long status)
 		tw_clearl(TW68_DMAC, TW68_FIFO_EN);
 		dprintk(DBG_UNUSUAL, "FFOF interrupt\n");
 		tw_setl(TW68_DMAC, reg);
+		events |= TW68_META_FIFO;
 	}
-	if (status & TW68_FFERR)
+	if (status & TW68_FFERR) {
 		dprintk(DBG_UNEXPECTED, "FFERR interrupt\n");
+		events |= TW68_META_FIFO;
+	}
+	if (events) {
+		/* for the meta of the buffer being filled */
+		spin_lock(&dev->slock);
+		dev->meta_flags |= events;
+		if (status & (TW68_FFOF | TW68_FFERR))
+			tw68_fifo_event(dev, status);
+		spin_unlock(&dev->slock);
+	}
+	/*
+	 * DMAPI shows we have reached the end of the risc code
+	 * for the current buffer.
+	 */
+	if (status & TW68_DMAPI) {
+		struct tw68_dmaqueue *q = &dev->video_q;
+		dprintk(DBG_FLOW | DBG_TESTING, "DMAPI interrupt\n");
+		spin_lock(&dev->slock);
+		/*
+		 * tw68_wakeup will take care of the buffer handling,
+		 * plus any non-video requirements.
+		 */
+		tw68_wakeup(q, &dev->video_fieldcount);
+		if (dev->crop_dirty)
+			tw68_commit_crop(dev, q);
+		spin_unlock(&dev->slock);
+		/* Check whether we have gotten into 'stopper' code */
+		reg = tw_readl(TW68_DMAP_PP);
+		if ((reg >= q->stopper.dma) &&
+		    (reg < q->stopper.dma + q->stopper.size)) {
+			/* Yes - log the information */
+			dprintk(DBG_FLOW | DBG_TESTING,
+				"%s: stopper risc code entered\n", __func__);
+			spin_lock(&dev->slock);
+			dev->meta_flags |= TW68_META_STOPPER;
+			spin_unlock(&dev->slock);
+		}
+	}
 	return;
 }
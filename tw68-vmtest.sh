@@ -0,0 +1,114 @@
+#!/bin/sh
+#
+# tw68-vmtest.sh - run the driver against the chip model in a VM
+#
+# Copyright (C) 2026  agent <agent@local>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+#   tw68-vmtest.sh qemu <qemu source tree>
+#	Add the tw68 device (tw68-qemu.c and the model) to a QEMU 8.x
+#	tree and build its qemu-system-x86_64.
+#
+#   tw68-vmtest.sh run
+#	Build tw68.ko against $KDIR and a static videotest, pack them
+#	with $BUSYBOX (a static busybox) into an initramfs, and boot
+#	$KERNEL on $QEMU with a tw68 device.  The guest loads the
+#	module, runs videotest on /dev/video0 and powers off; the
+#	result is PASS or FAIL, and the console log is kept in
+#	vmtest/console.log.  $KERNEL must have V4L2, videobuf-dma-sg
+#	and btcx-risc built in, and be the kernel $KDIR was built for.
+#
+# Environment: QEMU, KERNEL, KDIR, BUSYBOX as above; FRAMES, the
+# frames videotest measures [300]; TW68DEV, the device as given to
+# -device [tw68], e.g. tw68,norm50=on,fifo-stall=50; QEMUFLAGS, added
+# to the qemu command line.
+#
+set -e
+
+here=$(cd "$(dirname "$0")" && pwd)
+work=$here/vmtest
+
+die()
+{
+	echo "tw68-vmtest: $*" >&2
+	exit 1
+}
+
+add_to_qemu()
+{
+	q=$1
+	[ -f "$q/hw/misc/meson.build" ] || die "$q is not a QEMU tree"
+	cp "$here/tw68-qemu.c" "$q/hw/misc/tw68.c"
+	cp "$here/tw68-sim.c" "$here/tw68-sim.h" "$here/tw68-reg.h" \
+	   "$q/hw/misc/"
+	grep -q CONFIG_TW68 "$q/hw/misc/meson.build" ||
+		echo "system_ss.add(when: 'CONFIG_TW68'," \
+		     "if_true: files('tw68.c', 'tw68-sim.c'))" \
+		     >> "$q/hw/misc/meson.build"
+	grep -q "^config TW68" "$q/hw/misc/Kconfig" ||
+		printf '\nconfig TW68\n    bool\n    default y if PCI_DEVICES\n    depends on PCI\n' \
+		       >> "$q/hw/misc/Kconfig"
+	(cd "$q" && ./configure --target-list=x86_64-softmmu &&
+	 make -j"$(nproc)")
+	echo "tw68-vmtest: QEMU=$q/build/qemu-system-x86_64"
+}
+
+run_vm()
+{
+	: "${QEMU:?set QEMU to a qemu-system-x86_64 with the tw68 device}"
+	: "${KERNEL:?set KERNEL to the guest kernel image}"
+	: "${KDIR:?set KDIR to the build tree of that kernel}"
+	: "${BUSYBOX:?set BUSYBOX to a static busybox binary}"
+	frames=${FRAMES:-300}
+
+	make -C "$here" KDIR="$KDIR" all
+	rm -rf "$work"
+	mkdir -p "$work/root/bin" "$work/root/proc" "$work/root/sys" \
+		 "$work/root/dev"
+	${CC:-cc} -O2 -Wall -static -o "$work/root/bin/videotest" \
+		"$here/videotest.c" "$here/vcap.c" -lm
+	cp "$BUSYBOX" "$work/root/bin/busybox"
+	cp "$here/tw68.ko" "$work/root/"
+	cat > "$work/root/init" <<EOF
+#!/bin/busybox sh
+/bin/busybox --install -s /bin
+mount -t proc proc /proc
+mount -t sysfs sys /sys
+mount -t devtmpfs dev /dev
+insmod /tw68.ko || echo "tw68-vmtest: FAIL (insmod)"
+sleep 1
+if videotest -d /dev/video0 -n $frames; then
+	echo "tw68-vmtest: PASS"
+else
+	echo "tw68-vmtest: FAIL (videotest)"
+fi
+dmesg | grep tw68
+poweroff -f
+EOF
+	chmod +x "$work/root/init"
+	(cd "$work/root" && find . | cpio -o -H newc --quiet | gzip) \
+		> "$work/initrd.gz"
+
+	"$QEMU" -nographic -no-reboot -m 512 \
+		-kernel "$KERNEL" -initrd "$work/initrd.gz" \
+		-append "console=ttyS0 panic=-1 quiet" \
+		-device "${TW68DEV:-tw68}" $QEMUFLAGS | tee "$work/console.log"
+	grep -q "tw68-vmtest: PASS" "$work/console.log"
+}
+
+case "$1" in
+qemu)
+	[ -n "$2" ] || die "usage: $0 qemu <qemu source tree>"
+	add_to_qemu "$2"
+	;;
+run)
+	run_vm
+	;;
+*)
+	die "usage: $0 qemu <qemu source tree> | run"
+	;;
+esac
@@ -30,6 +30,7 @@
 #define	TW68_VERSION_CODE	KERNEL_VERSION(0, 0, 8)
 
 #include <linux/pci.h>
+#include <linux/interrupt.h>
 #include <linux/i2c.h>
 #include <linux/i2c-algo-bit.h>
 #include <linux/videodev2.h>
@@ -54,6 +55,7 @@
 
 #include "btcx-risc.h"
 #include "tw68-reg.h"
+#include "tw68-ioctl.h"
 
 #define	UNSET	(-1U)
 
@@ -93,6 +95,12 @@
 	V4L2_STD_525_60 | V4L2_STD_625_50    | \
 	V4L2_STD_SECAM_L| V4L2_STD_SECAM_LC  | V4L2_STD_SECAM_DK)
 
+/* private controls */
+#define	V4L2_CID_PRIVATE_PRESET	(V4L2_CID_PRIVATE_BASE + 0)	/* menu */
+#define	V4L2_CID_PRIVATE_SCAN	(V4L2_CID_PRIVATE_BASE + 1)	/* inputs */
+#define	V4L2_CID_PRIVATE_SCAN_SETTLE (V4L2_CID_PRIVATE_BASE + 2)
+#define	V4L2_CID_PRIVATE_LASTP1	(V4L2_CID_PRIVATE_BASE + 3)
+
 #define	TW68_VID_INTS	(TW68_FFERR | TW68_PABORT | TW68_DMAPERR | \
 			 TW68_FFOF   | TW68_DMAPI)
 /* TW6800 chips have trouble with these, so we don't set them for that chip */
@@ -154,6 +162,16 @@ struct tw68_format {
 
 #define	TW68_MAXBOARDS			16
 #define	TW68_INPUT_MAX			8
+#define	TW68_SCAN_SETTLE_MAX		8	/* fields */
+#define	TW68_WAKEUP_SETTLE		200	/* msecs for lock after sleep */
+
+/* DMA FIFO request level, DMAC bits 15:8 (see tw68_fifo_event) */
+#define	TW68_FIFO_LEVEL_SHIFT		8
+#define	TW68_FIFO_LEVEL_MASK		(0xff << TW68_FIFO_LEVEL_SHIFT)
+#define	TW68_FIFO_LEVEL_MIN		0x04
+#define	TW68_FIFO_LEVEL_STEP		0x02
+#define	TW68_FIFO_HOLD			10	/* secs quiet before raising */
+#define	TW68_FIFO_HOLD_MAX		640
 
 /* ----------------------------------------------------------- */
 /* enums						       */
@@ -226,6 +244,9 @@ struct tw68_board {
 
 #define	BUFFER_TIMEOUT	msecs_to_jiffies(500)	/* 0.5 seconds */
 
+/* size of the register shadow saved over suspend (see tw68-core.c) */
+#define	TW68_SHADOW_REGS		64
+
 struct tw68_dev;	/* forward delclaration */
 
 /* tvaudio thread status */
@@ -248,9 +269,29 @@ struct tw68_buf {
 	unsigned int		top_seen;
 	int (*activate)(struct tw68_dev *dev,
 			struct tw68_buf *buf,
-			struct tw68_buf *next);
+			struct tw68_buf *prev);
 	struct btcx_riscmem	risc;
-	unsigned int		bpl;
+	unsigned int		bpl;		/* bytesperline, with padding */
+	struct v4l2_rect	crop;		/* in effect while filled */
+	/* field order the buffer was prepared for; with ALTERNATE,
+	 * vb.field tells which field it was filled with */
+	enum v4l2_field		field;
+
+	/* owning file handle, for completion counting (may be NULL) */
+	struct tw68_fh		*fh;
+
+	/* pinned userptr region, see tw68-userptr.c */
+	struct tw68_upin	*upin;
+
+	/* queue the buffer was last given to */
+	struct tw68_dmaqueue	*dmaq;
+
+	/* on dev->risc_bufs while it has a program, for debugfs */
+	struct list_head	risc_list;
+	unsigned int		risc_listed;
+	/* TW68_IOC_G_META, filled in as the buffer is started and done */
+	struct tw68_meta	meta;
+	ktime_t			done_time;	/* its DMAPI interrupt */
 };
 
 struct tw68_dmaqueue {
@@ -259,6 +300,17 @@ struct tw68_dmaqueue {
 	struct list_head	queued;
 	struct timer_list	timeout;
 	struct btcx_riscmem	stopper;
+
+	/* most recently completed buffer, shared with "tap" readers */
+	struct tw68_buf		*last;
+	unsigned int		done_seq;
+	wait_queue_head_t	tap_wait;
+	/* per buffer index, bumped as it is queued or freed (slock) */
+	unsigned int		tap_gen[VIDEO_MAX_FRAME];
+
+	/* time of the last completion, to spot frames missed since */
+	struct timeval		last_ts;
+
 	int (*buf_compat)(struct tw68_buf *prev,
 			  struct tw68_buf *buf);
 	int (*start_dma)(struct tw68_dev *dev,
@@ -277,10 +329,32 @@ struct tw68_fh {
 	/* video capture */
 	struct tw68_format	*fmt;
 	unsigned int		width, height;
+	unsigned int		bytesperline;
 	struct videobuf_queue	cap;	/* also used for overlay */
 
 	/* vbi capture */
 	struct videobuf_queue	vbi;
+
+	/* streaming completions and dequeues, compared by video_poll */
+	atomic_t		done_cnt;
+	atomic_t		dq_cnt;
+	wait_queue_head_t	done_wait;
+
+	/* read() or mmap of a stream owned by another file handle */
+	unsigned int		tap_seq;	/* last completion taken */
+	unsigned int		tap_frames;
+	unsigned int		tap_dropped;
+	struct tw68_meta	tap_meta;	/* of the last frame taken */
+
+	/* a read() capture holds the decoder up, see tw68_power_get */
+	unsigned int		read_power;
+
+	/* PCI bandwidth its capture holds, see tw68_bw_reserve */
+	unsigned int		bw_kbps;
+	struct list_head	bw_list;	/* on dev->bw_fhs meanwhile */
+
+	/* userptr regions kept pinned between uses */
+	struct tw68_upin_cache	*upin;
 };
 
 /* dmasound dsp status */
@@ -359,6 +433,7 @@ struct tw68_dev {
 	/* various device info */
 	TW68_DECODER_TYPE	vdecoder;
 	unsigned int		resources;
+	struct tw68_fh		*video_owner;	/* has RESOURCE_VIDEO */
 	struct video_device	*video_dev;
 	struct video_device	*radio_dev;
 	struct video_device	*vbi_dev;
@@ -406,6 +481,27 @@ struct tw68_dev {
 	struct tw68_dmaqueue	vbi_q;
 	unsigned int		video_fieldcount;
 	unsigned int		vbi_fieldcount;
+	/* for the next buffer's meta: TW68_META_* flags since the last
+	 * completion, and when the interrupt completing it came in */
+	u32			meta_flags;
+	ktime_t			irq_time;
+	u32			meta_status;	/* STATUS1 at the last one */
+
+	/* PCI bandwidth held by its file handles, see tw68_bw_reserve */
+	unsigned int		bw_kbps;
+	struct list_head	bw_fhs;
+
+	/* DMA FIFO level tuning, see tw68_fifo_event (under slock) */
+	unsigned int		fifo_level;	/* in use */
+	unsigned int		fifo_ffof;	/* FFOF interrupts */
+	unsigned int		fifo_fferr;	/* FFERR interrupts */
+	unsigned int		fifo_lowered;
+	unsigned int		fifo_raised;
+	unsigned int		fifo_events;	/* this second */
+	unsigned int		fifo_quiet;	/* seconds without any */
+	unsigned int		fifo_hold;	/* quiet seconds to raise */
+	unsigned int		fifo_trial;	/* this second follows a raise */
+	unsigned long		fifo_second;	/* jiffies, end of this one */
 
 	/* various v4l controls */
 	struct tw68_tvnorm	*tvnorm;	/* video */
@@ -430,6 +526,10 @@ struct tw68_dev {
 	struct v4l2_rect	crop_bounds;
 	struct v4l2_rect	crop_defrect;
 	struct v4l2_rect	crop_current;
+	/* crop last written to the scaler; while streaming, a new
+	 * crop_current is committed between frames (both under slock) */
+	struct v4l2_rect	crop_hw;
+	unsigned int		crop_dirty;
 
 	/* other global state info */
 	unsigned int		automute;
@@ -437,10 +537,20 @@ struct tw68_dev {
 	/* input is latest requested by app, hw_input is current hw setting */
 	struct tw68_input	*input;
 	struct tw68_input	*hw_input;
+	/* round robin capture: bit n set for card_in(dev, n); each buffer
+	 * starts on the next input, after scan_settle skipped fields */
+	unsigned int		scan_mask;
+	unsigned int		scan_settle;
+	struct btcx_riscmem	scan_risc;
 	unsigned int		hw_mute;
 	int			last_carrier;
 	int			nosignal;
 	unsigned int		insuspend;
+	struct mutex		power_lock;	/* for users and asleep */
+	unsigned int		users;		/* captures under way */
+	unsigned int		asleep;		/* decoder powered down */
+	u8			acntl;		/* ACNTL before power down */
+	u32			reg_shadow[TW68_SHADOW_REGS];
 
 	/* TW68_MPEG_* */
 	struct tw68_ts		ts;
@@ -449,6 +559,22 @@ struct tw68_dev {
 	unsigned int 		buff_cnt;
 	struct tw68_mpeg_ops	*mops;
 
+	/* <debugfs>/tw68/<name>, see tw68-debugfs.c */
+	struct dentry		*debugfs;
+	/* the video buffers having a RISC program (under slock) */
+	struct list_head	risc_bufs;
+
+	/* capture group, see tw68-group.c (under the group's lock) */
+	struct tw68_group	*group;
+	struct list_head	group_list;
+	unsigned int		group_pending;	/* waiting for the others */
+	unsigned int		group_running;
+	unsigned int		group_go;	/* owed the group's start */
+	struct tasklet_struct	group_tasklet;	/* which then does it */
+	u32			group_dmac;	/* starts the loaded program */
+	unsigned int		group_base;	/* group frame it started at */
+	unsigned int		group_fc0;	/* video_fieldcount then */
+
 	void (*gate_ctrl)(struct tw68_dev *dev, int open);
 };
 
@@ -496,13 +622,29 @@ extern struct mutex tw68_devlist_lock;
 extern unsigned int irq_debug;
 
 int tw68_buffer_count(unsigned int size, unsigned int count);
+unsigned int tw68_bw_demand(struct tw68_dev *dev, struct tw68_format *fmt,
+			    unsigned int width, unsigned int height,
+			    enum v4l2_field field);
+int tw68_bw_reserve(struct tw68_fh *fh, unsigned int kbps);
+void tw68_bw_release(struct tw68_fh *fh);
+int tw68_bw_renorm(struct tw68_dev *dev, struct tw68_tvnorm *norm);
 void tw68_buffer_queue(struct tw68_dev *dev, struct tw68_dmaqueue *q,
 		      struct tw68_buf *buf);
 void tw68_buffer_timeout(unsigned long data);
 int tw68_set_dmabits(struct tw68_dev *dev);
 void tw68_dma_free(struct videobuf_queue *q, struct tw68_buf *buf);
+void tw68_buf_track(struct tw68_dev *dev, struct tw68_buf *buf);
+void tw68_buf_untrack(struct tw68_dev *dev, struct tw68_buf *buf);
 void tw68_wakeup(struct tw68_dmaqueue *q, unsigned int *field_count);
+void tw68_fifo_event(struct tw68_dev *dev, u32 status);
+void tw68_fifo_start(struct tw68_dev *dev);
 int tw68_buffer_requeue(struct tw68_dev *dev, struct tw68_dmaqueue *q);
+int tw68_tap_fmt_ok(struct tw68_fh *fh, struct tw68_buf *buf);
+void tw68_tap_count(struct tw68_fh *fh, unsigned int done);
+ssize_t tw68_tap_read(struct tw68_fh *fh, char __user *data, size_t count,
+		      int nonblocking);
+void tw68_power_get(struct tw68_dev *dev);
+void tw68_power_put(struct tw68_dev *dev);
 
 /* ----------------------------------------------------------- */
 /* tw68-cards.c                                                */
@@ -536,6 +678,7 @@ int tw68_video_init1(struct tw68_dev *dev);
 int tw68_video_init2(struct tw68_dev *dev);
 void tw68_irq_video_signalchange(struct tw68_dev *dev);
 void tw68_irq_video_done(struct tw68_dev *dev, unsigned long status);
+void tw68_video_go(struct tw68_dev *dev, u32 dmac);
 
 /* ----------------------------------------------------------- */
 /* tw68-ts.c                                                   */
@@ -583,6 +726,71 @@ int tw68_risc_buffer(struct pci_dev *pci, struct btcx_riscmem *risc,
 	struct scatterlist *sglist, unsigned int top_offset,
 	unsigned int bottom_offset, unsigned int bpl,
 	unsigned int padding, unsigned int lines);
+int tw68_risc_frame(struct pci_dev *pci, struct btcx_riscmem *risc,
+	struct scatterlist *sglist, enum v4l2_field field,
+	unsigned int bpl, unsigned int stride, unsigned int height);
 int tw68_risc_stopper(struct pci_dev *pci, struct btcx_riscmem *risc);
+void tw68_risc_skip(struct btcx_riscmem *risc, unsigned int fields,
+	u32 sync, u32 next);
+int tw68_risc_decode(char *buf, size_t len, u32 risc, u32 addr);
+void tw68_risc_program_dump(struct tw68_dev *dev,
+			    struct btcx_riscmem *risc);
 int tw68_risc_overlay(struct tw68_fh *fh, struct btcx_riscmem *risc,
 		      int field_type);
+
+/* ----------------------------------------------------------- */
+/* tw68-userptr.c                                              */
+
+#ifdef CONFIG_MMU_NOTIFIER
+int tw68_userptr_get(struct tw68_fh *fh, struct tw68_buf *buf,
+		     unsigned int *seq);
+void tw68_userptr_pinned(struct tw68_fh *fh, struct tw68_buf *buf,
+			 unsigned int seq);
+int tw68_userptr_stale(struct tw68_buf *buf);
+int tw68_userptr_put(struct tw68_fh *fh, struct tw68_buf *buf);
+void tw68_userptr_fini(struct tw68_fh *fh);
+#else
+static inline int tw68_userptr_get(struct tw68_fh *fh, struct tw68_buf *buf,
+				   unsigned int *seq) { return 0; }
+static inline void tw68_userptr_pinned(struct tw68_fh *fh,
+				       struct tw68_buf *buf,
+				       unsigned int seq) {}
+static inline int tw68_userptr_stale(struct tw68_buf *buf) { return 0; }
+static inline int tw68_userptr_put(struct tw68_fh *fh,
+				   struct tw68_buf *buf) { return 0; }
+static inline void tw68_userptr_fini(struct tw68_fh *fh) {}
+#endif
+
+/* ----------------------------------------------------------- */
+/* tw68-group.c                                                */
+
+void tw68_group_join(struct tw68_dev *dev, unsigned int id);
+void tw68_group_leave(struct tw68_dev *dev);
+int tw68_group_start(struct tw68_dev *dev, u32 dmac);
+int tw68_group_expire(struct tw68_dev *dev);
+void tw68_group_stop(struct tw68_dev *dev);
+void tw68_group_stamp(struct tw68_dev *dev, struct tw68_buf *buf);
+
+/* what debugfs shows of a device's group */
+struct tw68_group_state {
+	unsigned int		id, members, pending, running;
+	unsigned int		seq;		/* group's next frame */
+	unsigned int		base;		/* device's first frame */
+	const char		*state;		/* of the device */
+};
+int tw68_group_state(struct tw68_dev *dev, struct tw68_group_state *st);
+
+/* ----------------------------------------------------------- */
+/* tw68-debugfs.c                                              */
+
+#ifdef CONFIG_DEBUG_FS
+void tw68_debugfs_init(void);
+void tw68_debugfs_fini(void);
+void tw68_debugfs_dev_init(struct tw68_dev *dev);
+void tw68_debugfs_dev_fini(struct tw68_dev *dev);
+#else
+static inline void tw68_debugfs_init(void) {}
+static inline void tw68_debugfs_fini(void) {}
+static inline void tw68_debugfs_dev_init(struct tw68_dev *dev) {}
+static inline void tw68_debugfs_dev_fini(struct tw68_dev *dev) {}
+#endif
@@ -0,0 +1,575 @@
+/*
+* vcap - V4L2 capture channel helpers shared by videotest and multicap
+*
+* This program can be used and distributed without restrictions.
+*
+* Taken from the V4L2 video capture example (videotest.c), with the
+* global state moved into struct vcap so that several channels can be
+* captured at once.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>		/* low-level i/o */
+#include <unistd.h>
+#include <errno.h>
+#include <malloc.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include "vcap.h"
+#include "tw68-ioctl.h"
+#define CLEAR(x) memset (&(x), 0, sizeof (x))
+const char *vcap_io_name[] = { "read", "mmap", "userptr" };
+static void errno_exit(const char *s)
+{
+    fprintf(stderr, "%s error %d, %s\n", s, errno, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+static int xioctl(int fd, int request, void *arg)
+{
+    int r;
+    do
+	r = ioctl(fd, request, arg);
+    while (-1 == r && EINTR == errno);
+    return r;
+}
+
+double vcap_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double now_real(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void vcap_stat_add(struct vcap_stat *s, double v)
+{
+    if (0 == s->n || v < s->min)
+	s->min = v;
+    if (0 == s->n || v > s->max)
+	s->max = v;
+    s->n++;
+    s->sum += v;
+    s->sumsq += v * v;
+}
+
+double vcap_stat_mean(const struct vcap_stat *s)
+{
+    return s->n ? s->sum / s->n : 0;
+}
+
+double vcap_stat_stddev(const struct vcap_stat *s)
+{
+    double m, var;
+    if (s->n < 2)
+	return 0;
+    m = vcap_stat_mean(s);
+    var = s->sumsq / s->n - m * m;
+    return var > 0 ? sqrt(var) : 0;
+}
+
+/*
+ * Account for one frame.  @buf is NULL for read(), which gives neither
+ * a sequence number nor a timestamp.
+ */
+static void process_frame(struct vcap *c, const struct v4l2_buffer *buf)
+{
+    double dq = vcap_now(), ts, now;
+    c->frames++;
+    c->bytes += buf ? buf->bytesused : c->fmt.fmt.pix.sizeimage;
+    if (c->cfg->verbose) {
+	fputc('.', stdout);
+	fflush(stdout);
+    }
+    /* let the stream settle before measuring anything */
+    if (c->frames <= c->cfg->warmup) {
+	c->first_dq = dq;
+	c->last_dq = dq;
+	c->last_seq = buf ? (long) buf->sequence : -1;
+	return;
+    }
+    vcap_stat_add(&c->interval, (dq - c->last_dq) * 1000);
+    c->last_dq = dq;
+    if (!buf)
+	return;
+    if (buf->flags & V4L2_BUF_FLAG_ERROR)
+	c->errors++;
+    if (c->last_seq >= 0 && (long) buf->sequence > c->last_seq + 1)
+	c->dropped += buf->sequence - c->last_seq - 1;
+    c->last_seq = buf->sequence;
+    /* the driver stamps buffers with either clock */
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+    if ((buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+	V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+	now = dq;
+    else
+#endif
+	now = now_real();
+    ts = buf->timestamp.tv_sec + buf->timestamp.tv_usec / 1e6;
+    vcap_stat_add(&c->latency, (now - ts) * 1000);
+}
+
+int vcap_read_frame(struct vcap *c)
+{
+    struct v4l2_buffer buf;
+    unsigned int i;
+    switch (c->cfg->io) {
+	case IO_METHOD_READ:
+	    if (-1 == read(c->fd, c->buffers[0].start,
+			   c->buffers[0].length)) {
+		switch (errno) {
+		    case EAGAIN:
+			return 0;
+		    case EIO:
+/* Could ignore EIO, see spec. */
+/* fall through */
+		    default:
+			errno_exit("read");
+		}
+	    }
+	    process_frame(c, NULL);
+	    break;
+	case IO_METHOD_MMAP:
+	    CLEAR(buf);
+	    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	    buf.memory = V4L2_MEMORY_MMAP;
+	    if (-1 == xioctl(c->fd, VIDIOC_DQBUF, &buf)) {
+		switch (errno) {
+		    case EAGAIN:
+			return 0;
+		    case EIO:
+/* Could ignore EIO, see spec. */
+/* fall through */
+		    default:
+			errno_exit("VIDIOC_DQBUF");
+		}
+	    }
+	    assert(buf.index < c->n_buffers);
+	    process_frame(c, &buf);
+	    if (-1 == xioctl(c->fd, VIDIOC_QBUF, &buf))
+		errno_exit("VIDIOC_QBUF");
+	    break;
+	case IO_METHOD_USERPTR:
+	    CLEAR(buf);
+	    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	    buf.memory = V4L2_MEMORY_USERPTR;
+	    if (-1 == xioctl(c->fd, VIDIOC_DQBUF, &buf)) {
+		switch (errno) {
+		    case EAGAIN:
+			return 0;
+		    case EIO:
+/* Could ignore EIO, see spec. */
+/* fall through */
+		    default:
+			errno_exit("VIDIOC_DQBUF");
+		}
+	    }
+	    for (i = 0; i < c->n_buffers; ++i)
+		if (buf.m.userptr == (unsigned long) c->buffers[i].start
+		    && buf.length == c->buffers[i].length)
+		    break;
+	    assert(i < c->n_buffers);
+	    process_frame(c, &buf);
+	    if (-1 == xioctl(c->fd, VIDIOC_QBUF, &buf))
+		errno_exit("VIDIOC_QBUF");
+	    break;
+    }
+    return 1;
+}
+
+/*
+ * Dequeue a frame from each of the channels, all tw68 devices streaming
+ * mmap or userptr buffers, with one TW68_IOC_BATCH in place of a DQBUF
+ * and a QBUF on each.  A frame is processed as soon as it's dequeued
+ * and its buffer requeued by the next call.  Frames the driver's
+ * metadata shows without a locked signal, or hit by a FIFO or DMA
+ * error, are counted in c->bad.  With TW68_BATCH_SET in flags, frames
+ * are only dequeued as sets of the same frame from all the channels.
+ */
+int vcap_read_batch(struct vcap **c, unsigned int n, unsigned int flags)
+{
+    struct tw68_batch_entry e[TW68_BATCH_MAX];
+    struct tw68_batch b;
+    unsigned int i;
+    assert(n > 0 && n <= TW68_BATCH_MAX);
+    CLEAR(e);
+    for (i = 0; i < n; i++) {
+	e[i].fd = c[i]->fd;
+	if (c[i]->holding) {
+	    e[i].flags = TW68_BATCH_QBUF;
+	    e[i].buf = c[i]->held;
+	    c[i]->holding = 0;
+	}
+    }
+    CLEAR(b);
+    b.entries = (unsigned long) e;
+    b.count = n;
+    b.flags = flags;
+    if (-1 == xioctl(c[0]->fd, TW68_IOC_BATCH, &b))
+	errno_exit("TW68_IOC_BATCH");
+    for (i = 0; i < n; i++) {
+	if (e[i].result) {
+	    errno = -e[i].result;
+	    errno_exit(c[i]->name);
+	}
+	if (!(e[i].flags & TW68_BATCH_DONE))
+	    continue;
+	assert(e[i].buf.index < c[i]->n_buffers);
+	if ((e[i].meta.status & TW68_META_VDLOSS) ||
+	    !(e[i].meta.status & TW68_META_VLOCK) ||
+	    (e[i].meta.flags & (TW68_META_FIFO | TW68_META_DMAERR)))
+	    c[i]->bad++;
+	process_frame(c[i], &e[i].buf);
+	c[i]->held = e[i].buf;
+	c[i]->holding = 1;
+    }
+    return b.done;
+}
+
+void vcap_stop(struct vcap *c)
+{
+    enum v4l2_buf_type type;
+    switch (c->cfg->io) {
+	case IO_METHOD_READ:
+/* Nothing to do. */
+	    break;
+	case IO_METHOD_MMAP:
+	case IO_METHOD_USERPTR:
+	    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	    if (-1 == xioctl(c->fd, VIDIOC_STREAMOFF, &type))
+		errno_exit("VIDIOC_STREAMOFF");
+	    c->holding = 0;
+	    break;
+    }
+}
+
+void vcap_start(struct vcap *c)
+{
+    unsigned int i;
+    enum v4l2_buf_type type;
+    switch (c->cfg->io) {
+	case IO_METHOD_READ:
+/* Nothing to do. */
+	    break;
+	case IO_METHOD_MMAP:
+	    for (i = 0; i < c->n_buffers; ++i) {
+		struct v4l2_buffer buf;
+		CLEAR(buf);
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (-1 == xioctl(c->fd, VIDIOC_QBUF, &buf))
+		    errno_exit("VIDIOC_QBUF");
+	    }
+	    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	    if (-1 == xioctl(c->fd, VIDIOC_STREAMON, &type))
+		errno_exit("VIDIOC_STREAMON");
+	    break;
+	case IO_METHOD_USERPTR:
+	    for (i = 0; i < c->n_buffers; ++i) {
+		struct v4l2_buffer buf;
+		CLEAR(buf);
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_USERPTR;
+		buf.index = i;
+		buf.m.userptr = (unsigned long) c->buffers[i].start;
+		buf.length = c->buffers[i].length;
+		if (-1 == xioctl(c->fd, VIDIOC_QBUF, &buf))
+		    errno_exit("VIDIOC_QBUF");
+	    }
+	    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	    if (-1 == xioctl(c->fd, VIDIOC_STREAMON, &type))
+		errno_exit("VIDIOC_STREAMON");
+	    break;
+    }
+}
+
+static void uninit_device(struct vcap *c)
+{
+    unsigned int i;
+    switch (c->cfg->io) {
+	case IO_METHOD_READ:
+	    free(c->buffers[0].start);
+	    break;
+	case IO_METHOD_MMAP:
+	    for (i = 0; i < c->n_buffers; ++i)
+		if (-1 == munmap(c->buffers[i].start, c->buffers[i].length))
+		    errno_exit("munmap");
+	    break;
+	case IO_METHOD_USERPTR:
+	    for (i = 0; i < c->n_buffers; ++i)
+		free(c->buffers[i].start);
+	    break;
+    }
+    free(c->buffers);
+}
+
+static void init_read(struct vcap *c, unsigned int buffer_size)
+{
+    c->buffers = calloc(1, sizeof(*c->buffers));
+    if (!c->buffers) {
+	fprintf(stderr, "Out of memory\n");
+	exit(EXIT_FAILURE);
+    }
+    c->buffers[0].length = buffer_size;
+    c->buffers[0].start = malloc(buffer_size);
+    if (!c->buffers[0].start) {
+	fprintf(stderr, "Out of memory\n");
+	exit(EXIT_FAILURE);
+    }
+    memset(c->buffers[0].start, 0, buffer_size);
+    c->n_buffers = 1;
+}
+
+static void init_mmap(struct vcap *c)
+{
+    struct v4l2_requestbuffers req;
+    CLEAR(req);
+    req.count = c->cfg->n_buffers;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (-1 == xioctl(c->fd, VIDIOC_REQBUFS, &req)) {
+	if (EINVAL == errno) {
+	    fprintf(stderr, "%s does not support "
+		    "memory mapping\n", c->name);
+	    exit(EXIT_FAILURE);
+	} else {
+	    errno_exit("VIDIOC_REQBUFS");
+	}
+    }
+    if (req.count < 2) {
+	fprintf(stderr, "Insufficient buffer memory on %s\n", c->name);
+	exit(EXIT_FAILURE);
+    }
+    c->buffers = calloc(req.count, sizeof(*c->buffers));
+    if (!c->buffers) {
+	fprintf(stderr, "Out of memory\n");
+	exit(EXIT_FAILURE);
+    }
+    for (c->n_buffers = 0; c->n_buffers < req.count; ++c->n_buffers) {
+	struct v4l2_buffer buf;
+	CLEAR(buf);
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = c->n_buffers;
+	if (-1 == xioctl(c->fd, VIDIOC_QUERYBUF, &buf))
+	    errno_exit("VIDIOC_QUERYBUF");
+	c->buffers[c->n_buffers].length = buf.length;
+	c->buffers[c->n_buffers].start = mmap(NULL /* start anywhere */ ,
+					      buf.length,
+					      PROT_READ | PROT_WRITE
+					      /* required */ ,
+					      MAP_SHARED /* recommended */ ,
+					      c->fd, buf.m.offset);
+	if (MAP_FAILED == c->buffers[c->n_buffers].start)
+	    errno_exit("mmap");
+    }
+}
+
+static void init_userp(struct vcap *c, unsigned int buffer_size)
+{
+    struct v4l2_requestbuffers req;
+    unsigned int page_size;
+    page_size = getpagesize();
+    buffer_size = (buffer_size + page_size - 1) & ~(page_size - 1);
+    CLEAR(req);
+    req.count = c->cfg->n_buffers;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_USERPTR;
+    if (-1 == xioctl(c->fd, VIDIOC_REQBUFS, &req)) {
+	if (EINVAL == errno) {
+	    fprintf(stderr, "%s does not support "
+		    "user pointer i/o\n", c->name);
+	    exit(EXIT_FAILURE);
+	} else {
+	    errno_exit("VIDIOC_REQBUFS");
+	}
+    }
+    c->buffers = calloc(c->cfg->n_buffers, sizeof(*c->buffers));
+    if (!c->buffers) {
+	fprintf(stderr, "Out of memory\n");
+	exit(EXIT_FAILURE);
+    }
+    for (c->n_buffers = 0; c->n_buffers < c->cfg->n_buffers;
+	 ++c->n_buffers) {
+	c->buffers[c->n_buffers].length = buffer_size;
+	c->buffers[c->n_buffers].start = memalign( /* boundary */ page_size,
+						  buffer_size);
+	if (!c->buffers[c->n_buffers].start) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(EXIT_FAILURE);
+	}
+    }
+}
+
+static void init_device(struct vcap *c)
+{
+    struct v4l2_capability cap;
+    struct v4l2_cropcap cropcap;
+    struct v4l2_crop crop;
+    struct v4l2_format *fmt = &c->fmt;
+    unsigned int min;
+    if (-1 == xioctl(c->fd, VIDIOC_QUERYCAP, &cap)) {
+	if (EINVAL == errno) {
+	    fprintf(stderr, "%s is no V4L2 device\n", c->name);
+	    exit(EXIT_FAILURE);
+	} else {
+	    errno_exit("VIDIOC_QUERYCAP");
+	}
+    }
+    if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+	fprintf(stderr, "%s is no video capture device\n", c->name);
+	exit(EXIT_FAILURE);
+    }
+    switch (c->cfg->io) {
+	case IO_METHOD_READ:
+	    if (!(cap.capabilities & V4L2_CAP_READWRITE)) {
+		fprintf(stderr, "%s does not support read i/o\n",
+			c->name);
+		exit(EXIT_FAILURE);
+	    }
+	    break;
+	case IO_METHOD_MMAP:
+	case IO_METHOD_USERPTR:
+	    if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
+		fprintf(stderr, "%s does not support streaming i/o\n",
+			c->name);
+		exit(EXIT_FAILURE);
+	    }
+	    break;
+    }
+/* Select video input, video standard and tune here. */
+    CLEAR(cropcap);
+    cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (0 == xioctl(c->fd, VIDIOC_CROPCAP, &cropcap)) {
+	crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	crop.c = cropcap.defrect;	/* reset to default */
+/* Errors (cropping not supported) ignored. */
+	xioctl(c->fd, VIDIOC_S_CROP, &crop);
+    }
+    CLEAR(*fmt);
+    fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt->fmt.pix.width = c->cfg->width;
+    fmt->fmt.pix.height = c->cfg->height;
+    fmt->fmt.pix.pixelformat = c->cfg->pixelformat;
+    fmt->fmt.pix.field = c->cfg->field;
+    if (c->cfg->align > 1) {
+/* Ask for the shortest line first, then for it rounded up. */
+	if (-1 == xioctl(c->fd, VIDIOC_TRY_FMT, fmt))
+	    errno_exit("VIDIOC_TRY_FMT");
+	fmt->fmt.pix.bytesperline = (fmt->fmt.pix.bytesperline +
+				     c->cfg->align - 1) / c->cfg->align *
+	    c->cfg->align;
+    }
+    if (-1 == xioctl(c->fd, VIDIOC_S_FMT, fmt))
+	errno_exit("VIDIOC_S_FMT");
+    if (c->cfg->align > 1 && fmt->fmt.pix.bytesperline % c->cfg->align)
+	fprintf(stderr, "%s: bytesperline %u is not a multiple of %u\n",
+		c->name, fmt->fmt.pix.bytesperline, c->cfg->align);
+/* Note VIDIOC_S_FMT may change width and height. */
+/* Buggy driver paranoia. */
+    min = fmt->fmt.pix.width * 2;
+    if (fmt->fmt.pix.bytesperline < min)
+	fmt->fmt.pix.bytesperline = min;
+    min = fmt->fmt.pix.bytesperline * fmt->fmt.pix.height;
+    if (fmt->fmt.pix.sizeimage < min)
+	fmt->fmt.pix.sizeimage = min;
+    switch (c->cfg->io) {
+	case IO_METHOD_READ:
+	    init_read(c, fmt->fmt.pix.sizeimage);
+	    break;
+	case IO_METHOD_MMAP:
+	    init_mmap(c);
+	    break;
+	case IO_METHOD_USERPTR:
+	    init_userp(c, fmt->fmt.pix.sizeimage);
+	    break;
+    }
+}
+
+static void close_device(struct vcap *c)
+{
+    if (-1 == close(c->fd))
+	errno_exit("close");
+    c->fd = -1;
+}
+
+static void open_device(struct vcap *c)
+{
+    struct stat st;
+    if (-1 == stat(c->name, &st)) {
+	fprintf(stderr, "Cannot identify '%s': %d, %s\n",
+		c->name, errno, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    if (!S_ISCHR(st.st_mode)) {
+	fprintf(stderr, "%s is no device\n", c->name);
+	exit(EXIT_FAILURE);
+    }
+    c->fd = open(c->name, O_RDWR /* required */  | O_NONBLOCK, 0);
+    if (-1 == c->fd) {
+	fprintf(stderr, "Cannot open '%s': %d, %s\n",
+		c->name, errno, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    c->last_seq = -1;
+}
+
+double vcap_fps(const struct vcap *c)
+{
+    double t = c->last_dq - c->first_dq;
+    return t > 0 ? c->interval.n / t : 0;
+}
+
+void vcap_open(struct vcap *c, const char *name,
+	       const struct vcap_config *cfg)
+{
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    c->cfg = cfg;
+    open_device(c);
+    init_device(c);
+}
+
+void vcap_close(struct vcap *c)
+{
+    uninit_device(c);
+    close_device(c);
+}
+
+static const struct {
+    const char *name;
+    enum v4l2_field field;
+} field_names[] = {
+    {"interlaced", V4L2_FIELD_INTERLACED},
+    {"top", V4L2_FIELD_TOP},
+    {"bottom", V4L2_FIELD_BOTTOM},
+    {"seq-tb", V4L2_FIELD_SEQ_TB},
+    {"seq-bt", V4L2_FIELD_SEQ_BT},
+    {"alternate", V4L2_FIELD_ALTERNATE},
+    {"any", V4L2_FIELD_ANY},
+};
+
+int vcap_parse_field(const char *name, enum v4l2_field *field)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof(field_names) / sizeof(field_names[0]); i++)
+	if (!strcmp(name, field_names[i].name)) {
+	    *field = field_names[i].field;
+	    return 0;
+	}
+    return -1;
+}
@@ -0,0 +1,77 @@
+/*
+* vcap - V4L2 capture channel helpers shared by videotest and multicap
+*
+* This program can be used and distributed without restrictions.
+*
+* A channel is one open /dev/videoN with its buffers and the running
+* statistics of what it captured.  The functions report errors and
+* exit, like the V4L2 capture example they were taken from; a channel
+* is only ever touched by one thread.
+*/
+#ifndef VCAP_H
+#define VCAP_H
+#include <stddef.h>
+#include <asm/types.h>		/* for videodev2.h */
+#include <linux/videodev2.h>
+typedef enum {
+    IO_METHOD_READ,
+    IO_METHOD_MMAP,
+    IO_METHOD_USERPTR,
+} io_method;
+extern const char *vcap_io_name[];
+struct vcap_config {
+    io_method io;
+    unsigned int n_buffers;	/* buffers to request */
+    unsigned int width, height;
+    unsigned int pixelformat;
+    enum v4l2_field field;
+    unsigned int align;		/* round bytesperline up to this, or 0 */
+    unsigned int warmup;	/* frames before measuring */
+    int verbose;		/* a dot per frame */
+};
+struct vcap_buffer {
+    void *start;
+    size_t length;
+};
+/* running statistics of one quantity */
+struct vcap_stat {
+    unsigned long n;
+    double sum, sumsq, min, max;
+};
+struct vcap {
+    const char *name;
+    int fd;
+    const struct vcap_config *cfg;
+    struct vcap_buffer *buffers;
+    unsigned int n_buffers;
+    struct v4l2_format fmt;
+    int done;
+    /* results */
+    unsigned long frames;
+    unsigned long dropped;
+    unsigned long errors;	/* buffers flagged V4L2_BUF_FLAG_ERROR */
+    unsigned long bad;		/* vcap_read_batch: no lock, FIFO or DMA error */
+    unsigned long long bytes;	/* bytesused, or sizeimage for read() */
+    long last_seq;
+    double first_dq, last_dq;	/* seconds, CLOCK_MONOTONIC */
+    struct vcap_stat latency;	/* msecs */
+    struct vcap_stat interval;	/* msecs */
+    /* vcap_read_batch: the buffer dequeued last, to requeue next time */
+    struct v4l2_buffer held;
+    int holding;
+};
+void vcap_open(struct vcap *c, const char *name,
+	       const struct vcap_config *cfg);
+void vcap_start(struct vcap *c);
+int vcap_read_frame(struct vcap *c);	/* 1 for a frame, 0 for EAGAIN */
+/* one TW68_IOC_BATCH over the channels, returns the frames dequeued */
+int vcap_read_batch(struct vcap **c, unsigned int n, unsigned int flags);
+void vcap_stop(struct vcap *c);
+void vcap_close(struct vcap *c);
+double vcap_fps(const struct vcap *c);
+double vcap_now(void);
+void vcap_stat_add(struct vcap_stat *s, double v);
+double vcap_stat_mean(const struct vcap_stat *s);
+double vcap_stat_stddev(const struct vcap_stat *s);
+int vcap_parse_field(const char *name, enum v4l2_field *field);
+#endif
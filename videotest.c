@@ -1,447 +1,186 @@
 /*
-* V4L2 video capture example
+* V4L2 video capture example, grown into a capture benchmark
 *
 * This program can be used and distributed without restrictions.
+*
+* Captures from one or more devices at once and reports, per device:
+*   - sustained frame rate, and frames dropped (from gaps in
+*     v4l2_buffer.sequence)
+*   - DQBUF latency: the time the frame is dequeued minus its
+*     v4l2_buffer.timestamp
+*   - jitter: the spread of the interval between dequeued frames
+* and for the whole run the CPU time used per frame captured.
+*
+* With --batch the frames of all the devices are dequeued and requeued
+* with the tw68 driver's TW68_IOC_BATCH, one call per wakeup; with --set
+* only as sets of the same frame, for the members of a capture group.
+*
+* Example, four channels of an 8-chip board, 30 seconds, JSON:
+*   videotest -d /dev/video0 -d /dev/video1 -d /dev/video2 \
+*       -d /dev/video3 -s 720x576 -f YUYV -t 30 -j
 */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
 #include <getopt.h>		/* getopt_long() */
-#include <fcntl.h>		/* low-level i/o */
-#include <unistd.h>
 #include <errno.h>
-#include <malloc.h>
-#include <sys/stat.h>
-#include <sys/types.h>
 #include <sys/time.h>
-#include <sys/mman.h>
-#include <sys/ioctl.h>
-#include <asm/types.h>		/* for videodev2.h */
-#include <linux/videodev2.h>
-#define CLEAR(x) memset (&(x), 0, sizeof (x))
-typedef enum {
-    IO_METHOD_READ,
-    IO_METHOD_MMAP,
-    IO_METHOD_USERPTR,
-} io_method;
-struct buffer {
-    void *start;
-    size_t length;
+#include <sys/resource.h>
+#include <sys/select.h>
+#include "vcap.h"
+#include "tw68-ioctl.h"
+#define MAX_DEVICES 16
+static struct vcap devices[MAX_DEVICES];
+static const char *dev_names[MAX_DEVICES];
+static unsigned int n_devices = 0;
+static struct vcap_config cfg = {
+    .io = IO_METHOD_MMAP,
+    .n_buffers = 4,
+    .width = 640,
+    .height = 480,
+    .pixelformat = V4L2_PIX_FMT_YUYV,
+    .field = V4L2_FIELD_INTERLACED,
+    .warmup = 5,
 };
-static char *dev_name = NULL;
-static io_method io = IO_METHOD_MMAP;
-static int fd = -1;
-struct buffer *buffers = NULL;
-static unsigned int n_buffers = 0;
-static void errno_exit(const char *s)
-{
-    fprintf(stderr, "%s error %d, %s\n", s, errno, strerror(errno));
-    exit(EXIT_FAILURE);
-}
-
-static int xioctl(int fd, int request, void *arg)
-{
-    int r;
-    do
-	r = ioctl(fd, request, arg);
-    while (-1 == r && EINTR == errno);
-    return r;
-}
+static unsigned long max_frames = 100;
+static double max_seconds = 0;
+static int json = 0;
+static int batch = 0;
+static unsigned int batch_flags = 0;
 
-static void process_image(const void *p)
+static double cpu_seconds(void)
 {
-int *pint = (int *)p;
-if (*pint == 0)
-  printf("zero data\n");
-else {
-  printf(" %x", *pint);
-  *pint = 0;
-}
-    fputc('.', stdout);
-    fflush(stdout);
-}
-
-static int read_frame(void)
-{
-    struct v4l2_buffer buf;
-    unsigned int i;
-    switch (io) {
-	case IO_METHOD_READ:
-	    if (-1 == read(fd, buffers[0].start, buffers[0].length)) {
-		switch (errno) {
-		    case EAGAIN:
-			return 0;
-		    case EIO:
-/* Could ignore EIO, see spec. */
-/* fall through */
-		    default:
-			errno_exit("read");
-		}
-	    }
-	    process_image(buffers[0].start);
-	    break;
-	case IO_METHOD_MMAP:
-	    CLEAR(buf);
-	    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	    buf.memory = V4L2_MEMORY_MMAP;
-	    if (-1 == xioctl(fd, VIDIOC_DQBUF, &buf)) {
-		switch (errno) {
-		    case EAGAIN:
-			return 0;
-		    case EIO:
-/* Could ignore EIO, see spec. */
-/* fall through */
-		    default:
-			errno_exit("VIDIOC_DQBUF");
-		}
-	    }
-	    assert(buf.index < n_buffers);
-	    process_image(buffers[buf.index].start);
-	    if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
-		errno_exit("VIDIOC_QBUF");
-	    break;
-	case IO_METHOD_USERPTR:
-	    CLEAR(buf);
-	    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	    buf.memory = V4L2_MEMORY_USERPTR;
-	    if (-1 == xioctl(fd, VIDIOC_DQBUF, &buf)) {
-		switch (errno) {
-		    case EAGAIN:
-			return 0;
-		    case EIO:
-/* Could ignore EIO, see spec. */
-/* fall through */
-		    default:
-			errno_exit("VIDIOC_DQBUF");
-		}
-	    }
-	    for (i = 0; i < n_buffers; ++i)
-		if (buf.m.userptr == (unsigned long) buffers[i].start
-		    && buf.length == buffers[i].length)
-		    break;
-	    assert(i < n_buffers);
-	    process_image((void *) buf.m.userptr);
-	    if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
-		errno_exit("VIDIOC_QBUF");
-	    break;
-    }
-    return 1;
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
 }
 
 static void mainloop(void)
 {
-    unsigned int count;
-    count = 100;
-    while (count-- > 0) {
-	for (;;) {
-	    fd_set fds;
-	    struct timeval tv;
-	    int r;
-	    FD_ZERO(&fds);
-	    FD_SET(fd, &fds);
-/* Timeout. */
-	    tv.tv_sec = 2;
-	    tv.tv_usec = 0;
-	    r = select(fd + 1, &fds, NULL, NULL, &tv);
-	    if (-1 == r) {
-		if (EINTR == errno)
-		    continue;
-		errno_exit("select");
-	    }
-	    if (0 == r) {
-		fprintf(stderr, "select timeout\n");
-		exit(EXIT_FAILURE);
-	    }
-	    if (read_frame())
-		break;
-/* EAGAIN - continue select loop. */
-	}
-    }
-}
-
-static void stop_capturing(void)
-{
-    enum v4l2_buf_type type;
-    switch (io) {
-	case IO_METHOD_READ:
-/* Nothingto do. */
-	    break;
-	case IO_METHOD_MMAP:
-	case IO_METHOD_USERPTR:
-	    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	    if (-1 == xioctl(fd, VIDIOC_STREAMOFF, &type))
-		errno_exit("VIDIOC_STREAMOFF");
-	    break;
-    }
-}
-
-static void start_capturing(void)
-{
-    unsigned int i;
-    enum v4l2_buf_type type;
-    switch (io) {
-	case IO_METHOD_READ:
-/* Nothing to do. */
-	    break;
-	case IO_METHOD_MMAP:
-	    for (i = 0; i < n_buffers; ++i) {
-		struct v4l2_buffer buf;
-		CLEAR(buf);
-		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.index = i;
-		if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
-		    errno_exit("VIDIOC_QBUF");
-	    }
-	    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	    if (-1 == xioctl(fd, VIDIOC_STREAMON, &type))
-		errno_exit("VIDIOC_STREAMON");
-	    break;
-	case IO_METHOD_USERPTR:
-	    for (i = 0; i < n_buffers; ++i) {
-		struct v4l2_buffer buf;
-		CLEAR(buf);
-		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.memory = V4L2_MEMORY_USERPTR;
-		buf.index = i;
-		buf.m.userptr = (unsigned long) buffers[i].start;
-		buf.length = buffers[i].length;
-		if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
-		    errno_exit("VIDIOC_QBUF");
-	    }
-	    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	    if (-1 == xioctl(fd, VIDIOC_STREAMON, &type))
-		errno_exit("VIDIOC_STREAMON");
-	    break;
-    }
-}
-
-static void uninit_device(void)
-{
-    unsigned int i;
-    switch (io) {
-	case IO_METHOD_READ:
-	    free(buffers[0].start);
-	    break;
-	case IO_METHOD_MMAP:
-	    for (i = 0; i < n_buffers; ++i)
-		if (-1 == munmap(buffers[i].start, buffers[i].length))
-		    errno_exit("munmap");
-	    break;
-	case IO_METHOD_USERPTR:
-	    for (i = 0; i < n_buffers; ++i)
-		free(buffers[i].start);
-	    break;
-    }
-    free(buffers);
-}
-
-static void init_read(unsigned int buffer_size)
-{
-    buffers = calloc(1, sizeof(*buffers));
-    if (!buffers) {
-	fprintf(stderr, "Out of memory\n");
-	exit(EXIT_FAILURE);
-    }
-    buffers[0].length = buffer_size;
-    buffers[0].start = malloc(buffer_size);
-    if (!buffers[0].start) {
-	fprintf(stderr, "Out of memory\n");
-	exit(EXIT_FAILURE);
-    }
-memset(buffers[0].start, 0, buffer_size);
-}
-
-static void init_mmap(void)
-{
-    struct v4l2_requestbuffers req;
-    CLEAR(req);
-    req.count = 4;
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-    if (-1 == xioctl(fd, VIDIOC_REQBUFS, &req)) {
-	if (EINVAL == errno) {
-	    fprintf(stderr, "%s does not support "
-		    "memory mapping\n", dev_name);
-	    exit(EXIT_FAILURE);
-	} else {
-	    errno_exit("VIDIOC_REQBUFS");
+    double start = vcap_now();
+    unsigned int i, running = n_devices;
+    while (running) {
+	fd_set fds;
+	struct timeval tv;
+	int r, maxfd = -1;
+	FD_ZERO(&fds);
+	for (i = 0; i < n_devices; i++) {
+	    if (devices[i].done)
+		continue;
+	    FD_SET(devices[i].fd, &fds);
+	    if (devices[i].fd > maxfd)
+		maxfd = devices[i].fd;
 	}
-    }
-    if (req.count < 2) {
-	fprintf(stderr, "Insufficient buffer memory on %s\n", dev_name);
-	exit(EXIT_FAILURE);
-    }
-    buffers = calloc(req.count, sizeof(*buffers));
-    if (!buffers) {
-	fprintf(stderr, "Out of memory\n");
-	exit(EXIT_FAILURE);
-    }
-    for (n_buffers = 0; n_buffers < req.count; ++n_buffers) {
-	struct v4l2_buffer buf;
-	CLEAR(buf);
-	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	buf.memory = V4L2_MEMORY_MMAP;
-	buf.index = n_buffers;
-	if (-1 == xioctl(fd, VIDIOC_QUERYBUF, &buf))
-	    errno_exit("VIDIOC_QUERYBUF");
-	buffers[n_buffers].length = buf.length;
-	buffers[n_buffers].start = mmap(NULL /* start anywhere */ ,
-					buf.length,
-					PROT_READ | PROT_WRITE
-					/* required */ ,
-					MAP_SHARED /* recommended */ ,
-					fd, buf.m.offset);
-	if (MAP_FAILED == buffers[n_buffers].start)
-	    errno_exit("mmap");
-    }
-}
-
-static void init_userp(unsigned int buffer_size)
-{
-    struct v4l2_requestbuffers req;
-    unsigned int page_size;
-    page_size = getpagesize();
-    buffer_size = (buffer_size + page_size - 1) & ~(page_size - 1);
-    CLEAR(req);
-    req.count = 4;
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_USERPTR;
-    if (-1 == xioctl(fd, VIDIOC_REQBUFS, &req)) {
-	if (EINVAL == errno) {
-	    fprintf(stderr, "%s does not support "
-		    "user pointer i/o\n", dev_name);
+/* Timeout. */
+	tv.tv_sec = 2;
+	tv.tv_usec = 0;
+	r = select(maxfd + 1, &fds, NULL, NULL, &tv);
+	if (-1 == r) {
+	    if (EINTR == errno)
+		continue;
+	    fprintf(stderr, "select error %d, %s\n", errno, strerror(errno));
 	    exit(EXIT_FAILURE);
-	} else {
-	    errno_exit("VIDIOC_REQBUFS");
 	}
-    }
-    buffers = calloc(4, sizeof(*buffers));
-    if (!buffers) {
-	fprintf(stderr, "Out of memory\n");
-	exit(EXIT_FAILURE);
-    }
-    for (n_buffers = 0; n_buffers < 4; ++n_buffers) {
-	buffers[n_buffers].length = buffer_size;
-	buffers[n_buffers].start = memalign( /* boundary */ page_size,
-					    buffer_size);
-	if (!buffers[n_buffers].start) {
-	    fprintf(stderr, "Out of memory\n");
+	if (0 == r) {
+	    fprintf(stderr, "select timeout\n");
 	    exit(EXIT_FAILURE);
 	}
-    }
-}
-
-static void init_device(void)
-{
-    struct v4l2_capability cap;
-    struct v4l2_cropcap cropcap;
-    struct v4l2_crop crop;
-    struct v4l2_format fmt;
-    unsigned int min;
-    if (-1 == xioctl(fd, VIDIOC_QUERYCAP, &cap)) {
-	if (EINVAL == errno) {
-	    fprintf(stderr, "%s is no V4L2 device\n", dev_name);
-	    exit(EXIT_FAILURE);
-	} else {
-	    errno_exit("VIDIOC_QUERYCAP");
+	if (batch) {
+	    struct vcap *c[MAX_DEVICES];
+	    unsigned int n = 0;
+	    for (i = 0; i < n_devices; i++)
+		if (!devices[i].done)
+		    c[n++] = &devices[i];
+	    vcap_read_batch(c, n, batch_flags);
 	}
-    }
-    if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
-	fprintf(stderr, "%s is no video capture device\n", dev_name);
-	exit(EXIT_FAILURE);
-    }
-    switch (io) {
-	case IO_METHOD_READ:
-	    if (!(cap.capabilities & V4L2_CAP_READWRITE)) {
-		fprintf(stderr, "%s does not support read i/o\n",
-			dev_name);
-		exit(EXIT_FAILURE);
-	    }
-	    break;
-	case IO_METHOD_MMAP:
-	case IO_METHOD_USERPTR:
-	    if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
-		fprintf(stderr, "%s does not support streaming i/o\n",
-			dev_name);
-		exit(EXIT_FAILURE);
-	    }
-	    break;
-    }
-/* Select video input, video standard and tune here. */
-    CLEAR(cropcap);
-    cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (0 == xioctl(fd, VIDIOC_CROPCAP, &cropcap)) {
-	crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	crop.c = cropcap.defrect;	/* reset to default */
-	if (-1 == xioctl(fd, VIDIOC_S_CROP, &crop)) {
-	    switch (errno) {
-		case EINVAL:
-/* Cropping not supported. */
-		    break;
-		default:
-/* Errors ignored. */
-		    break;
+	for (i = 0; i < n_devices; i++) {
+	    struct vcap *d = &devices[i];
+	    if (d->done || (!batch && !FD_ISSET(d->fd, &fds)))
+		continue;
+/* EAGAIN - back to the select loop. */
+	    if (!batch)
+		vcap_read_frame(d);
+	    if ((max_frames && d->frames >= max_frames + cfg.warmup) ||
+		(max_seconds && vcap_now() - start >= max_seconds)) {
+		d->done = 1;
+		running--;
 	    }
 	}
-    } else {
-/* Errors ignored. */
-    }
-    CLEAR(fmt);
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width = 640;
-    fmt.fmt.pix.height = 480;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-    fmt.fmt.pix.field = V4L2_FIELD_INTERLACED;
-    if (-1 == xioctl(fd, VIDIOC_S_FMT, &fmt))
-	errno_exit("VIDIOC_S_FMT");
-/* Note VIDIOC_S_FMT may change width and height. */
-/* Buggy driver paranoia. */
-    min = fmt.fmt.pix.width * 2;
-    if (fmt.fmt.pix.bytesperline < min)
-	fmt.fmt.pix.bytesperline = min;
-    min = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height;
-    if (fmt.fmt.pix.sizeimage < min)
-	fmt.fmt.pix.sizeimage = min;
-    switch (io) {
-	case IO_METHOD_READ:
-	    init_read(fmt.fmt.pix.sizeimage);
-	    break;
-	case IO_METHOD_MMAP:
-	    init_mmap();
-	    break;
-	case IO_METHOD_USERPTR:
-	    init_userp(fmt.fmt.pix.sizeimage);
-	    break;
     }
 }
 
-static void close_device(void)
+static void report_stat(const char *name, const struct vcap_stat *s, int last)
 {
-    if (-1 == close(fd))
-	errno_exit("close");
-    fd = -1;
+    printf("      \"%s\": {\"mean\": %.3f, \"stddev\": %.3f, "
+	   "\"min\": %.3f, \"max\": %.3f}%s\n", name, vcap_stat_mean(s),
+	   vcap_stat_stddev(s), s->min, s->max, last ? "" : ",");
 }
 
-static void open_device(void)
+static void report(double elapsed, double cpu)
 {
-    struct stat st;
-    if (-1 == stat(dev_name, &st)) {
-	fprintf(stderr, "Cannot identify '%s': %d, %s\n",
-		dev_name, errno, strerror(errno));
-	exit(EXIT_FAILURE);
-    }
-    if (!S_ISCHR(st.st_mode)) {
-	fprintf(stderr, "%s is no device\n", dev_name);
-	exit(EXIT_FAILURE);
+    unsigned long frames = 0;
+    unsigned int i;
+    for (i = 0; i < n_devices; i++)
+	frames += devices[i].frames;
+    if (!json) {
+	if (cfg.verbose)
+	    fputc('\n', stdout);
+	for (i = 0; i < n_devices; i++) {
+	    struct vcap *d = &devices[i];
+	    printf("%s: %ux%u %.4s %s, %lu frames, %.2f fps, "
+		   "%lu dropped, %lu errors\n", d->name,
+		   d->fmt.fmt.pix.width, d->fmt.fmt.pix.height,
+		   (char *) &d->fmt.fmt.pix.pixelformat, vcap_io_name[cfg.io],
+		   d->frames, vcap_fps(d), d->dropped, d->errors);
+	    if (batch)
+		printf("    %lu frames without lock or with FIFO/DMA "
+		       "errors\n", d->bad);
+	    if (cfg.io != IO_METHOD_READ)
+		printf("    latency ms: mean %.3f stddev %.3f "
+		       "min %.3f max %.3f\n", vcap_stat_mean(&d->latency),
+		       vcap_stat_stddev(&d->latency), d->latency.min,
+		       d->latency.max);
+	    printf("    interval ms: mean %.3f jitter %.3f "
+		   "min %.3f max %.3f\n", vcap_stat_mean(&d->interval),
+		   vcap_stat_stddev(&d->interval), d->interval.min,
+		   d->interval.max);
+	}
+	printf("%lu frames in %.2f s, cpu %.1f us/frame\n", frames,
+	       elapsed, frames ? cpu * 1e6 / frames : 0);
+	return;
     }
-    fd = open(dev_name, O_RDWR /* required */  | O_NONBLOCK, 0);
-    if (-1 == fd) {
-	fprintf(stderr, "Cannot open '%s': %d, %s\n",
-		dev_name, errno, strerror(errno));
-	exit(EXIT_FAILURE);
+    printf("{\n  \"io\": \"%s\",\n  \"batch\": %s,\n  \"buffers\": %u,\n"
+	   "  \"elapsed_s\": %.3f,\n  \"frames\": %lu,\n"
+	   "  \"cpu_us_per_frame\": %.2f,\n  \"devices\": [\n",
+	   vcap_io_name[cfg.io], batch ? "true" : "false", cfg.n_buffers,
+	   elapsed, frames,
+	   frames ? cpu * 1e6 / frames : 0);
+    for (i = 0; i < n_devices; i++) {
+	struct vcap *d = &devices[i];
+	printf("    {\n      \"device\": \"%s\",\n"
+	       "      \"width\": %u,\n      \"height\": %u,\n"
+	       "      \"fourcc\": \"%.4s\",\n      \"field\": %u,\n"
+	       "      \"bytesperline\": %u,\n"
+	       "      \"frames\": %lu,\n      \"fps\": %.3f,\n",
+	       d->name, d->fmt.fmt.pix.width, d->fmt.fmt.pix.height,
+	       (char *) &d->fmt.fmt.pix.pixelformat,
+	       d->fmt.fmt.pix.field, d->fmt.fmt.pix.bytesperline,
+	       d->frames, vcap_fps(d));
+	if (cfg.io == IO_METHOD_READ)
+	    printf("      \"dropped\": null,\n      \"errors\": null,\n"
+		   "      \"latency_ms\": null,\n");
+	else {
+	    printf("      \"dropped\": %lu,\n      \"errors\": %lu,\n",
+		   d->dropped, d->errors);
+	    if (batch)
+		printf("      \"bad\": %lu,\n", d->bad);
+	    report_stat("latency_ms", &d->latency, 0);
+	}
+	report_stat("interval_ms", &d->interval, 1);
+	printf("    }%s\n", i + 1 < n_devices ? "," : "");
     }
+    printf("  ]\n}\n");
 }
 
 static void usage(FILE * fp, int argc, char **argv)
@@ -449,27 +188,57 @@ static void usage(FILE * fp, int argc, char **argv)
     fprintf(fp,
 	    "Usage: %s [options]\n\n"
 	    "Options:\n"
-	    "-d | --device name Video device name [/dev/video]\n"
-	    "-h | --help Print this message\n"
-	    "-m | --mmap Use memory mapped buffers\n"
-	    "-r | --read Use read() calls\n"
-	    "-u | --userp Use application allocated buffers\n"
+	    "-d | --device name   Video device name [/dev/video], may be\n"
+	    "                     repeated to capture from several at once\n"
+	    "-h | --help          Print this message\n"
+	    "-m | --mmap          Use memory mapped buffers\n"
+	    "-r | --read          Use read() calls\n"
+	    "-u | --userp         Use application allocated buffers\n"
+	    "-b | --buffers n     Buffers to request [4]\n"
+	    "-f | --format fourcc Pixel format [YUYV]\n"
+	    "-s | --size WxH      Image size [640x480]\n"
+	    "-F | --field name    interlaced, top, bottom, seq-tb, seq-bt,\n"
+	    "                     alternate, any [interlaced]\n"
+	    "-a | --align n       Ask for bytesperline to be a multiple of n\n"
+	    "-n | --frames n      Frames to measure per device [100],\n"
+	    "                     0 to run until --time expires\n"
+	    "-t | --time secs     Stop after this long\n"
+	    "-w | --warmup n      Frames to skip before measuring [5]\n"
+	    "-B | --batch         Dequeue from all devices with one\n"
+	    "                     TW68_IOC_BATCH per wakeup (tw68 only)\n"
+	    "-S | --set           Like --batch, dequeueing only sets of\n"
+	    "                     the same frame (a tw68 capture group)\n"
+	    "-j | --json          Report in JSON\n"
+	    "-v | --verbose       Print a dot per frame\n"
 	    "", argv[0]);
 }
 
-static const char short_options[] = "d:hmru";
+static const char short_options[] = "d:hmrub:f:s:F:a:n:t:w:BSjv";
 static const struct option long_options[] = {
     {"device", required_argument, NULL, 'd'},
     {"help", no_argument, NULL, 'h'},
     {"mmap", no_argument, NULL, 'm'},
     {"read", no_argument, NULL, 'r'},
     {"userp", no_argument, NULL, 'u'},
+    {"buffers", required_argument, NULL, 'b'},
+    {"format", required_argument, NULL, 'f'},
+    {"size", required_argument, NULL, 's'},
+    {"field", required_argument, NULL, 'F'},
+    {"align", required_argument, NULL, 'a'},
+    {"frames", required_argument, NULL, 'n'},
+    {"time", required_argument, NULL, 't'},
+    {"warmup", required_argument, NULL, 'w'},
+    {"batch", no_argument, NULL, 'B'},
+    {"set", no_argument, NULL, 'S'},
+    {"json", no_argument, NULL, 'j'},
+    {"verbose", no_argument, NULL, 'v'},
     {0, 0, 0, 0}
 };
 
 int main(int argc, char **argv)
 {
-    dev_name = "/dev/video";
+    double start, cpu;
+    unsigned int i;
     for (;;) {
 	int index;
 	int c;
@@ -480,33 +249,103 @@ int main(int argc, char **argv)
 	    case 0:		/* getopt_long() flag */
 		break;
 	    case 'd':
-		dev_name = optarg;
+		if (n_devices == MAX_DEVICES) {
+		    fprintf(stderr, "at most %d devices\n", MAX_DEVICES);
+		    exit(EXIT_FAILURE);
+		}
+		dev_names[n_devices++] = optarg;
 		break;
 	    case 'h':
 		usage(stdout, argc, argv);
 		exit(EXIT_SUCCESS);
 	    case 'm':
-		io = IO_METHOD_MMAP;
+		cfg.io = IO_METHOD_MMAP;
 		break;
 	    case 'r':
-		io = IO_METHOD_READ;
+		cfg.io = IO_METHOD_READ;
 		break;
 	    case 'u':
-		io = IO_METHOD_USERPTR;
+		cfg.io = IO_METHOD_USERPTR;
+		break;
+	    case 'b':
+		cfg.n_buffers = strtoul(optarg, NULL, 0);
+		if (cfg.n_buffers < 2)
+		    cfg.n_buffers = 2;
+		break;
+	    case 'f':
+		if (strlen(optarg) != 4) {
+		    fprintf(stderr, "format must be a fourcc\n");
+		    exit(EXIT_FAILURE);
+		}
+		cfg.pixelformat = v4l2_fourcc(optarg[0], optarg[1],
+					  optarg[2], optarg[3]);
+		break;
+	    case 's':
+		if (2 != sscanf(optarg, "%ux%u", &cfg.width, &cfg.height)) {
+		    fprintf(stderr, "size must be WIDTHxHEIGHT\n");
+		    exit(EXIT_FAILURE);
+		}
+		break;
+	    case 'F':
+		if (vcap_parse_field(optarg, &cfg.field)) {
+		    fprintf(stderr, "unknown field order '%s'\n", optarg);
+		    exit(EXIT_FAILURE);
+		}
+		break;
+	    case 'a':
+		cfg.align = strtoul(optarg, NULL, 0);
+		break;
+	    case 'n':
+		max_frames = strtoul(optarg, NULL, 0);
+		break;
+	    case 't':
+		max_seconds = strtod(optarg, NULL);
+		break;
+	    case 'w':
+		cfg.warmup = strtoul(optarg, NULL, 0);
+		break;
+	    case 'B':
+		batch = 1;
+		break;
+	    case 'S':
+		batch = 1;
+		batch_flags = TW68_BATCH_SET;
+		break;
+	    case 'j':
+		json = 1;
+		break;
+	    case 'v':
+		cfg.verbose = 1;
 		break;
 	    default:
 		usage(stderr, argc, argv);
 		exit(EXIT_FAILURE);
 	}
     }
-    open_device();
-    init_device();
-    start_capturing();
+    if (0 == max_frames && 0 == max_seconds) {
+	fprintf(stderr, "--frames 0 needs --time\n");
+	exit(EXIT_FAILURE);
+    }
+    if (batch && cfg.io == IO_METHOD_READ) {
+	fprintf(stderr, "--batch needs streaming i/o\n");
+	exit(EXIT_FAILURE);
+    }
+    if (0 == n_devices)
+	dev_names[n_devices++] = "/dev/video";
+    for (i = 0; i < n_devices; i++)
+	vcap_open(&devices[i], dev_names[i], &cfg);
+    start = vcap_now();
+    cpu = cpu_seconds();
+    for (i = 0; i < n_devices; i++)
+	vcap_start(&devices[i]);
     mainloop();
-    stop_capturing();
-    uninit_device();
-    close_device();
-    fputc('\n', stdout);
+    cpu = cpu_seconds() - cpu;
+    start = vcap_now() - start;
+    for (i = 0; i < n_devices; i++) {
+	vcap_stop(&devices[i]);
+	vcap_close(&devices[i]);
+    }
+    report(start, cpu);
     exit(EXIT_SUCCESS);
     return 0;
 }
@@ -0,0 +1,415 @@
+/*
+* vstress - mix format, input, standard and queue changes into a capture
+*
+* This program can be used and distributed without restrictions.
+*
+* Changing the capture while it runs goes through the slow and racy
+* parts of the driver: S_FMT, buffer_prepare() regenerating the RISC
+* programs, the queued chain in tw68_buffer_queue(), STREAMOFF tearing
+* the chains down and close() doing it behind the application's back.
+* This tool captures from one device (a tw68, or any V4L2 device such as
+* vivid for a dry run) and between bursts of frames does, at random:
+*
+*   fmt-busy   S_FMT to another size while streaming (EBUSY is fine)
+*   fmt        STREAMOFF, close, reopen at another size, STREAMON
+*   input      S_INPUT to another input (of those with a signal when
+*              the run starts) while streaming
+*   std        S_STD to another standard while streaming, and back to
+*              the one in use at startup
+*   restart    STREAMOFF and STREAMON again
+*   close      close() while streaming, reopen, STREAMON
+*
+* It fails (exit status 1) when
+*   - any operation takes longer than --hang seconds (a watchdog alarm),
+*   - no frame arrives for --hang seconds after an operation,
+*   - an ioctl fails with anything but the errors listed as expected,
+*   - the frame rate after the run is below --regress of the rate
+*     measured before it.
+* and reports, per operation, how often it ran, how often it failed as
+* expected, and its latency, so that the fast paths can be timed.
+*
+* Example, five minutes of mmap capture with a fixed seed:
+*   vstress -d /dev/video0 -t 300 -S 1
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>		/* getopt_long() */
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include "vcap.h"
+enum op {
+    OP_FMT_BUSY,
+    OP_FMT,
+    OP_INPUT,
+    OP_STD,
+    OP_RESTART,
+    OP_CLOSE,
+    N_OPS
+};
+static const char *op_name[N_OPS] = {
+    "fmt-busy", "fmt", "input", "std", "restart", "close"
+};
+struct op_result {
+    unsigned long runs;
+    unsigned long expected;	/* failed in an allowed way */
+    struct vcap_stat latency;	/* msecs */
+};
+static struct op_result results[N_OPS];
+static const struct {
+    unsigned int width, height;
+} sizes[] = {
+    {720, 576}, {720, 480}, {640, 480}, {352, 288}, {320, 240},
+    {176, 144},
+};
+#define N_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+static struct vcap dev;
+static const char *dev_name = "/dev/video";
+static struct vcap_config cfg = {
+    .io = IO_METHOD_MMAP,
+    .n_buffers = 4,
+    .width = 720,
+    .height = 576,
+    .pixelformat = V4L2_PIX_FMT_YUYV,
+    .field = V4L2_FIELD_INTERLACED,
+};
+static unsigned int inputs[64];	/* those with a signal at startup */
+static unsigned int n_inputs;
+static v4l2_std_id stds[64];
+static unsigned int n_stds;
+static v4l2_std_id std0;		/* standard at startup */
+static double run_seconds = 60;
+static double measure_seconds = 5;
+static unsigned int hang_seconds = 3;
+static double regress = 0.9;
+static unsigned int burst = 10;	/* max frames between operations */
+static unsigned int seed;
+static const char *volatile in_progress = "startup";
+
+static void watchdog(int sig)
+{
+    /* only async-signal-safe calls from here */
+    static const char msg[] = "vstress: HANG in ";
+    const char *op = (const char *) in_progress;
+    if (write(2, msg, sizeof(msg) - 1) < 0 ||
+	write(2, op, strlen(op)) < 0 || write(2, "\n", 1) < 0)
+	_exit(1);
+    _exit(1);
+}
+
+static void arm(const char *what)
+{
+    in_progress = what;
+    alarm(hang_seconds);
+}
+
+static void disarm(void)
+{
+    alarm(0);
+    in_progress = "idle";
+}
+
+static int xioctl(int fd, int request, void *arg)
+{
+    int r;
+    do
+	r = ioctl(fd, request, arg);
+    while (-1 == r && EINTR == errno);
+    return r;
+}
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "vstress: %s error %d, %s (seed %u)\n", what, errno,
+	    strerror(errno), seed);
+    exit(EXIT_FAILURE);
+}
+
+/* capture up to n frames; a silence of hang_seconds is a failure */
+static unsigned long capture(unsigned long n)
+{
+    unsigned long got = 0;
+    while (got < n) {
+	fd_set fds;
+	struct timeval tv;
+	int r;
+	FD_ZERO(&fds);
+	FD_SET(dev.fd, &fds);
+	tv.tv_sec = hang_seconds;
+	tv.tv_usec = 0;
+	r = select(dev.fd + 1, &fds, NULL, NULL, &tv);
+	if (-1 == r) {
+	    if (EINTR == errno)
+		continue;
+	    fail("select");
+	}
+	if (0 == r) {
+	    fprintf(stderr, "vstress: TIMEOUT, no frame for %u s after "
+		    "%s (seed %u)\n", hang_seconds, in_progress, seed);
+	    exit(EXIT_FAILURE);
+	}
+	arm("DQBUF/QBUF");
+	got += vcap_read_frame(&dev);
+	disarm();
+    }
+    return got;
+}
+
+static double measure_fps(void)
+{
+    double start = vcap_now(), t;
+    unsigned long frames = 0;
+    do {
+	frames += capture(1);
+	t = vcap_now() - start;
+    } while (t < measure_seconds);
+    return frames / t;
+}
+
+static void reopen(void)
+{
+    vcap_close(&dev);
+    vcap_open(&dev, dev_name, &cfg);
+    vcap_start(&dev);
+}
+
+/* returns 1 if the operation failed in an expected way */
+static int do_op(enum op op)
+{
+    struct v4l2_format fmt;
+    unsigned int i;
+    int input;
+    switch (op) {
+	case OP_FMT_BUSY:
+	    i = rand() % N_SIZES;
+	    memset(&fmt, 0, sizeof(fmt));
+	    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	    fmt.fmt.pix.width = sizes[i].width;
+	    fmt.fmt.pix.height = sizes[i].height;
+	    fmt.fmt.pix.pixelformat = cfg.pixelformat;
+	    fmt.fmt.pix.field = cfg.field;
+	    if (-1 == xioctl(dev.fd, VIDIOC_S_FMT, &fmt)) {
+		if (EBUSY == errno)
+		    return 1;
+		fail("VIDIOC_S_FMT");
+	    }
+	    return 0;
+	case OP_FMT:
+	    i = rand() % N_SIZES;
+	    cfg.width = sizes[i].width;
+	    cfg.height = sizes[i].height;
+	    vcap_stop(&dev);
+	    reopen();
+	    return 0;
+	case OP_INPUT:
+	    if (n_inputs < 2)
+		return 1;
+	    input = inputs[rand() % n_inputs];
+	    if (-1 == xioctl(dev.fd, VIDIOC_S_INPUT, &input)) {
+		if (EBUSY == errno)
+		    return 1;
+		fail("VIDIOC_S_INPUT");
+	    }
+	    return 0;
+	case OP_STD:
+	    if (n_stds < 2)
+		return 1;
+	    if (-1 == xioctl(dev.fd, VIDIOC_S_STD, &stds[rand() % n_stds])) {
+		if (EBUSY == errno)
+		    return 1;
+		fail("VIDIOC_S_STD");
+	    }
+	    /* another standard may well not match the signal */
+	    if (-1 == xioctl(dev.fd, VIDIOC_S_STD, &std0))
+		fail("VIDIOC_S_STD");
+	    return 0;
+	case OP_RESTART:
+	    vcap_stop(&dev);
+	    vcap_start(&dev);
+	    return 0;
+	case OP_CLOSE:
+	    reopen();
+	    return 0;
+	default:
+	    return 1;
+    }
+}
+
+static void enum_inputs_stds(void)
+{
+    struct v4l2_input input;
+    struct v4l2_standard std;
+    memset(&input, 0, sizeof(input));
+    for (input.index = 0; n_inputs < sizeof(inputs) / sizeof(inputs[0]) &&
+	 0 == xioctl(dev.fd, VIDIOC_ENUMINPUT, &input); input.index++)
+	if (!(input.status & V4L2_IN_ST_NO_SIGNAL))
+	    inputs[n_inputs++] = input.index;
+    memset(&std, 0, sizeof(std));
+    for (std.index = 0; n_stds < sizeof(stds) / sizeof(stds[0]) &&
+	 0 == xioctl(dev.fd, VIDIOC_ENUMSTD, &std); std.index++)
+	stds[n_stds++] = std.id;
+    if (-1 == xioctl(dev.fd, VIDIOC_G_STD, &std0))
+	n_stds = 0;
+}
+
+static void usage(FILE * fp, int argc, char **argv)
+{
+    fprintf(fp,
+	    "Usage: %s [options]\n\n"
+	    "Options:\n"
+	    "-d | --device name   Video device name [/dev/video]\n"
+	    "-h | --help          Print this message\n"
+	    "-u | --userp         Use application allocated buffers\n"
+	    "                     (default: memory mapped buffers)\n"
+	    "-b | --buffers n     Buffers to request [4]\n"
+	    "-f | --format fourcc Pixel format [YUYV]\n"
+	    "-t | --time secs     Length of the stress run [60]\n"
+	    "-m | --measure secs  Length of the frame rate measurement\n"
+	    "                     before and after the run [5]\n"
+	    "-B | --burst n       At most n frames between operations [10]\n"
+	    "-H | --hang secs     Watchdog for operations and frames [3]\n"
+	    "-r | --regress x     Fail if the final frame rate is below\n"
+	    "                     x times the initial one [0.9]\n"
+	    "-S | --seed n        Random seed [time]\n"
+	    "", argv[0]);
+}
+
+static const char short_options[] = "d:hub:f:t:m:B:H:r:S:";
+static const struct option long_options[] = {
+    {"device", required_argument, NULL, 'd'},
+    {"help", no_argument, NULL, 'h'},
+    {"userp", no_argument, NULL, 'u'},
+    {"buffers", required_argument, NULL, 'b'},
+    {"format", required_argument, NULL, 'f'},
+    {"time", required_argument, NULL, 't'},
+    {"measure", required_argument, NULL, 'm'},
+    {"burst", required_argument, NULL, 'B'},
+    {"hang", required_argument, NULL, 'H'},
+    {"regress", required_argument, NULL, 'r'},
+    {"seed", required_argument, NULL, 'S'},
+    {0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+    struct vcap_config initial;
+    double start, t0, before, after;
+    unsigned long frames = 0, ops = 0;
+    unsigned int i;
+    seed = time(NULL);
+    for (;;) {
+	int index;
+	int c;
+	c = getopt_long(argc, argv, short_options, long_options, &index);
+	if (-1 == c)
+	    break;
+	switch (c) {
+	    case 0:		/* getopt_long() flag */
+		break;
+	    case 'd':
+		dev_name = optarg;
+		break;
+	    case 'h':
+		usage(stdout, argc, argv);
+		exit(EXIT_SUCCESS);
+	    case 'u':
+		cfg.io = IO_METHOD_USERPTR;
+		break;
+	    case 'b':
+		cfg.n_buffers = strtoul(optarg, NULL, 0);
+		if (cfg.n_buffers < 2)
+		    cfg.n_buffers = 2;
+		break;
+	    case 'f':
+		if (strlen(optarg) != 4) {
+		    fprintf(stderr, "format must be a fourcc\n");
+		    exit(EXIT_FAILURE);
+		}
+		cfg.pixelformat = v4l2_fourcc(optarg[0], optarg[1],
+					      optarg[2], optarg[3]);
+		break;
+	    case 't':
+		run_seconds = strtod(optarg, NULL);
+		break;
+	    case 'm':
+		measure_seconds = strtod(optarg, NULL);
+		break;
+	    case 'B':
+		burst = strtoul(optarg, NULL, 0);
+		break;
+	    case 'H':
+		hang_seconds = strtoul(optarg, NULL, 0);
+		if (0 == hang_seconds)
+		    hang_seconds = 1;
+		break;
+	    case 'r':
+		regress = strtod(optarg, NULL);
+		break;
+	    case 'S':
+		seed = strtoul(optarg, NULL, 0);
+		break;
+	    default:
+		usage(stderr, argc, argv);
+		exit(EXIT_FAILURE);
+	}
+    }
+    initial = cfg;
+    srand(seed);
+    signal(SIGALRM, watchdog);
+    printf("seed %u\n", seed);
+    arm("open");
+    vcap_open(&dev, dev_name, &cfg);
+    enum_inputs_stds();
+    vcap_start(&dev);
+    disarm();
+    before = measure_fps();
+    start = vcap_now();
+    while (vcap_now() - start < run_seconds) {
+	enum op op = rand() % N_OPS;
+	int expected;
+	if (burst)
+	    frames += capture(rand() % (burst + 1));
+	t0 = vcap_now();
+	arm(op_name[op]);
+	expected = do_op(op);
+	disarm();
+	results[op].runs++;
+	if (expected)
+	    results[op].expected++;
+	else
+	    vcap_stat_add(&results[op].latency, (vcap_now() - t0) * 1000);
+	ops++;
+	/* whatever was done, frames must keep coming */
+	in_progress = op_name[op];
+	frames += capture(1);
+    }
+    /* back to the starting point before measuring again */
+    cfg = initial;
+    arm("final reopen");
+    vcap_stop(&dev);
+    reopen();
+    disarm();
+    after = measure_fps();
+    vcap_stop(&dev);
+    vcap_close(&dev);
+    printf("%lu operations, %lu frames in %.1f s, %u live inputs, "
+	   "%u standards\n", ops, frames, run_seconds, n_inputs, n_stds);
+    for (i = 0; i < N_OPS; i++)
+	printf("%-9s %6lu runs %6lu expected failures  "
+	       "latency ms mean %8.3f max %8.3f\n", op_name[i],
+	       results[i].runs, results[i].expected,
+	       vcap_stat_mean(&results[i].latency),
+	       results[i].latency.max);
+    printf("fps before %.2f, after %.2f\n", before, after);
+    if (after < regress * before) {
+	printf("FAIL: frame rate regressed (seed %u)\n", seed);
+	exit(EXIT_FAILURE);
+    }
+    printf("PASS\n");
+    exit(EXIT_SUCCESS);
+    return 0;
+}